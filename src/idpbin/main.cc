@@ -22,6 +22,24 @@ static const int ROBOT = 0;
 static const int ROBOT = 39;
 #endif
 
+/**
+ * Which HAL backend to drive, chosen on the command line: --sim for the
+ * in-process simulator, --replay to play back the link log, otherwise the
+ * real robot.
+ */
+static IDP::HALBackend backend = IDP::HAL_BACKEND_LINK;
+
+/**
+ * Whether to record all link traffic, chosen with --record.
+ */
+static bool record = false;
+
+/**
+ * Whether to run the robot link on its own I/O thread, chosen with
+ * --async. Only applies to the real robot.
+ */
+static bool async = false;
+
 /**
  * Global reference to our Mission Supervisor so we can use it inside
  * terminate()
@@ -53,6 +71,12 @@ void terminate(int param)
         tests->stop();
     }
 
+    // Show where the link time went, and keep the link log
+    if(missup) {
+        missup->hal()->dump_stats();
+        missup->hal()->flush_link_log();
+    }
+
     // Save state from missup
     if(missup) {
         std::ofstream f("statefile");
@@ -74,7 +98,7 @@ void terminate(int param)
 void run_self_test(IDP::MenuChoice choice)
 {
     // One of the tests was selected, so initialise tests
-    tests = new IDP::SelfTests(ROBOT);
+    tests = new IDP::SelfTests(ROBOT, backend, record, async);
     if(choice == IDP::MENU_RUN_ALL_SELF_TESTS) {
         // TODO: this complete self test routine
     } else if(choice == IDP::MENU_LINE_FOLLOWING_TEST) {
@@ -131,6 +155,8 @@ void run_self_test(IDP::MenuChoice choice)
         tests->bad_bobbin_LED();
     } else if(choice == IDP::MENU_CALIBRATE) {
         tests->calibrate();
+    } else if(choice == IDP::MENU_CALIBRATE_ODOMETRY) {
+        tests->calibrate_odometry();
     } else {
         std::cout << "Invalid selection received from menu, quitting.";
         std::cout << std::endl;
@@ -143,9 +169,29 @@ void run_self_test(IDP::MenuChoice choice)
 
 /**
  * Code entry point and main loop.
+ * \param argc Argument count
+ * \param argv Arguments, optionally --sim or --replay, --record and
+ * --async
  */
-int main()
+int main(int argc, char* argv[])
 {
+    // Pick the backend
+    for(int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if(arg == "--sim") {
+            backend = IDP::HAL_BACKEND_SIMULATOR;
+        } else if(arg == "--replay") {
+            backend = IDP::HAL_BACKEND_REPLAY;
+        } else if(arg == "--record") {
+            record = true;
+        } else if(arg == "--async") {
+            async = true;
+        } else {
+            std::cout << "Unknown argument " << arg << ", ignoring.";
+            std::cout << std::endl;
+        }
+    }
+
     // Set up ctrl-c catching
     struct sigaction sigint_handler;
     sigint_handler.sa_handler = terminate;
@@ -166,7 +212,8 @@ int main()
             return 0;
         } else if(choice == IDP::MENU_RUN_MAIN_TASK) {
             // Make a MissionSupervisor
-            missup = new IDP::MissionSupervisor(ROBOT);
+            missup = new IDP::MissionSupervisor(ROBOT, backend,
+                record, async);
 
             // Check if we should load a state file
             std::cout << "Load state file? (y/N) > ";
@@ -25,6 +25,7 @@ namespace IDP {
             std::cout << "1) Run Main Task" << std::endl;
             std::cout << "2) Run Self Tests" << std::endl;
             std::cout << "3) Calibrate levels" << std::endl;
+            std::cout << "4) Calibrate odometry" << std::endl;
             std::cout << "q) Quit" << std::endl;
             std::cout << std::endl << "> ";
 
@@ -57,6 +58,8 @@ namespace IDP {
                     return option;
             } else if(choice == "3") {
                 return MENU_CALIBRATE;
+            } else if(choice == "4") {
+                return MENU_CALIBRATE_ODOMETRY;
             } else if(choice == "q") {
                 return MENU_QUIT;
             } else {
@@ -25,7 +25,7 @@ namespace IDP {
         MENU_NAVIGATE_TO_BOBBIN, MENU_NAVIGATE_TO_BOX_FOR_PICKUP,
         MENU_NAVIGATE_TO_BOX_FOR_DROP, MENU_BOBBIN_PRESENT,
         MENU_NAVIGATE_TO_DELIVERY, MENU_DELIVERY, MENU_BOX_PRESENT,
-        MENU_BOX_COLOUR, MENU_CALIBRATE,
+        MENU_BOX_COLOUR, MENU_CALIBRATE, MENU_CALIBRATE_ODOMETRY,
         MAX_MENU_CHOICE
     };
 
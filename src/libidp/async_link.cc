@@ -0,0 +1,284 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// async_link.cc
+// Asynchronous Link class implementation
+
+#include "async_link.h"
+#include "hal.h"
+#include "link_stats.h"
+
+#include <sched.h>
+
+// Debug functionality
+#define MODULE_NAME "AsyncLink"
+#define TRACE_ENABLED   false
+#define DEBUG_ENABLED   false
+#define INFO_ENABLED    true
+#define ERROR_ENABLED   true
+#include "debug.h"
+
+namespace IDP {
+
+    /**
+     * Start the I/O thread, which takes over the given link.
+     * \param rlink An initialised robot_link, which must not be used by
+     * anything else until this AsyncLink is destroyed
+     * \param stats Where to record the time each exchange takes
+     */
+    AsyncLink::AsyncLink(robot_link* rlink, LinkStats* stats): _rlink(rlink),
+        _stats(stats), _running(true),
+        _head(0), _tail(0), _stop_requested(0), _stop_fence(0),
+        _skip_motors_until(0), _command_failed(false), _sequence(0),
+        _polls(0)
+    {
+        TRACE("AsyncLink(" << rlink << ", " << stats << ")");
+        INFO("Starting link I/O thread");
+
+        // Fill the mailbox before the control thread can read it
+        this->_sample.port0 = 0xFF;
+        this->_sample.adc0 = this->_sample.adc1 = 0;
+        this->_sample.status = 0;
+        this->_sample.status_reads = 0;
+        this->_sample.timestamp = 0;
+        this->_sample.error = false;
+        this->poll();
+
+        if(pthread_create(&this->_thread, 0, AsyncLink::run, this)) {
+            ERROR("Could not start the link I/O thread");
+            this->_running = false;
+        }
+    }
+
+    /**
+     * Stop the I/O thread once it has sent every queued command.
+     */
+    AsyncLink::~AsyncLink()
+    {
+        TRACE("~AsyncLink()");
+        if(this->_running) {
+            INFO("Stopping link I/O thread");
+            this->_running = false;
+            pthread_join(this->_thread, 0);
+        }
+
+        // Anything still queued goes out before the link is handed back
+        this->drain_queue();
+    }
+
+    /**
+     * Whether the I/O thread is running. If it could not be started,
+     * nothing will ever send the commands queued, so the link should be
+     * used synchronously instead.
+     * \returns true if the I/O thread is running
+     */
+    bool AsyncLink::running() const
+    {
+        return this->_running;
+    }
+
+    /**
+     * Queue a command for the I/O thread. Only blocks if the queue is
+     * full.
+     * \param cmd The command opcode
+     * \param arg The command argument
+     */
+    void AsyncLink::command(const command_instruction cmd, const int arg)
+    {
+        TRACE("command(" << cmd << ", " << arg << ")");
+
+        unsigned int head = this->_head;
+        while(head - this->_tail >= ASYNC_QUEUE_SIZE) {
+            DEBUG("Command queue full, waiting");
+            sched_yield();
+        }
+
+        robot_command& slot = this->_queue[head & (ASYNC_QUEUE_SIZE - 1)];
+        slot.opcode = cmd;
+        slot.parameter = static_cast<unsigned char>(arg);
+
+        // Make the slot visible before publishing the new head
+        __sync_synchronize();
+        this->_head = head + 1;
+    }
+
+    /**
+     * Ask the I/O thread to stop both motors before anything else it has
+     * queued. Safe to call from a signal handler.
+     */
+    void AsyncLink::stop()
+    {
+        TRACE("stop()");
+        this->_stop_fence = this->_head;
+        __sync_synchronize();
+        __sync_lock_test_and_set(&this->_stop_requested, 1);
+    }
+
+    /**
+     * Read the most recently polled sensor values without blocking.
+     * \returns An AsyncLinkSample
+     */
+    AsyncLinkSample AsyncLink::latest() const
+    {
+        TRACE("latest()");
+        AsyncLinkSample sample;
+        unsigned int before, after;
+        do {
+            before = this->_sequence;
+            __sync_synchronize();
+            sample = this->_sample;
+            __sync_synchronize();
+            after = this->_sequence;
+        } while(before != after || (before & 1));
+        return sample;
+    }
+
+    /**
+     * pthread entry point.
+     * \param self The AsyncLink to run
+     */
+    void* AsyncLink::run(void* self)
+    {
+        static_cast<AsyncLink*>(self)->loop();
+        return 0;
+    }
+
+    /**
+     * The I/O thread's main loop: service stops first, then queued
+     * commands, then refresh the mailbox.
+     */
+    void AsyncLink::loop()
+    {
+        while(this->_running) {
+            this->send_stop();
+            this->drain_queue();
+            this->poll();
+        }
+    }
+
+    /**
+     * Send a pending stop request, if there is one.
+     */
+    void AsyncLink::send_stop()
+    {
+        if(!__sync_lock_test_and_set(&this->_stop_requested, 0))
+            return;
+
+        DEBUG("Sending priority stop");
+        if(!this->_rlink->command(BOTH_MOTORS_GO_SAME, 0))
+            this->_command_failed = true;
+        __sync_synchronize();
+        this->_skip_motors_until = this->_stop_fence;
+    }
+
+    /**
+     * Send every command currently in the queue, checking for a stop
+     * request before each one.
+     */
+    void AsyncLink::drain_queue()
+    {
+        unsigned int head = this->_head;
+        __sync_synchronize();
+
+        while(this->_tail != head) {
+            this->send_stop();
+
+            unsigned int tail = this->_tail;
+            const robot_command& cmd =
+                this->_queue[tail & (ASYNC_QUEUE_SIZE - 1)];
+            bool motor = cmd.opcode == MOTOR_1_GO ||
+                cmd.opcode == MOTOR_2_GO ||
+                cmd.opcode == BOTH_MOTORS_GO_SAME ||
+                cmd.opcode == BOTH_MOTORS_GO_OPPOSITE;
+
+            // Signed difference copes with the indices wrapping
+            int before_stop =
+                static_cast<int>(this->_skip_motors_until - tail);
+            if(motor && before_stop > 0) {
+                DEBUG("Dropping motor command queued before a stop");
+            } else {
+                unsigned long long int start = monotonic_time_us();
+                if(!this->_rlink->command(cmd.opcode, cmd.parameter))
+                    this->_command_failed = true;
+                this->_stats->record(cmd.opcode, monotonic_time_us() - start);
+            }
+
+            // Finish with the slot before handing it back
+            __sync_synchronize();
+            this->_tail = tail + 1;
+        }
+    }
+
+    /**
+     * Read the sensors in one batch and publish them to the mailbox. If
+     * any read, or any command since the last poll, fails, the values
+     * from the last good poll are kept and the sample is marked as an
+     * error.
+     */
+    void AsyncLink::poll()
+    {
+        robot_request batch[3] = {{READ_PORT_0, 0}, {ADC0, 0}, {ADC1, 0}};
+        int errors = this->link_errors();
+        this->_rlink->clear_errs();
+        unsigned long long int start = monotonic_time_us();
+        for(int i = 0; i < 3; i++) {
+            *this->_rlink >> batch[i];
+            unsigned long long int end = monotonic_time_us();
+            this->_stats->record(batch[i].opcode, end - start);
+            start = end;
+        }
+
+        int status = this->_sample.status;
+        unsigned int status_reads = this->_sample.status_reads;
+        bool error = this->link_errors() != errors ||
+            this->_rlink->any_errs();
+        if(!error && this->_polls++ % ASYNC_STATUS_POLL_INTERVAL == 0) {
+            int value = this->_rlink->request(STATUS);
+            unsigned long long int end = monotonic_time_us();
+            this->_stats->record(STATUS, end - start);
+            start = end;
+            if(value == REQUEST_ERROR) {
+                error = true;
+            } else {
+                status = value;
+                status_reads++;
+            }
+        }
+
+        if(error) {
+            DEBUG("Sensor poll failed");
+        }
+        if(this->_command_failed) {
+            DEBUG("Command failed since the last poll");
+            error = true;
+            this->_command_failed = false;
+        }
+
+        this->_sequence++;
+        __sync_synchronize();
+        if(!error) {
+            this->_sample.port0 = batch[0].parameter;
+            this->_sample.adc0 = batch[1].parameter;
+            this->_sample.adc1 = batch[2].parameter;
+            this->_sample.status = status;
+            this->_sample.status_reads = status_reads;
+            this->_sample.timestamp = start;
+        }
+        this->_sample.error = error;
+        __sync_synchronize();
+        this->_sequence++;
+    }
+
+    /**
+     * Total the robot link's error counters, so a failed poll can be
+     * spotted by the count changing. Errors such as the link not being
+     * set up only show in its error buffer.
+     * \returns The total error count
+     */
+    int AsyncLink::link_errors() const
+    {
+        return this->_rlink->send_errs + this->_rlink->recv_errs +
+            this->_rlink->cmd_errs;
+    }
+}
+
@@ -0,0 +1,109 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// async_link.h
+// Asynchronous Link class definition
+//
+// Asynchronous Link - own the robot link on a dedicated I/O thread so the
+// control code never blocks on a round trip
+
+#pragma once
+#ifndef LIBIDP_ASYNC_LINK_H
+#define LIBIDP_ASYNC_LINK_H
+
+#include <pthread.h>
+#include <robot_link.h>
+
+namespace IDP {
+
+    class LinkStats;
+
+    /**
+     * How many commands may be queued for the I/O thread. Must be a power
+     * of two.
+     */
+    const unsigned int ASYNC_QUEUE_SIZE = 64;
+
+    /**
+     * The I/O thread reads the STATUS register once every this many
+     * sensor polls.
+     */
+    const unsigned int ASYNC_STATUS_POLL_INTERVAL = 16;
+
+    /**
+     * The raw sensor values most recently polled by the I/O thread.
+     * error is set if the last poll, or any command sent since the one
+     * before it, failed, in which case the values are those of the last
+     * poll that worked.
+     */
+    struct AsyncLinkSample
+    {
+        int port0;
+        int adc0;
+        int adc1;
+        int status;
+        unsigned int status_reads;
+        unsigned long long int timestamp;
+        bool error;
+    };
+
+    /**
+     * Own a robot_link on a dedicated I/O thread.
+     *
+     * Commands are passed to the thread through a lock-free single
+     * producer, single consumer ring. The thread continually polls the
+     * sensors into a mailbox which can be read without blocking. Stop
+     * requests bypass the ring entirely, so they never wait behind queued
+     * commands.
+     *
+     * Only one thread (the control thread) may call command(), stop()
+     * and latest().
+     */
+    class AsyncLink
+    {
+        public:
+            AsyncLink(robot_link* rlink, LinkStats* stats);
+            ~AsyncLink();
+            bool running() const;
+            void command(const command_instruction cmd, const int arg);
+            void stop();
+            AsyncLinkSample latest() const;
+        private:
+            static void* run(void* self);
+            void loop();
+            void send_stop();
+            void drain_queue();
+            void poll();
+            int link_errors() const;
+            robot_link* _rlink;
+            LinkStats* _stats;
+            pthread_t _thread;
+            volatile bool _running;
+
+            // Command ring. _head is only written by the control thread and
+            // _tail only by the I/O thread.
+            robot_command _queue[ASYNC_QUEUE_SIZE];
+            volatile unsigned int _head;
+            volatile unsigned int _tail;
+
+            // Priority stop lane. _stop_fence is the ring position when
+            // the stop was requested; queued motor commands before it are
+            // dropped rather than restarting the motors.
+            volatile int _stop_requested;
+            volatile unsigned int _stop_fence;
+            unsigned int _skip_motors_until;
+
+            // Set by the I/O thread when a command fails, until the next
+            // poll publishes it
+            bool _command_failed;
+
+            // Latest-value mailbox, guarded by a sequence count which is
+            // odd while the I/O thread is writing.
+            volatile unsigned int _sequence;
+            AsyncLinkSample _sample;
+            unsigned int _polls;
+    };
+}
+
+#endif /* LIBIDP_ASYNC_LINK_H */
+
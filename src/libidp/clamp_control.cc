@@ -4,9 +4,6 @@
 // clamp_control.cc
 // Clamp Control class implementation
 
-// Use unistd.h for sleep functionality
-#include <unistd.h>
-
 // abs()
 #include <cstdlib>
 
@@ -30,7 +27,9 @@ namespace IDP {
      * \param hal A const pointer to an instance of the HAL
      */
     ClampControl::ClampControl(HardwareAbstractionLayer* hal): _hal(hal),
-    _arm_up(true), _jaw_open(true)
+    _arm_up(true), _jaw_open(true), _presence_phase(PRESENCE_IDLE),
+    _presence_ticks(0), _presence_total(0), _bobbin_present(false),
+    _box_present(false)
     {
         TRACE("ClampControl("<<hal<<")");
         INFO("Initialising a ClampControl");
@@ -98,7 +97,8 @@ namespace IDP {
         //if(!this->_arm_up) {
             DEBUG("Lifting the grabber");
             this->_hal->grabber_lift(true);
-            usleep(1500000);
+            this->_hal->flush();
+            this->_hal->pause(1500000);
             this->_arm_up = true;
         //} else {
             //DEBUG("Asked to raise the arm but it was already raised");
@@ -114,7 +114,8 @@ namespace IDP {
         //if(this->_arm_up) {
             DEBUG("Lowering the grabber");
             this->_hal->grabber_lift(false);
-            usleep(2000000);
+            this->_hal->flush();
+            this->_hal->pause(2000000);
             this->_arm_up = false;
         //} else {
             //DEBUG("Asked to lower the grabber but it was already lowered");
@@ -130,7 +131,8 @@ namespace IDP {
         //if(!this->_jaw_open) {
             DEBUG("Releasing the grabber jaw");
             this->_hal->grabber_jaw(false);
-            usleep(1000000);
+            this->_hal->flush();
+            this->_hal->pause(1000000);
             this->_jaw_open = true;
         //} else {
             //DEBUG("Asked to open the jaw but it was already open");
@@ -146,7 +148,8 @@ namespace IDP {
         //if(this->_jaw_open) {
             DEBUG("Clamping the grabber jaw");
             this->_hal->grabber_jaw(true);
-            usleep(1000000);
+            this->_hal->flush();
+            this->_hal->pause(1000000);
             this->_jaw_open = false;
         //} else {
             //DEBUG("Asked to close the jaw but it was already closed");
@@ -174,7 +177,8 @@ namespace IDP {
         {
             DEBUG("Found a red bobbin");
             this->_hal->indication_LEDs(false, false, true);
-            usleep(500000);
+            this->_hal->flush();
+            this->_hal->pause(500000);
             this->_hal->indication_LEDs(true, true, true);
             return BOBBIN_RED;
         }
@@ -182,7 +186,8 @@ namespace IDP {
         {
             DEBUG("Found a green bobbin");
             this->_hal->indication_LEDs(false, true, false);
-            usleep(500000);
+            this->_hal->flush();
+            this->_hal->pause(500000);
             this->_hal->indication_LEDs(true, true, true);
             return BOBBIN_GREEN;
         }
@@ -190,7 +195,8 @@ namespace IDP {
         {
             DEBUG("Found a white bobbin");
             this->_hal->indication_LEDs(true, false, false);
-            usleep(500000);
+            this->_hal->flush();
+            this->_hal->pause(500000);
             this->_hal->indication_LEDs(true, true, true);
             return BOBBIN_WHITE;
         }
@@ -216,7 +222,8 @@ namespace IDP {
         {
             DEBUG("Found a red bobbin in a box");
             this->_hal->indication_LEDs(false, false, true);
-            usleep(500000);
+            this->_hal->flush();
+            this->_hal->pause(500000);
             this->_hal->indication_LEDs(true, true, true);
             return BOBBIN_RED;
         }
@@ -224,7 +231,8 @@ namespace IDP {
         {
             DEBUG("Found a green bobbin in a box");
             this->_hal->indication_LEDs(false, true, false);
-            usleep(500000);
+            this->_hal->flush();
+            this->_hal->pause(500000);
             this->_hal->indication_LEDs(true, true, true);
             return BOBBIN_GREEN;
         }
@@ -232,7 +240,8 @@ namespace IDP {
         {
             DEBUG("Found a white bobbin in a box");
             this->_hal->indication_LEDs(true, false, false);
-            usleep(500000);
+            this->_hal->flush();
+            this->_hal->pause(500000);
             this->_hal->indication_LEDs(true, true, true);
             return BOBBIN_WHITE;
         }
@@ -277,71 +286,148 @@ namespace IDP {
      * bobbins reflect about the same amount, but when present without lights
      * on they will block a good deal of light from hitting the sensor anyway,
      * so we can detect them as such.
-     * \returns True when a bobbin is found
+     *
+     * Each call takes one reading from the frame for this control tick, so
+     * the check runs over several calls: an average in the light, a wait
+     * for the sensor to settle in the dark, then an average in the dark.
+     * \param frame The SensorFrame for this control tick
+     * \returns True if the last complete check found a bobbin
      */
-    bool ClampControl::bobbin_present()
+    bool ClampControl::bobbin_present(const SensorFrame& frame)
     {
-        TRACE("bobbin_present()");
-        DEBUG("Checking for bobbins..."); 
-
-        // Turn on the light
-        this->_hal->colour_LED(true);
-        this->_hal->bad_bobbin_LED(false);
-
-        // Get a reading in the light (for red and green)
-        unsigned short int reading = this->average_colour_ldr();
-        short int delta = reading - this->_colour_light_zero;
-        
-        // Turn off the light
-        this->_hal->colour_LED(false);
+        TRACE("bobbin_present(frame)");
 
-        DEBUG("Light: Read " << reading << ", delta " << delta);
-
-        // If the light reading indicates that we found a bobbin, we can return
-        if(delta < _coloured_present_level)
-            return true;
-
-        // Discard readings while it settles
-        this->average_bad_ldr(10);
-
-        // Take a reading with lights off (for white)
-        reading = this->average_bad_ldr();
-        delta = reading - this->_badness_dark_zero;
+        if(this->_presence_phase == PRESENCE_IDLE ||
+            this->_presence_phase == PRESENCE_BOX)
+        {
+            DEBUG("Checking for bobbins...");
+            this->start_presence(PRESENCE_LIGHT);
+        }
 
-        DEBUG("Dark: Read " << reading << ", delta " << delta);
+        if(this->_presence_phase == PRESENCE_LIGHT) {
+            // Turn on the light
+            this->_hal->colour_LED(true);
+            this->_hal->bad_bobbin_LED(false);
+
+            // Average the readings in the light (for red and green)
+            if(!this->presence_reading(frame.colour_ldr))
+                return this->_bobbin_present;
+            unsigned short int reading = this->_presence_total /
+                PRESENCE_SAMPLES;
+            short int delta = reading - this->_colour_light_zero;
+            DEBUG("Light: Read " << reading << ", delta " << delta);
+
+            // If the light reading indicates that we found a bobbin, we
+            // can stop there and check again in the light
+            if(delta < _coloured_present_level) {
+                this->_bobbin_present = true;
+                this->start_presence(PRESENCE_LIGHT);
+            } else {
+                this->start_presence(PRESENCE_SETTLING);
+            }
+        } else if(this->_presence_phase == PRESENCE_SETTLING) {
+            // Turn off the light and discard readings while it settles
+            this->_hal->colour_LED(false);
+            if(++this->_presence_ticks >= PRESENCE_SETTLE_TICKS)
+                this->start_presence(PRESENCE_DARK);
+        } else {
+            // Average the readings with lights off (for white)
+            if(!this->presence_reading(frame.bad_bobbin_ldr))
+                return this->_bobbin_present;
+            unsigned short int reading = this->_presence_total /
+                PRESENCE_SAMPLES;
+            short int delta = reading - this->_badness_dark_zero;
+            DEBUG("Dark: Read " << reading << ", delta " << delta);
+
+            this->_bobbin_present = delta > _white_present_level;
+            this->start_presence(PRESENCE_LIGHT);
+        }
 
-        return (delta > _white_present_level);
+        return this->_bobbin_present;
     }
 
     /**
      * See if a box is under the jaw.
      *
      * We do this by checking for reflections of the steel box under the bad
-     * bobbin sensor.
+     * bobbin sensor. Each call takes one reading from the frame for this
+     * control tick, and the check is made on the average of several.
+     * \param frame The SensorFrame for this control tick
+     * \returns True if the last complete check found a box
      */
-    bool ClampControl::box_present()
+    bool ClampControl::box_present(const SensorFrame& frame)
     {
-        TRACE("box_present()");
-        DEBUG("Checking for a box...");
-        
+        TRACE("box_present(frame)");
+
+        if(this->_presence_phase != PRESENCE_BOX) {
+            DEBUG("Checking for a box...");
+            this->start_presence(PRESENCE_BOX);
+        }
+
         // Turn on the light
         this->_hal->bad_bobbin_LED(true);
         this->_hal->colour_LED(false);
 
-        // Read the LDR
-        unsigned short int reading = this->average_bad_ldr();
-        short int delta = reading - this->_badness_light_zero;
+        // Average the readings
+        if(this->presence_reading(frame.bad_bobbin_ldr)) {
+            unsigned short int reading = this->_presence_total /
+                PRESENCE_SAMPLES;
+            short int delta = reading - this->_badness_light_zero;
+            DEBUG("Reading " << reading << ", delta " << delta);
+
+            this->_box_present = delta > _box_present_level;
+            this->start_presence(PRESENCE_BOX);
+        }
+
+        return this->_box_present;
+    }
 
-        // Turn off the light
+    /**
+     * Stop checking for bobbins or boxes, turning off the lights. The
+     * next box check starts afresh, while a bobbin found is remembered so
+     * that the next bobbin run first waits to leave it.
+     */
+    void ClampControl::end_presence()
+    {
+        TRACE("end_presence()");
+        this->_hal->colour_LED(false);
         this->_hal->bad_bobbin_LED(false);
+        this->_presence_phase = PRESENCE_IDLE;
+        this->_box_present = false;
+    }
 
-        DEBUG("Reading " << reading << ", delta " << delta);
+    /**
+     * Start a phase of the presence checks, discarding any readings so
+     * far.
+     * \param phase The ClampPresencePhase to start
+     */
+    void ClampControl::start_presence(const ClampPresencePhase phase)
+    {
+        this->_presence_phase = phase;
+        this->_presence_ticks = 0;
+        this->_presence_total = 0;
+    }
 
-        return (delta > _box_present_level);
+    /**
+     * Add a reading to the running average for this phase of the
+     * presence checks. The first reading of each phase is discarded, as
+     * the frame was sampled before the lights were set for it.
+     * \param reading The LDR reading from this tick's frame
+     * \returns true once there are PRESENCE_SAMPLES readings in the total
+     */
+    bool ClampControl::presence_reading(const unsigned short int reading)
+    {
+        if(this->_presence_ticks++ == 0)
+            return false;
+        this->_presence_total += reading;
+        return this->_presence_ticks > PRESENCE_SAMPLES;
     }
 
     /**
      * Take an average bad bobbin LDR reading of n samples.
+     *
+     * Each sample is a full SensorFrame, so the last frame taken is left
+     * in the HAL for line following to reuse.
      * \param n Number of samples to take, default 3
      */
     unsigned short int ClampControl::average_bad_ldr(unsigned short int n)
@@ -352,12 +438,15 @@ namespace IDP {
         unsigned int total = 0;
         unsigned short int i;
         for(i = 0; i < n; i++)
-            total += this->_hal->bad_bobbin_ldr();
+            total += this->_hal->sample().bad_bobbin_ldr;
         return static_cast<unsigned short int>(total / n);
     }
 
     /**
      * Take an average colour LDR reading of n samples.
+     *
+     * Each sample is a full SensorFrame, so the last frame taken is left
+     * in the HAL for line following to reuse.
      * \param n Number of samples to take, default 3
      */
     unsigned short int ClampControl::average_colour_ldr(unsigned short int n)
@@ -368,7 +457,7 @@ namespace IDP {
         unsigned int total = 0;
         unsigned short int i;
         for(i = 0; i < n; i++)
-            total += this->_hal->colour_ldr();
+            total += this->_hal->sample().colour_ldr;
         return static_cast<unsigned short int>(total / n);
     }
 
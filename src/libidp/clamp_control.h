@@ -14,6 +14,18 @@
 namespace IDP {
 
     class HardwareAbstractionLayer;
+    struct SensorFrame;
+
+    /**
+     * How many readings the presence checks average over.
+     */
+    const unsigned int PRESENCE_SAMPLES = 3;
+
+    /**
+     * How many ticks the bad bobbin LDR is left to settle with the
+     * lights off before the dark readings are taken.
+     */
+    const unsigned int PRESENCE_SETTLE_TICKS = 10;
 
     /**
      * Bobbin colours
@@ -33,6 +45,31 @@ namespace IDP {
         BOBBIN_BAD
     };
     
+    /**
+     * What the presence checks are reading, one tick at a time.
+     *
+     * PRESENCE_IDLE is not checking, with the lights off.
+     *
+     * PRESENCE_LIGHT is reading the colour LDR with its LED on, for red
+     * and green bobbins.
+     *
+     * PRESENCE_SETTLING is waiting for the bad bobbin LDR to settle with
+     * the lights off.
+     *
+     * PRESENCE_DARK is reading the bad bobbin LDR with the lights off, for
+     * white bobbins.
+     *
+     * PRESENCE_BOX is reading the bad bobbin LDR with its LED on, for the
+     * top of a box.
+     */
+    enum ClampPresencePhase {
+        PRESENCE_IDLE,
+        PRESENCE_LIGHT,
+        PRESENCE_SETTLING,
+        PRESENCE_DARK,
+        PRESENCE_BOX
+    };
+
     /**
      * String representation of BobbinColour
      */
@@ -64,8 +101,9 @@ namespace IDP {
             BobbinColour colour() const;
             BobbinColour box_colour() const;
             BobbinBadness badness() const;
-            bool bobbin_present();
-            bool box_present();
+            bool bobbin_present(const SensorFrame& frame);
+            bool box_present(const SensorFrame& frame);
+            void end_presence();
             void open_jaw(void);
             void close_jaw(void);
             void raise_arm(void);
@@ -75,6 +113,8 @@ namespace IDP {
             unsigned short int average_colour_ldr(unsigned short int n = 3)
                 const;
         private:
+            void start_presence(const ClampPresencePhase phase);
+            bool presence_reading(const unsigned short int reading);
             HardwareAbstractionLayer* _hal;
             short int _red_box_level;
             short int _green_box_level;
@@ -90,6 +130,11 @@ namespace IDP {
             short int _colour_light_box_zero;
             bool _arm_up;
             bool _jaw_open;
+            ClampPresencePhase _presence_phase;
+            unsigned int _presence_ticks;
+            unsigned int _presence_total;
+            bool _bobbin_present;
+            bool _box_present;
     };
 }
 
@@ -5,9 +5,19 @@
 // Hardware Abstraction Layer implementation
 
 #include "hal.h"
+#include "async_link.h"
+#include "sim_link.h"
+#include "replay_link.h"
+#include "link_log.h"
+#include "link_stats.h"
+#include "status_watchdog.h"
+#include "scheduler.h"
+#include "odometry.h"
 
-#include <iostream>
 #include <cstdlib>
+#include <iostream>
+#include <unistd.h>
+#include <time.h>
 
 #include <robot_instr.h>
 
@@ -26,41 +36,87 @@ namespace IDP {
 
     /**
      * Initialise the HAL class.
-     * Establishes the link to the robot.
+     * Establishes the link to the robot, or sets up the simulator or
+     * replay in its place. If the link cannot be established the HAL is
+     * still constructed, with the link marked down; it will keep trying
+     * to reconnect as it is used. If there is no link log to replay, the
+     * link is marked down and replay_finished() is true straight away.
+     * \param robot Which robot to link to, or 0 if embedded
+     * \param async If true, hand the link to a dedicated I/O thread once
+     * it is set up, so that no HAL call blocks on a round trip. If the
+     * link fails, the thread is stopped while it is reconnected and
+     * started again once it is back. Only applies to the real link.
+     * \param backend Which backend to drive
+     * \param record If true, record every exchange to LINK_LOG_FILE, or to
+     * LINK_LOG_REPLAY_FILE when replaying
      */
-    HardwareAbstractionLayer::HardwareAbstractionLayer(const int robot=0)
+    HardwareAbstractionLayer::HardwareAbstractionLayer(const int robot,
+        const bool async, const HALBackend backend, const bool record):
+        _robot(robot), _backend(backend), rlink(0), _sim(0), _replay(0),
+        _async(0), _stats(new LinkStats), _recorder(0),
+        _watchdog(new StatusWatchdog), _scheduler(0),
+        _odometry(new Odometry),
+        _status_interval(STATUS_POLL_INTERVAL),
+        _ticks(0), _status_reads(0), _async_wanted(false), _link_up(true),
+        _reconnecting(false), _last_reconnect(0)
     {
-        TRACE("HardwareAbstractionLayer(" << robot << ")");
+        TRACE("HardwareAbstractionLayer(" << robot << ", " << async << ", "
+            << backend << ", " << record << ")");
         INFO("Constructing HAL");
 
-        int status;
-        this->rlink = new robot_link;
-
-        // Initialise link
-        INFO("Initialising link");
-        if(robot == 0) {
-            status = this->rlink->initialise();
+        // We don't know what the motors are doing until we first set them
+        this->_motor_1 = this->_motor_2 = MOTOR_UNKNOWN;
+
+        // Use the robot's measured dimensions if it has been calibrated
+        if(!this->_odometry->load(ODOMETRY_FILE))
+            INFO("Using the default odometry calibration");
+
+        // The simulator and replay keep their own time, so they run as
+        // fast as they can rather than at the control rate
+        if(backend == HAL_BACKEND_SIMULATOR) {
+            this->_sim = new SimulatedLink;
+            this->_scheduler = new Scheduler(0);
+        } else if(backend == HAL_BACKEND_REPLAY) {
+            this->_replay = new ReplayLink(LINK_LOG_FILE);
+            this->_scheduler = new Scheduler(0);
+
+            // Check the log, there may be nothing to replay
+            if(this->_replay->finished()) {
+                ERROR("No link log to replay in " << LINK_LOG_FILE);
+                this->_link_up = false;
+            }
         } else {
-            status = this->rlink->initialise(robot);
+            this->_scheduler = new Scheduler(CONTROL_RATE);
+            this->rlink = new robot_link;
+
+            // Initialise link
+            INFO("Initialising link");
+            if(!this->open_link()) {
+                ERROR("Error initialising rlink, will retry");
+                this->_link_up = false;
+                this->_last_reconnect = monotonic_time_us();
+            }
         }
 
-        // Check link, exit on failure
-        if(!status) {
-            ERROR("Error initialising rlink, quitting");
-            std::exit(1);
-            return;
+        // Start recording before anything is sent. A replay has already
+        // loaded its log, but is recorded elsewhere so it can be compared.
+        if(record) {
+            this->_recorder = new LinkRecorder(backend == HAL_BACKEND_REPLAY
+                ? LINK_LOG_REPLAY_FILE : LINK_LOG_FILE);
         }
 
         // Set motor ramp speed
         DEBUG("Setting motor ramp speed to " << MOTOR_RAMP_TIME);
-        this->rlink->command(RAMP_TIME, MOTOR_RAMP_TIME);
+        this->link_command(RAMP_TIME, MOTOR_RAMP_TIME);
 
         // Initialise the value of the sensor port
         DEBUG("Reading the value of the hardware port");
-        this->_port7 = this->rlink->request(READ_PORT_7);
+        int port7 = this->link_request(READ_PORT_7);
+        this->_port7 = (port7 == REQUEST_ERROR) ? 0xFF : port7;
+        this->_port7_written = this->_port7;
 
         // Setting PORT0 to all inputs
-        this->rlink->command(WRITE_PORT_0, 0xFF);
+        this->link_command(WRITE_PORT_0, 0xFF);
 
         // Set emergency stop to the appropriate pin (front microswitch)
         this->enable_emergency_stop();
@@ -70,6 +126,18 @@ namespace IDP {
 
         this->grabber_lift(true);
         this->grabber_jaw(false);
+
+        // Take an initial sensor frame so frame() is always valid. This
+        // also flushes the output settings above.
+        this->sample();
+
+        // From here on the I/O thread owns the link
+        if(async && backend != HAL_BACKEND_LINK) {
+            INFO("Asynchronous I/O needs the real link, staying synchronous");
+        } else if(async) {
+            this->_async_wanted = true;
+            this->start_async();
+        }
     }
 
     /**
@@ -79,158 +147,326 @@ namespace IDP {
     {
         TRACE("~HardwareAbstractionLayer()");
 
-        if(this->rlink)
-            delete this->rlink;
+        // Stopping the I/O thread sends anything it still has queued
+        // and hands the link back to us.
+        if(this->_async) {
+            this->flush();
+            delete this->_async;
+            this->_async = 0;
+        }
+
+        this->flush();
+        this->dump_stats();
+        delete this->_recorder;
+        delete this->_watchdog;
+        delete this->_scheduler;
+        delete this->rlink;
+        delete this->_sim;
+        delete this->_replay;
+        delete this->_stats;
+        delete this->_odometry;
     }
 
     /**
-     * Drive both motors forwards at a given speed.
-     * \param speed The speed to drive at, 0 to 127
+     * Drive the left and right wheels at the given signed speeds.
+     *
+     * Positive speeds drive a wheel forwards and negative speeds drive it
+     * backwards. Speeds beyond MOTOR_MAX_SPEED in either direction are
+     * clamped. Only the commands needed to change the wheels from their
+     * current setting are sent, so repeating a setting costs nothing.
+     * \param left The left wheel speed, -127 to 127
+     * \param right The right wheel speed, -127 to 127
      */
-    void HardwareAbstractionLayer::motors_forward(
-        const unsigned short int speed)
+    void HardwareAbstractionLayer::set_wheels(int left, int right)
     {
-        TRACE("motors_forward(" << speed << ")");
-        DEBUG("Driving motors forward, speed " << speed);
+        TRACE("set_wheels(" << left << ", " << right << ")");
+        DEBUG("Setting wheels to " << left << ", " << right);
 
-        if(this->check_max_speed(speed)) {
-            return;
-        }
+        left = clamp_speed(left);
+        right = clamp_speed(right);
+
+        // The motors are mounted facing each other, so forwards is
+        // bit 7 set on the left motor but bit 7 clear on the right.
+        int motor_1 = (left >= 0) ? ((1<<7) | left) : -left;
+        int motor_2 = (right >= 0) ? right : ((1<<7) | -right);
 
-        this->rlink->command(BOTH_MOTORS_GO_OPPOSITE, (1<<7) | speed);
+        this->drive_motors(motor_1, motor_2);
+        this->_odometry->command(left, right);
     }
 
     /**
-     * Drive both motors backwards at a given speed.
-     * \param speed The speed to drive at, 0 to 127
+     * Stop all motors.
+     *
+     * Unlike other motor commands this is never suppressed as redundant,
+     * since the emergency stop can halt the motors without our knowledge.
+     * Only motors 1 and 2 are fitted, so one command stops both.
      */
-    void HardwareAbstractionLayer::motors_backward(
-        const unsigned short int speed)
+    void HardwareAbstractionLayer::motors_stop()
     {
-        TRACE("motors_backward(" << speed << ")");
-        DEBUG("Driving motors backward, speed " << speed);
-
-        if(this->check_max_speed(speed)) {
-            return;
-        }
-
-        this->rlink->command(BOTH_MOTORS_GO_OPPOSITE, (0<<7) | speed);
+        TRACE("motors_stop()");
+        INFO("Stopping all motors");
+        if(this->_async)
+            this->_async->stop();
+        else
+            this->link_command(BOTH_MOTORS_GO_SAME, 0);
+        this->_motor_1 = this->_motor_2 = 0;
+        this->_odometry->command(0, 0);
     }
 
     /**
-     * Drive the left motor forward at the given speed
-     * \param speed The speed at which to drive the motor
+     * Send the fewest commands needed to set motors 1 and 2 to the given
+     * values, skipping any motor already set to that value.
+     *
+     * Each value is a raw motor byte, with direction in bit 7 and speed
+     * in the low bits. If both motors need changing and want the same
+     * magnitude, a single BOTH_MOTORS_GO_SAME or BOTH_MOTORS_GO_OPPOSITE
+     * is used.
+     * \param motor_1 The byte for motor 1 (left)
+     * \param motor_2 The byte for motor 2 (right)
      */
-    void HardwareAbstractionLayer::motor_left_forward(
-        const unsigned short int speed)
+    void HardwareAbstractionLayer::drive_motors(int motor_1, int motor_2)
     {
-        TRACE("motor_left_forward(" << speed << ")");
-        DEBUG("Setting left motor forward at speed " << speed);
-
-        if (this->check_max_speed(speed)) {
+        TRACE("drive_motors(" << motor_1 << ", " << motor_2 << ")");
+
+        // A stopped motor has no direction, so compare stops equal
+        if(!(motor_1 & 0x7F))
+            motor_1 = 0;
+        if(!(motor_2 & 0x7F))
+            motor_2 = 0;
+
+        bool change_1 = motor_1 != this->_motor_1;
+        bool change_2 = motor_2 != this->_motor_2;
+
+        if(change_1 && change_2) {
+            // Opposite directions differ only in bit 7, unless stopped
+            int opposite_1 = motor_1 ? (motor_1 ^ (1<<7)) : 0;
+            if(motor_1 == motor_2) {
+                DEBUG("Setting both motors with one command");
+                this->link_command(BOTH_MOTORS_GO_SAME, motor_1);
+            } else if(motor_2 == opposite_1) {
+                DEBUG("Setting both motors opposite with one command");
+                this->link_command(BOTH_MOTORS_GO_OPPOSITE, motor_1);
+            } else {
+                this->link_command(MOTOR_1_GO, motor_1);
+                this->link_command(MOTOR_2_GO, motor_2);
+            }
+        } else if(change_1) {
+            this->link_command(MOTOR_1_GO, motor_1);
+        } else if(change_2) {
+            this->link_command(MOTOR_2_GO, motor_2);
+        } else {
+            DEBUG("Motors unchanged, not sending");
             return;
         }
 
-        this->rlink->command(MOTOR_1_GO, (1<<7) | speed);
+        this->_motor_1 = motor_1;
+        this->_motor_2 = motor_2;
     }
 
     /**
-     * Drive the right motor forward at the given speed
-     * \param speed The speed at which to drive the motor
+     * Read every sensor input in one batched exchange with the robot
+     * and store the result as the current frame.
+     *
+     * The port 0 read and both ADC reads are queued together so that a
+     * control tick costs one batch rather than a round trip per sensor.
+     * If the link fails and cannot be restored, the previous frame is
+     * kept.
+     *
+     * Each call is one control tick: it blocks until the next tick is
+     * due, so loops calling it run at the control rate.
+     * \returns The newly sampled SensorFrame
      */
-    void HardwareAbstractionLayer::motor_right_forward(
-        const unsigned short int speed)
+    const SensorFrame& HardwareAbstractionLayer::sample()
     {
-        TRACE("motor_right_forward(" << speed << ")");
-        DEBUG("Setting right motor forward at speed " << speed);
+        TRACE("sample()");
+        DEBUG("Sampling all sensors");
+
+        // Sampling marks the end of the previous control tick, so push
+        // out any output changes made during it first, then wait for the
+        // next tick to start.
+        this->flush();
+        this->_scheduler->wait();
+
+        this->_frame.status_read = false;
+        bool link_ok = true;
+
+        if(this->_async) {
+            // In asynchronous mode the I/O thread is already polling, so
+            // just take its latest values. If the link has failed, the
+            // previous frame is kept, as on the synchronous link, and the
+            // link is reconnected with the I/O thread stopped.
+            AsyncLinkSample latest = this->_async->latest();
+            if(latest.error) {
+                link_ok = false;
+                ERROR("Link I/O thread reports a failure");
+                this->stop_async();
+                if(this->reconnect())
+                    this->start_async();
+            } else {
+                this->decode_port0(latest.port0, this->_frame);
+                this->_frame.colour_ldr = latest.adc0;
+                this->_frame.bad_bobbin_ldr = latest.adc1;
+                this->_frame.timestamp = latest.timestamp;
+
+                // Only pass on STATUS when the I/O thread has read it
+                // afresh
+                if(latest.status_reads != this->_status_reads) {
+                    this->_status_reads = latest.status_reads;
+                    this->_frame.status_read = true;
+                    this->_frame.status = latest.status;
+                }
+
+                if(this->_recorder) {
+                    this->_recorder->record(LINK_LOG_REQUEST, READ_PORT_0,
+                        0, latest.port0);
+                    this->_recorder->record(LINK_LOG_REQUEST, ADC0, 0,
+                        latest.adc0);
+                    this->_recorder->record(LINK_LOG_REQUEST, ADC1, 0,
+                        latest.adc1);
+                    if(this->_frame.status_read)
+                        this->_recorder->record(LINK_LOG_REQUEST, STATUS,
+                            0, latest.status);
+                }
+            }
+        } else if(this->_backend == HAL_BACKEND_SIMULATOR) {
+            if(this->sample_link(*this->_sim))
+                this->_frame.timestamp = this->_sim->timestamp();
+        } else if(this->_backend == HAL_BACKEND_REPLAY) {
+            // Replayed frames keep their recorded times, so the control
+            // code sees time pass as it did in the original run. Once
+            // the log runs out there is nothing left to replay.
+            if(this->sample_link(*this->_replay)) {
+                this->_frame.timestamp = this->_replay->timestamp();
+            } else {
+                link_ok = false;
+                if(this->_replay->finished())
+                    this->end_replay();
+            }
+        } else {
+            if(!this->sample_link(*this->rlink)) {
+                link_ok = false;
+                if(this->reconnect())
+                    this->sample_link(*this->rlink);
+            }
+
+            // Go back to the I/O thread once a failed link is restored
+            if(this->_async_wanted && this->_link_up)
+                this->start_async();
+        }
 
-        if (this->check_max_speed(speed)) {
-            return;
+        // Faults are dealt with in the tick they are seen. The emergency
+        // stop halts the motors behind our back, so forget their settings
+        // and the next set_wheels() will send them again.
+        int events = this->_watchdog->check(this->_frame, link_ok);
+        if(events & STATUS_EVENT_EMERGENCY_STOP) {
+            INFO("Emergency stop fired");
+            this->_motor_1 = this->_motor_2 = MOTOR_UNKNOWN;
+            this->_odometry->command(0, 0);
         }
 
-        this->rlink->command(MOTOR_2_GO, speed);
+        // The wheels have been driving at the last speeds set since the
+        // previous frame
+        this->_odometry->update(this->_frame.timestamp);
+
+        return this->_frame;
     }
 
     /**
-     * Drive the left motor backward at the given speed
-     * \param speed The speed at which to drive the motor
+     * Set how often the STATUS register is read along with the sensors.
+     * Has no effect on the I/O thread in asynchronous mode, which reads
+     * it every ASYNC_STATUS_POLL_INTERVAL polls.
+     * \param ticks Read STATUS once every this many calls to sample(), or
+     * never if 0
      */
-    void HardwareAbstractionLayer::motor_left_backward(
-        const unsigned short int speed)
+    void HardwareAbstractionLayer::set_status_interval(
+        const unsigned int ticks)
     {
-        TRACE("motor_left_backward(" << speed << ")");
-        DEBUG("Setting left motor backward at speed " << speed);
-
-        if (this->check_max_speed(speed)) {
-            return;
-        }
-
-        this->rlink->command(MOTOR_1_GO, speed);
+        TRACE("set_status_interval(" << ticks << ")");
+        this->_status_interval = ticks;
     }
 
     /**
-     * Drive the right motor backward at the given speed
-     * \param speed The speed at which to drive the motor
+     * Set the rate sample() paces the control loop at.
+     * \param rate Ticks per second, or 0 to run as fast as possible
      */
-    void HardwareAbstractionLayer::motor_right_backward(
-        const unsigned short int speed)
+    void HardwareAbstractionLayer::set_control_rate(const unsigned int rate)
     {
-        TRACE("motor_right_backward(" << speed << ")");
-        DEBUG("Setting right motor backward at speed " << speed);
-
-        if (this->check_max_speed(speed)) {
-            return;
-        }
-
-        this->rlink->command(MOTOR_2_GO, (1<<7) | speed);
+        TRACE("set_control_rate(" << rate << ")");
+        this->_scheduler->set_rate(rate);
     }
 
     /**
-     * Drive the motors to steer the robot to the left.
-     * \param speed The speed to drive at, 0 to 127
+     * Collect and clear the events raised by the status watchdog since the
+     * last call.
+     * \returns The pending StatusEvent flags
      */
-    void HardwareAbstractionLayer::motors_turn_left(
-        const unsigned short int speed)
+    int HardwareAbstractionLayer::status_events()
     {
-        TRACE("motors_turn_left(" << speed << ")");
-        DEBUG("Turning motors left, speed " << speed);
-
-        if(this->check_max_speed(speed)) {
-            return;
-        }
-
-        this->rlink->command(BOTH_MOTORS_GO_SAME, (1<<7) | speed);
+        TRACE("status_events()");
+        return this->_watchdog->take_events();
     }
 
     /**
-     * Drive the motors to steer the robot to the right.
-     * \param speed The speed to drive at, 0 to 127
+     * Read every sensor in one batch from the given backend into the
+     * current frame, with STATUS added to the batch every
+     * _status_interval calls. Instantiated once per backend, so the batch
+     * is dispatched statically.
+     * \param link The backend to read from
+     * \returns true if the batch was read, false if the link failed, in
+     * which case the current frame is left alone
      */
-    void HardwareAbstractionLayer::motors_turn_right(
-        const unsigned short int speed)
+    template<class Link>
+    bool HardwareAbstractionLayer::sample_link(Link& link)
     {
-        TRACE("motors_turn_right(" << speed << ")");
-        DEBUG("Turning motors right, speed " << speed);
+        if(!this->_link_up && !this->reconnect())
+            return false;
 
-        if(this->check_max_speed(speed)) {
-            return;
+        robot_request batch[4] = {{READ_PORT_0, 0}, {ADC0, 0}, {ADC1, 0},
+            {STATUS, 0}};
+        int errors = this->link_errors();
+
+        int size = 3;
+        if(this->_status_interval &&
+            this->_ticks++ % this->_status_interval == 0)
+            size = 4;
+
+        // Each request is timed separately for the link statistics
+        unsigned long long int start = monotonic_time_us();
+        for(int i = 0; i < size; i++) {
+            link >> batch[i];
+            unsigned long long int end = monotonic_time_us();
+            this->_stats->record(batch[i].opcode, end - start);
+            start = end;
+        }
+
+        if(this->link_errors() != errors) {
+            ERROR("Sensor batch failed");
+            return false;
         }
 
-        this->rlink->command(BOTH_MOTORS_GO_SAME, (0<<7) | speed);
+        if(this->_recorder) {
+            for(int i = 0; i < size; i++)
+                this->_recorder->record(LINK_LOG_REQUEST, batch[i].opcode,
+                    0, batch[i].parameter);
+        }
+
+        this->decode_port0(batch[0].parameter, this->_frame);
+        this->_frame.colour_ldr = batch[1].parameter;
+        this->_frame.bad_bobbin_ldr = batch[2].parameter;
+        this->_frame.status_read = size == 4;
+        this->_frame.status = batch[3].parameter;
+        this->_frame.timestamp = start;
+        return true;
     }
 
     /**
-     * Stop all motors.
+     * Return the most recently sampled frame without touching the link.
+     * \returns The SensorFrame from the last call to sample()
      */
-    void HardwareAbstractionLayer::motors_stop()
+    const SensorFrame& HardwareAbstractionLayer::frame() const
     {
-        TRACE("motors_stop()");
-        INFO("Stopping all motors");
-        this->rlink->command(BOTH_MOTORS_GO_SAME, 0);
-        this->rlink->command(MOTOR_1_GO, 0);
-        this->rlink->command(MOTOR_2_GO, 0);
-        this->rlink->command(MOTOR_3_GO, 0);
-        this->rlink->command(MOTOR_4_GO, 0);
+        TRACE("frame()");
+        return this->_frame;
     }
 
     /**
@@ -243,33 +479,9 @@ namespace IDP {
         TRACE("line_following_sensors()");
         DEBUG("Reading line following sensors");
 
-        // Get the port values
-        int port_values = this->rlink->request(READ_PORT_0);
-        LineSensors sensor_values;
-        
-        // Set the struct members appropriately
-        if(port_values & (1<<0))
-            sensor_values.outer_left = LINE;
-        else
-            sensor_values.outer_left = NO_LINE;
-
-        if(port_values & (1<<1))
-            sensor_values.line_left = LINE;
-        else
-            sensor_values.line_left = NO_LINE;
-
-        if(port_values & (1<<2))
-            sensor_values.line_right = LINE;
-        else
-            sensor_values.line_right = NO_LINE;
-
-        if(port_values & (1<<3))
-            sensor_values.outer_right = LINE;
-        else
-            sensor_values.outer_right = NO_LINE;
-
-        return sensor_values;
-
+        SensorFrame frame;
+        this->decode_port0(this->link_request(READ_PORT_0), frame);
+        return frame.line_sensors;
     }
 
     /**
@@ -279,7 +491,7 @@ namespace IDP {
     {
         TRACE("clear_status_register()");
         DEBUG("Reading and discarding status register");
-        this->rlink->request(STATUS);
+        this->link_request(STATUS);
     }
 
     /**
@@ -290,7 +502,7 @@ namespace IDP {
     {
         TRACE("status_register()");
         DEBUG("Reading status register");
-        return static_cast<char>(this->rlink->request(STATUS));
+        return static_cast<char>(this->link_request(STATUS));
     }
 
     /**
@@ -302,14 +514,9 @@ namespace IDP {
         TRACE("reset_switch()");
         DEBUG("Reading reset switch");
 
-        // Get the port values
-        int port_values = this->rlink->request(READ_PORT_0);
-        
-        // Return true or false as appropriate
-        if(port_values & (1<<5))
-            return false;
-        else
-            return true;
+        SensorFrame frame;
+        this->decode_port0(this->link_request(READ_PORT_0), frame);
+        return frame.reset_switch;
     }
 
     /**
@@ -321,14 +528,9 @@ namespace IDP {
         TRACE("grabber_switch()");
         DEBUG("Reading grabber switch");
 
-        // Get the port values
-        int port_values = this->rlink->request(READ_PORT_0);
-        
-        // Return true or false as appropriate
-        if(port_values & (1<<4))
-            return false;
-        else
-            return true;
+        SensorFrame frame;
+        this->decode_port0(this->link_request(READ_PORT_0), frame);
+        return frame.grabber_switch;
     }
 
     /**
@@ -338,7 +540,7 @@ namespace IDP {
     unsigned short int HardwareAbstractionLayer::colour_ldr() const
     {
         TRACE("colour_ldr()");
-        return this->rlink->request(ADC0);
+        return this->link_request(ADC0);
     }
 
     /**
@@ -348,7 +550,45 @@ namespace IDP {
     unsigned short int HardwareAbstractionLayer::bad_bobbin_ldr() const
     {
         TRACE("bad_bobbin_ldr()");
-        return this->rlink->request(ADC1);
+        return this->link_request(ADC1);
+    }
+
+    /**
+     * Write the port 7 shadow register out to the robot, if it has changed
+     * since it was last written.
+     *
+     * The LED and actuator setters only update the shadow register, so
+     * several changes made in one control tick cost a single write. This
+     * is called automatically by sample(); call it directly when an output
+     * must take effect before waiting, e.g. before sleeping on an actuator.
+     */
+    void HardwareAbstractionLayer::flush()
+    {
+        TRACE("flush()");
+
+        if(this->_port7 == this->_port7_written) {
+            DEBUG("Port 7 unchanged, not writing");
+            return;
+        }
+
+        DEBUG("Writing port 7 as " << this->_port7);
+        this->link_command(WRITE_PORT_7, this->_port7);
+        this->_port7_written = this->_port7;
+    }
+
+    /**
+     * Wait while an actuator moves or an indicator is shown. Nothing
+     * physical moves in the simulator or a replay, so they do not wait.
+     * The control loop's schedule restarts afterwards, so the wait is not
+     * counted as an overrun.
+     * \param us How long to wait on the real robot, in microseconds
+     */
+    void HardwareAbstractionLayer::pause(const unsigned int us) const
+    {
+        TRACE("pause(" << us << ")");
+        this->_scheduler->idle();
+        if(this->_backend == HAL_BACKEND_LINK)
+            usleep(us);
     }
 
     /**
@@ -375,8 +615,6 @@ namespace IDP {
             this->_port7 = ~(1<<5) & this->_port7;
         else
             this->_port7 = 1<<5 | this->_port7;
-        
-        this->rlink->command(WRITE_PORT_7, this->_port7);
     }
 
     /**
@@ -391,7 +629,6 @@ namespace IDP {
             this->_port7 = ~(1<<0) & this->_port7;
         else
             this->_port7 = 1<<0 | this->_port7;
-        this->rlink->command(WRITE_PORT_7, this->_port7);
     }
 
     /**
@@ -406,8 +643,6 @@ namespace IDP {
             this->_port7 = ~(1<<4) & this->_port7; 
         else
             this->_port7 = 1<<4 | this->_port7; 
-
-        this->rlink->command(WRITE_PORT_7, this->_port7);
     }
 
     /**
@@ -424,8 +659,6 @@ namespace IDP {
             DEBUG("Releasing clamp");
             this->_port7 = 1<<6 | this->_port7;
         }
-
-        this->rlink->command(WRITE_PORT_7, this->_port7);
     }
 
     /**
@@ -442,8 +675,6 @@ namespace IDP {
             DEBUG("Lowering grabber");
             this->_port7 = ~(1<<7) & this->_port7;
         }
-
-        this->rlink->command(WRITE_PORT_7, this->_port7);
     }
 
     /**
@@ -454,26 +685,384 @@ namespace IDP {
     {
         TRACE("enable_emergency_stop()");
         INFO("Enabling emergency stop.");
-        this->rlink->command(STOP_SELECT, 0x00);
-        this->rlink->command(STOP_IF_LOW, (1<<5));
+        this->link_command(STOP_SELECT, 0x00);
+        this->link_command(STOP_IF_LOW, EMERGENCY_STOP_PIN);
     }
 
     /**
-     * Check the motor speed against the set maximum, printing an error
-     * and returning true if the speed exceeds that value.
-     * \param speed The speed to check
-     * \return true if the speed is too high, false if okay
+     * Clamp a signed motor speed to MOTOR_MAX_SPEED in either direction.
+     * \param speed The speed to clamp
+     * \return The clamped speed
      */
-    bool HardwareAbstractionLayer::check_max_speed(
-        const unsigned short int speed) const
+    int HardwareAbstractionLayer::clamp_speed(const int speed) const
     {
-        TRACE("check_max_speed("<<speed<<")");
+        TRACE("clamp_speed("<<speed<<")");
         if(speed > MOTOR_MAX_SPEED) {
-            DEBUG("ERROR: Motor speed too high, not setting");
-            return true;
+            DEBUG("Motor speed too high, clamping to " << MOTOR_MAX_SPEED);
+            return MOTOR_MAX_SPEED;
+        } else if(speed < -MOTOR_MAX_SPEED) {
+            DEBUG("Motor speed too low, clamping to " << -MOTOR_MAX_SPEED);
+            return -MOTOR_MAX_SPEED;
+        } else {
+            return speed;
+        }
+    }
+
+    /**
+     * Send a command to the current backend, through the I/O thread if
+     * running asynchronously. If the real link fails, it is reconnected
+     * and the command retried once.
+     * \param cmd The command opcode
+     * \param arg The command argument
+     * \returns true if the command was sent
+     */
+    bool HardwareAbstractionLayer::link_command(const command_instruction cmd,
+        const int arg) const
+    {
+        TRACE("link_command(" << cmd << ", " << arg << ")");
+
+        bool ok;
+        unsigned long long int start = monotonic_time_us();
+        if(this->_async) {
+            // The I/O thread records its own timings. The command is only
+            // queued, so report whether the link is still working.
+            this->_async->command(cmd, arg);
+            ok = !this->_async->latest().error;
+        } else if(this->_backend == HAL_BACKEND_SIMULATOR) {
+            ok = this->_sim->command(cmd, arg);
+        } else if(this->_backend == HAL_BACKEND_REPLAY) {
+            ok = this->_replay->command(cmd, arg);
+        } else {
+            ok = (this->_link_up || this->reconnect()) &&
+                this->rlink->command(cmd, arg);
+            if(!ok && this->reconnect())
+                ok = this->rlink->command(cmd, arg);
+        }
+
+        if(!this->_async)
+            this->_stats->record(cmd, monotonic_time_us() - start);
+        if(this->_recorder)
+            this->_recorder->record(LINK_LOG_COMMAND, cmd, arg, ok);
+        return ok;
+    }
+
+    /**
+     * Make a request of the current backend. When running asynchronously
+     * the sensor ports and STATUS are answered from the I/O thread's
+     * mailbox without blocking. If the real link fails, it is reconnected
+     * and the request retried once.
+     * \param req The request opcode
+     * \returns The value returned by the robot, or REQUEST_ERROR
+     */
+    int HardwareAbstractionLayer::link_request(
+        const request_instruction req) const
+    {
+        TRACE("link_request(" << req << ")");
+        int response;
+        if(!this->_async) {
+            unsigned long long int start = monotonic_time_us();
+            if(this->_backend == HAL_BACKEND_SIMULATOR)
+                response = this->_sim->request(req);
+            else if(this->_backend == HAL_BACKEND_REPLAY)
+                response = this->_replay->request(req);
+            else if(!this->_link_up && !this->reconnect())
+                response = REQUEST_ERROR;
+            else
+                response = this->rlink->request(req);
+
+            if(response == REQUEST_ERROR && this->rlink && this->reconnect())
+                response = this->rlink->request(req);
+
+            this->_stats->record(req, monotonic_time_us() - start);
         } else {
+            AsyncLinkSample latest = this->_async->latest();
+            if(req == READ_PORT_0) {
+                response = latest.port0;
+            } else if(req == ADC0) {
+                response = latest.adc0;
+            } else if(req == ADC1) {
+                response = latest.adc1;
+            } else if(req == STATUS) {
+                response = latest.status;
+            } else {
+                ERROR("Request " << req <<
+                    " unavailable in asynchronous mode");
+                response = REQUEST_ERROR;
+            }
+        }
+
+        if(this->_recorder)
+            this->_recorder->record(LINK_LOG_REQUEST, req, 0, response);
+        return response;
+    }
+
+    /**
+     * Get the link statistics, with the link error counters brought up to
+     * date.
+     * \returns The LinkStats for this HAL
+     */
+    const LinkStats& HardwareAbstractionLayer::link_stats() const
+    {
+        TRACE("link_stats()");
+        if(this->rlink) {
+            this->_stats->update_errors(this->rlink->send_errs,
+                this->rlink->recv_errs, this->rlink->cmd_errs);
+        }
+        return *this->_stats;
+    }
+
+    /**
+     * Print the link statistics.
+     */
+    void HardwareAbstractionLayer::dump_stats() const
+    {
+        TRACE("dump_stats()");
+        INFO("Link statistics:");
+        this->link_stats().dump();
+        this->_scheduler->dump();
+    }
+
+    /**
+     * Get the dead reckoned movement since the robot was last at a known
+     * place.
+     * \returns A reference to the Odometry, valid for the HAL's lifetime
+     */
+    const Odometry& HardwareAbstractionLayer::odometry() const
+    {
+        return *this->_odometry;
+    }
+
+    /**
+     * Mark the robot as being at a known place, such as a node, so the
+     * odometry measures from here.
+     */
+    void HardwareAbstractionLayer::reset_odometry()
+    {
+        TRACE("reset_odometry()");
+        this->_odometry->reset();
+    }
+
+    /**
+     * Write out any buffered link log records, e.g. before exiting
+     * without destroying the HAL.
+     */
+    void HardwareAbstractionLayer::flush_link_log() const
+    {
+        TRACE("flush_link_log()");
+        if(this->_recorder)
+            this->_recorder->flush();
+    }
+
+    /**
+     * Check whether the link to the robot is working.
+     * \returns false if the link failed and could not be restored, or a
+     * replay has run out
+     */
+    bool HardwareAbstractionLayer::link_up() const
+    {
+        TRACE("link_up()");
+        return this->_link_up;
+    }
+
+    /**
+     * Hand the link over to a new I/O thread. If the link is down, this
+     * waits until it has been reconnected.
+     */
+    void HardwareAbstractionLayer::start_async()
+    {
+        TRACE("start_async()");
+        if(!this->_link_up) {
+            INFO("Link is down, staying synchronous until it is restored");
+            return;
+        }
+
+        INFO("Switching to asynchronous link I/O");
+        this->_async = new AsyncLink(this->rlink, this->_stats);
+        if(!this->_async->running()) {
+            ERROR("Link I/O thread did not start, staying synchronous");
+            delete this->_async;
+            this->_async = 0;
+            this->_async_wanted = false;
+        }
+    }
+
+    /**
+     * Stop the I/O thread, once it has sent what it has queued, and take
+     * the link back.
+     */
+    void HardwareAbstractionLayer::stop_async()
+    {
+        TRACE("stop_async()");
+        delete this->_async;
+        this->_async = 0;
+    }
+
+    /**
+     * Connect the robot link for the first time.
+     * \returns true on success
+     */
+    bool HardwareAbstractionLayer::open_link() const
+    {
+        TRACE("open_link()");
+        if(this->_robot == 0)
+            return this->rlink->initialise();
+        else
+            return this->rlink->initialise(this->_robot);
+    }
+
+    /**
+     * Re-establish a failed robot link, backing off between attempts, then
+     * restore the robot's state from our shadow copies.
+     *
+     * Once this has given up it will not try again until
+     * LINK_RECONNECT_HOLDOFF has passed, so a dead link costs little.
+     * \returns true if the link is working again
+     */
+    bool HardwareAbstractionLayer::reconnect() const
+    {
+        TRACE("reconnect()");
+
+        // Never recurse, and only the real link can be reconnected
+        if(!this->rlink || this->_reconnecting)
             return false;
+
+        unsigned long long int now = monotonic_time_us();
+        if(!this->_link_up &&
+            now - this->_last_reconnect < LINK_RECONNECT_HOLDOFF)
+            return false;
+
+        ERROR("Link failure, reconnecting");
+        this->_reconnecting = true;
+        this->_link_up = false;
+
+        unsigned int delay = LINK_RECONNECT_DELAY;
+        for(unsigned int i = 0; i < LINK_RECONNECT_ATTEMPTS; i++) {
+            if(i) {
+                usleep(delay);
+                delay *= 2;
+            }
+            // reinitialise() can only reopen a link that was once open
+            bool open = this->rlink->reinitialise() || this->open_link();
+            if(open && this->restore_state()) {
+                INFO("Link restored on attempt " << i + 1);
+                this->_link_up = true;
+                break;
+            }
         }
+
+        if(!this->_link_up) {
+            ERROR("Could not restore link");
+            this->_last_reconnect = monotonic_time_us();
+        }
+        this->_reconnecting = false;
+        return this->_link_up;
     }
-}
 
+    /**
+     * Send the robot everything it needs to match our view of it: motor
+     * ramp, port 0 direction, emergency stop, port 7 and both motors.
+     * \returns true if every command was sent
+     */
+    bool HardwareAbstractionLayer::restore_state() const
+    {
+        TRACE("restore_state()");
+        DEBUG("Restoring robot state");
+
+        bool ok = this->rlink->command(RAMP_TIME, MOTOR_RAMP_TIME) &&
+            this->rlink->command(WRITE_PORT_0, 0xFF) &&
+            this->rlink->command(STOP_SELECT, 0x00) &&
+            this->rlink->command(STOP_IF_LOW, EMERGENCY_STOP_PIN) &&
+            this->rlink->command(WRITE_PORT_7, this->_port7);
+
+        if(ok && this->_motor_1 != MOTOR_UNKNOWN)
+            ok = this->rlink->command(MOTOR_1_GO, this->_motor_1);
+        if(ok && this->_motor_2 != MOTOR_UNKNOWN)
+            ok = this->rlink->command(MOTOR_2_GO, this->_motor_2);
+
+        return ok;
+    }
+
+    /**
+     * Total the robot link's error counters, so a failed batch can be
+     * spotted by the count changing.
+     * \returns The total error count, the replay's unanswered requests
+     * when replaying, or 0 for the simulator, which never fails
+     */
+    int HardwareAbstractionLayer::link_errors() const
+    {
+        if(this->_replay)
+            return this->_replay->errors();
+        if(!this->rlink)
+            return 0;
+        return this->rlink->send_errs + this->rlink->recv_errs +
+            this->rlink->cmd_errs;
+    }
+
+    /**
+     * Check whether a replay has played back its whole link log, after
+     * which there are no more sensor readings to act on and the caller
+     * should stop.
+     * \returns true once the replayed log has run out, or false if not
+     * replaying
+     */
+    bool HardwareAbstractionLayer::replay_finished() const
+    {
+        return this->_replay && this->_replay->finished();
+    }
+
+    /**
+     * Wind up at the end of the replayed link log. Like stopping the run
+     * with ctrl-c, this stops the motors and keeps the statistics and
+     * link log. The link is then down for good, which the caller finds
+     * out from link_up() or replay_finished().
+     */
+    void HardwareAbstractionLayer::end_replay()
+    {
+        TRACE("end_replay()");
+        if(!this->_link_up)
+            return;
+
+        INFO("End of link log, replay finished with " <<
+            this->_replay->divergences() << " divergences");
+        this->motors_stop();
+        this->_link_up = false;
+        this->dump_stats();
+        this->flush_link_log();
+    }
+
+    /**
+     * Decode the value read from port 0 into the line sensor and switch
+     * fields of a SensorFrame.
+     * \param port_values The value read from port 0
+     * \param frame The SensorFrame to fill in
+     */
+    void HardwareAbstractionLayer::decode_port0(const int port_values,
+        SensorFrame& frame) const
+    {
+        TRACE("decode_port0(" << port_values << ")");
+
+        // Line sensors read high when they see a line
+        frame.line_sensors.outer_left =
+            (port_values & (1<<0)) ? LINE : NO_LINE;
+        frame.line_sensors.line_left =
+            (port_values & (1<<1)) ? LINE : NO_LINE;
+        frame.line_sensors.line_right =
+            (port_values & (1<<2)) ? LINE : NO_LINE;
+        frame.line_sensors.outer_right =
+            (port_values & (1<<3)) ? LINE : NO_LINE;
+
+        // Switches pull their pin low when pressed
+        frame.grabber_switch = !(port_values & (1<<4));
+        frame.reset_switch = !(port_values & (1<<5));
+    }
+
+    // Documented in hal.h
+    // Intentionally not part of the class.
+    unsigned long long int monotonic_time_us()
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return static_cast<unsigned long long int>(now.tv_sec) * 1000000ULL
+            + static_cast<unsigned long long int>(now.tv_nsec) / 1000ULL;
+    }
+}
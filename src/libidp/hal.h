@@ -15,6 +15,15 @@
 
 namespace IDP {
 
+    class AsyncLink;
+    class SimulatedLink;
+    class ReplayLink;
+    class LinkStats;
+    class LinkRecorder;
+    class StatusWatchdog;
+    class Scheduler;
+    class Odometry;
+
     /**
      * Highest allowable motor speed in either direction
      */
@@ -26,6 +35,51 @@ namespace IDP {
      */
     const int MOTOR_RAMP_TIME = 16;
 
+    /**
+     * Placeholder motor value marking a motor whose current setting is
+     * unknown, so the next command to it is always sent.
+     */
+    const int MOTOR_UNKNOWN = -1;
+
+    /**
+     * By default the STATUS register is read along with the sensors once
+     * every this many calls to sample().
+     */
+    const unsigned int STATUS_POLL_INTERVAL = 16;
+
+    /**
+     * Port 0 pin which triggers the emergency stop when it goes low (the
+     * front microswitch).
+     */
+    const int EMERGENCY_STOP_PIN = (1<<5);
+
+    /**
+     * How many times to try reconnecting a failed link before giving up.
+     */
+    const unsigned int LINK_RECONNECT_ATTEMPTS = 5;
+
+    /**
+     * Delay before the second reconnection attempt, in microseconds. The
+     * delay doubles after each failed attempt.
+     */
+    const unsigned int LINK_RECONNECT_DELAY = 10000;
+
+    /**
+     * Once reconnection has failed, how long to wait before trying again,
+     * in microseconds. Link calls fail immediately in the meantime.
+     */
+    const unsigned long long int LINK_RECONNECT_HOLDOFF = 1000000ULL;
+
+    /**
+     * Which backend the HAL drives: the real robot over robot_link, the
+     * in-process simulator, or a replay of a recorded link log.
+     */
+    enum HALBackend {
+        HAL_BACKEND_LINK,
+        HAL_BACKEND_SIMULATOR,
+        HAL_BACKEND_REPLAY
+    };
+
     /**
      * Line sensor status, LINE or NO_LINE.
      */
@@ -46,6 +100,28 @@ namespace IDP {
         LineSensorStatus outer_right;
     };
 
+    /**
+     * A snapshot of every sensor input, taken in a single batched
+     * exchange with the robot.
+     */
+    struct SensorFrame
+    {
+        LineSensors line_sensors;
+        bool reset_switch;
+        bool grabber_switch;
+        unsigned short int colour_ldr;
+        unsigned short int bad_bobbin_ldr;
+        bool status_read;
+        unsigned char status;
+        unsigned long long int timestamp;
+    };
+
+    /**
+     * Read the monotonic system clock.
+     * \returns The current time in microseconds from an arbitrary epoch
+     */
+    unsigned long long int monotonic_time_us();
+
     /**
      * Provide a hardware agnostic interface to the required hardware
      * functionality
@@ -53,19 +129,20 @@ namespace IDP {
     class HardwareAbstractionLayer
     {
         public:
-            HardwareAbstractionLayer(const int robot);
+            HardwareAbstractionLayer(const int robot,
+                const bool async = false,
+                const HALBackend backend = HAL_BACKEND_LINK,
+                const bool record = false);
             ~HardwareAbstractionLayer();
-            void motors_forward(const unsigned short int speed);
-            void motors_backward(const unsigned short int speed);
-            void motor_left_forward(const unsigned short int speed);
-            void motor_right_forward(const unsigned short int speed);
-            void motor_left_backward(const unsigned short int speed);
-            void motor_right_backward(const unsigned short int speed);
-            void motors_turn_left(const unsigned short int speed);
-            void motors_turn_right(const unsigned short int speed);
+            void set_wheels(int left, int right);
             void motors_stop();
             char status_register() const;
             void clear_status_register() const;
+            const SensorFrame& sample();
+            const SensorFrame& frame() const;
+            void set_status_interval(const unsigned int ticks);
+            void set_control_rate(const unsigned int rate);
+            int status_events();
             const LineSensors line_following_sensors() const;
             bool reset_switch() const;
             bool grabber_switch() const;
@@ -77,11 +154,56 @@ namespace IDP {
             void bad_bobbin_LED(const bool status);
             void grabber_jaw(const bool status);
             void grabber_lift(const bool status);
+            void flush();
+            void pause(const unsigned int us) const;
             void enable_emergency_stop(void);
+            const LinkStats& link_stats() const;
+            const Odometry& odometry() const;
+            void reset_odometry();
+            void dump_stats() const;
+            void flush_link_log() const;
+            bool link_up() const;
+            bool replay_finished() const;
         private:
-            bool check_max_speed(const unsigned short int speed) const;
+            int clamp_speed(const int speed) const;
+            void drive_motors(int motor_1, int motor_2);
+            bool link_command(const command_instruction cmd,
+                const int arg) const;
+            int link_request(const request_instruction req) const;
+            template<class Link> bool sample_link(Link& link);
+            void start_async();
+            void stop_async();
+            bool open_link() const;
+            bool reconnect() const;
+            bool restore_state() const;
+            int link_errors() const;
+            void end_replay();
+            void decode_port0(const int port_values, SensorFrame& frame) const;
+            const int _robot;
+            HALBackend _backend;
             robot_link* rlink;
+            SimulatedLink* _sim;
+            ReplayLink* _replay;
+            AsyncLink* _async;
+            LinkStats* _stats;
+            LinkRecorder* _recorder;
+            StatusWatchdog* _watchdog;
+            Scheduler* _scheduler;
+            Odometry* _odometry;
+            unsigned int _status_interval;
+            unsigned int _ticks;
+            unsigned int _status_reads;
+            bool _async_wanted;
+
+            // Link health. Changed by any link call, even const ones.
+            mutable bool _link_up;
+            mutable bool _reconnecting;
+            mutable unsigned long long int _last_reconnect;
             unsigned short int _port7;
+            unsigned short int _port7_written;
+            int _motor_1;
+            int _motor_2;
+            SensorFrame _frame;
     };
 }
 
@@ -4,8 +4,17 @@
 // line_following.cc
 // Line Following class implementation
 
+#include <cmath>
+#include <fstream>
+
 #include "hal.h"
 #include "line_following.h"
+#include "line_position_estimator.h"
+#include "line_sensor_filter.h"
+#include "odometry.h"
+#include "scheduler.h"
+#include "sensor_history.h"
+#include "turn_rates.h"
 
 // Debug functionality
 #define MODULE_NAME "LineFollowing"
@@ -17,26 +26,212 @@
 
 namespace IDP {
 
+    /*
+     * The action tables. Each row is indexed by the sensor nibble, written
+     * as outer right, line right, line left, outer left, so a 1 is a
+     * sensor which can see the line.
+     */
+
+    // Documented in line_following.h
+    const LineFollowingAction FOLLOW_ACTIONS[SENSOR_STATES] = {
+        /* 0000 */ {STEER_SEARCH, SEARCH_ERROR, ACTION_IN_PROGRESS, LOST_LINE},
+        /* 0001 */ {STEER_RIGHT, -EDGE_ERROR, ACTION_IN_PROGRESS, OTHER},
+        /* 0010 */ {STEER_RIGHT, -1, ACTION_IN_PROGRESS, OTHER},
+        /* 0011 */ {STEER_RIGHT, -2, ACTION_IN_PROGRESS, OTHER},
+        /* 0100 */ {STEER_LEFT, 1, ACTION_IN_PROGRESS, OTHER},
+        /* 0101 */ {STEER_HOLD, 0, ACTION_IN_PROGRESS, OTHER},
+        /* 0110 */ {STEER_STRAIGHT, 0, ACTION_IN_PROGRESS, ON_LINE},
+        /* 0111 */ {STEER_STRAIGHT, 0, LEFT_TURN_FOUND, OTHER},
+        /* 1000 */ {STEER_LEFT, EDGE_ERROR, ACTION_IN_PROGRESS, OTHER},
+        /* 1001 */ {STEER_HOLD, 0, ACTION_IN_PROGRESS, OTHER},
+        /* 1010 */ {STEER_HOLD, 0, ACTION_IN_PROGRESS, OTHER},
+        /* 1011 */ {STEER_HOLD, 0, ACTION_IN_PROGRESS, OTHER},
+        /* 1100 */ {STEER_LEFT, 2, ACTION_IN_PROGRESS, OTHER},
+        /* 1101 */ {STEER_HOLD, 0, ACTION_IN_PROGRESS, OTHER},
+        /* 1110 */ {STEER_STRAIGHT, 0, RIGHT_TURN_FOUND, OTHER},
+        /* 1111 */ {STEER_STRAIGHT, 0, BOTH_TURNS_FOUND, OTHER}
+    };
+
+    // Documented in line_following.h
+    const LineFollowingAction
+        TURN_ACTIONS[MAX_TURN_DIRECTION][SENSOR_STATES] = {
+        // TURN_LEFT
+        {
+            /* 0000 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, LOST_LINE},
+            /* 0001 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, NEAR_LINE},
+            /* 0010 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE},
+            /* 0011 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE},
+            /* 0100 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 0101 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 0110 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE},
+            /* 0111 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 1000 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 1001 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 1010 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE},
+            /* 1011 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE},
+            /* 1100 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 1101 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 1110 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 1111 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER}
+        },
+        // TURN_RIGHT
+        {
+            /* 0000 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, LOST_LINE},
+            /* 0001 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 0010 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 0011 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 0100 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE},
+            /* 0101 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE},
+            /* 0110 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE},
+            /* 0111 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 1000 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, NEAR_LINE},
+            /* 1001 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 1010 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 1011 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 1100 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE},
+            /* 1101 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE},
+            /* 1110 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 1111 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER}
+        },
+        // TURN_AROUND_CW
+        {
+            /* 0000 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, LOST_LINE},
+            /* 0001 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 0010 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 0011 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 0100 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 0101 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 0110 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE},
+            /* 0111 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 1000 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE},
+            /* 1001 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE},
+            /* 1010 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE},
+            /* 1011 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE},
+            /* 1100 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE},
+            /* 1101 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE},
+            /* 1110 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE},
+            /* 1111 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE}
+        },
+        // TURN_AROUND_CCW
+        {
+            /* 0000 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, LOST_LINE},
+            /* 0001 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, NEAR_LINE},
+            /* 0010 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE},
+            /* 0011 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE},
+            /* 0100 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 0101 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 0110 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE},
+            /* 0111 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 1000 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 1001 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 1010 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE},
+            /* 1011 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, ON_LINE},
+            /* 1100 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 1101 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 1110 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER},
+            /* 1111 */ {STEER_TURN, 0, ACTION_IN_PROGRESS, OTHER}
+        }
+    };
+
+    /**
+     * Steering gains used when there is no gain schedule file, in order of
+     * increasing speed. Faster robots drift off the line faster, so need
+     * stiffer steering and more damping.
+     *
+     * These were picked by a grid search on the simulator, keeping each
+     * gain non-decreasing with speed: the robot starts 0.1 to 0.5 radians
+     * off the line, and the worst RMS offset once settled is about 0.5mm
+     * at any speed. They have not been measured on the robot; a gainsfile
+     * tuned there replaces them.
+     */
+    static const LineFollowingGains DEFAULT_GAIN_SCHEDULE[] = {
+        {20, 40.0, 1000.0, 0.0},
+        {80, 60.0, 1000.0, 0.25},
+        {127, 60.0, 1000.0, 0.25}
+    };
+
+    /**
+     * How far round each LineFollowingTurnDirection goes before the
+     * line is found again, in radians.
+     */
+    static const double TURN_ANGLES[MAX_TURN_DIRECTION] = {
+        1.5708, 1.5708, 3.1416, 3.1416
+    };
+
     /**
      * Construct the Line Follower
      */
     LineFollowing::LineFollowing(HardwareAbstractionLayer* hal)
-        : _hal(hal), _left_error(0), _right_error(0), _speed(0),
-        _lost_turning_line(false), _lost_time(0), _lines_seen(0),
-        _integral_gain(5.0), _lost_timeout(50), _turning_timeout(400)
+        : _hal(hal), _filter(0), _history(0), _estimator(0), _turn_rates(0),
+        _turn_rates_learned(false), _error(0), _integral(0),
+        _derivative(0), _speed(0), _lost_turning_line(false), _lost_since(0),
+        _last_timestamp(0), _tick(0), _lines_seen(0), _turn_phase(TURN_IDLE),
+        _turn_rotation(0), _turn_start_heading(0),
+        _recovery_phase(RECOVERY_IDLE), _recovery_side(0),
+        _recovery_heading(0), _recovery_distance(0), _lost_timeout(250000)
     {
         INFO("Initialising a Line Follower");
         TRACE("LineFollowing(" << hal << ")");
+
+        if(!this->load_gain_schedule(LINE_FOLLOWING_GAINS_FILE)) {
+            INFO("Using the default gain schedule");
+            this->_gain_schedule.assign(DEFAULT_GAIN_SCHEDULE,
+                DEFAULT_GAIN_SCHEDULE + sizeof(DEFAULT_GAIN_SCHEDULE) /
+                sizeof(DEFAULT_GAIN_SCHEDULE[0]));
+        }
+        this->_gains = this->_gain_schedule[0];
+
+        this->_filter = new LineSensorFilter();
+        this->_history = new SensorHistory();
+        this->_estimator = new LinePositionEstimator();
+
+        this->_turn_rates = new TurnRates();
+        if(!this->_turn_rates->load(TURN_RATES_FILE))
+            INFO("Using the default turn rates");
+    }
+
+    /**
+     * Destruct the Line Follower, saving any turn rates learned and
+     * deleting the sensor filter, history, position estimator and turn
+     * rates
+     */
+    LineFollowing::~LineFollowing()
+    {
+        TRACE("~LineFollowing()");
+        this->save_turn_rates();
+        if(this->_filter)
+            delete this->_filter;
+        if(this->_history)
+            delete this->_history;
+        if(this->_estimator)
+            delete this->_estimator;
+        if(this->_turn_rates)
+            delete this->_turn_rates;
     }
 
     /**
-     * Read line sensors and correct motor movement to keep us going straight.
+     * Sample the sensors and correct motor movement to keep us going
+     * straight.
      *
      * \returns A LineFollowingStatus to indicate that either we are going
      * fine, we are lost, or one or more possible turns were found.
      */
     LineFollowingStatus LineFollowing::follow_line() {
         TRACE("follow_line()");
+        return this->follow_line(this->_hal->sample());
+    }
+
+    /**
+     * Correct motor movement to keep us going straight, using an already
+     * sampled SensorFrame.
+     *
+     * \param frame The SensorFrame for this control tick
+     * \returns A LineFollowingStatus to indicate that either we are going
+     * fine, we are lost, or one or more possible turns were found.
+     */
+    LineFollowingStatus LineFollowing::follow_line(const SensorFrame& frame)
+    {
+        TRACE("follow_line(frame)");
 
         // Quick speed sanity check to prevent otherwise very frustrating
         // mistakes
@@ -47,179 +242,192 @@ namespace IDP {
         // We're not turning, so reset the state in case it's incorrect
         this->_lost_turning_line = false;
         this->_lines_seen = 0;
+        this->_turn_phase = TURN_IDLE;
 
-        // Read the state of the IR sensors from hal
-        const LineSensors s = _hal->line_following_sensors();
+        this->update_tick(frame);
+        this->observe(frame);
 
-        // Take various appropriate action depending on sensor state.
-        // A long if statement but at least it's not very deeply nested.
-        if( s.line_left == LINE && s.line_right == LINE &&
-            s.outer_left == NO_LINE && s.outer_right == NO_LINE)
-        {
-            // We are okay! Keep driving forwards
-            DEBUG("Driving forwards");
-            this->_left_error = this->_right_error = this->_lost_time  = 0;
-            this->correct_steering();
-            return ACTION_IN_PROGRESS;
-        } else if(  s.line_left == NO_LINE && s.line_right == LINE &&
-                    s.outer_left == NO_LINE && s.outer_right == NO_LINE)
-        {
-            // Have veered a little left, compensate
-            DEBUG("Compensating for slight left drift");
-            this->_left_error++;
-            this->_right_error = this->_lost_time = 0;
-            this->correct_steering();
-            return ACTION_IN_PROGRESS;
-        } else if(  s.line_left == LINE && s.line_right == NO_LINE &&
-                    s.outer_left == NO_LINE && s.outer_right == NO_LINE)
-        {
-            // Have veered a little right, compensate
-            DEBUG("Compensating for slight right drift");
-            this->_right_error++;
-            this->_lost_time = 0;
-            this->_left_error = this->_lost_time = 0;
-            this->correct_steering();
-            return ACTION_IN_PROGRESS;
-        } else if(  s.line_left == NO_LINE && s.line_right == NO_LINE &&
-                    s.outer_left == LINE && s.outer_right == NO_LINE)
-        {
-            // We've veered a lot right, compensate
-            DEBUG("Compensating for large right drift");
-            this->_right_error += EDGE_ERROR;
-            this->_left_error = this->_lost_time = 0;
-            this->correct_steering();
-            return ACTION_IN_PROGRESS;
-        } else if(  s.line_left == NO_LINE && s.line_right == NO_LINE &&
-                    s.outer_left == NO_LINE && s.outer_right == LINE)
-        {
-            // We've veered a lot left, compensate
-            DEBUG("Compensating for large left drift");
-            this->_left_error += EDGE_ERROR;
-            this->_right_error = this->_lost_time = 0;
-            this->correct_steering();
-            return ACTION_IN_PROGRESS;
-        } else if(  s.line_left == LINE && s.line_right == LINE &&
-                    s.outer_left == LINE && s.outer_right == NO_LINE)
-        {
-            // Found a left turn
-            INFO("Left turn found");
-            this->_right_error = this->_left_error = this->_lost_time = 0;
-            this->correct_steering();
-            return LEFT_TURN_FOUND;
-        } else if(  s.line_left == LINE && s.line_right == LINE &&
-                    s.outer_left == NO_LINE && s.outer_right == LINE)
-        {
-            // Found a right turn
-            INFO("Right turn found");
-            this->_right_error = this->_left_error = this->_lost_time = 0;
-            this->correct_steering();
-            return RIGHT_TURN_FOUND;
-        } else if(  s.line_left == LINE && s.line_right == LINE &&
-                    s.outer_left == LINE && s.outer_right == LINE)
-        {
-            // Found both turns
-            INFO("Both turns found");
-            this->_right_error = this->_left_error = this->_lost_time = 0;
-            this->correct_steering();
-            return BOTH_TURNS_FOUND;
-        } else if(  s.line_left == NO_LINE && s.line_right == NO_LINE &&
-                    s.outer_left == NO_LINE && s.outer_right == NO_LINE)
-        {
+        // Keep searching for a lost line until we find it again
+        if(this->_recovery_phase != RECOVERY_IDLE && !this->recovered())
+            return this->recover();
+
+        // Look up what to do for this tick's debounced sensor state
+        const LineFollowingAction& action =
+            FOLLOW_ACTIONS[this->_filter->nibble()];
+        DEBUG("Steering action " <<
+            LineFollowingSteeringStrings[action.steering]);
+        double error = this->_error;
+        bool tracking = false;
+
+        if(action.steering == STEER_SEARCH) {
             // We can't see any lines. If it has been a long time since
-            // we were on a line, return LOST, otherwise correct towards
-            // the last known direction.
-            DEBUG("No line visible");
-            this->_lost_time++;
-            if(this->_lost_time > this->_lost_timeout) {
-                // Prevent lost_time from overflowing
-                INFO("Haven't seen a line for a while, LOST");
-                this->_lost_time--;
-                this->correct_steering();
-                return LOST;
-            } else {
-                DEBUG("Trying to find the line");
-                if(this->_left_error)
-                    this->_left_error++;
-                else if(this->_right_error)
-                    this->_right_error++;
-                this->correct_steering();
-                return ACTION_IN_PROGRESS;
+            // we were on a line, go and search for it, otherwise steer
+            // hard towards the last known direction.
+            if(!this->_lost_since)
+                this->_lost_since = frame.timestamp;
+            if(frame.timestamp - this->_lost_since > this->_lost_timeout) {
+                INFO("Haven't seen a line for a while, searching");
+                // A positive error means we drifted left, so the line is
+                // to our right, clockwise
+                this->begin_recovery(RECOVERY_SWEEP,
+                    this->_error > 0 ? -1 : 1);
+                return this->recover();
             }
-        } else {
-            // Something odd happened. Keep driving as we were.
-            DEBUG("In an unhandled state, continuing steering as before");
-            this->correct_steering();
-            return ACTION_IN_PROGRESS;
+            if(this->_error > 0)
+                error = action.error;
+            else if(this->_error < 0)
+                error = -action.error;
+        } else if(action.steering != STEER_HOLD) {
+            // The sensors show roughly where the line is, and the times
+            // they changed show more precisely
+            this->_estimator->update(frame.timestamp, action.error);
+            error = this->_estimator->offset();
+            tracking = true;
+            this->_lost_since = 0;
+            DEBUG("Line at " << error << ", moving at " <<
+                this->_estimator->rate() << "/s");
+        }
+        // Anything else is something odd, so keep steering as before
+
+        // Only report a junction once it has been seen for long enough
+        // to be sure of it
+        LineFollowingStatus status = action.status;
+        if(status != ACTION_IN_PROGRESS) {
+            status = this->confirmed_junction();
+            if(status == NO_TURNS_FOUND)
+                status = ACTION_IN_PROGRESS;
+            else
+                INFO("Found " << LineFollowingStatusStrings[status]);
         }
+
+        this->correct_steering(error, tracking);
+        return status;
     }
 
     /**
-     * Correct the steering of the robot after the error has been
-     * calculated in follow_line.
+     * Work out how long this control tick was from the frame timestamps,
+     * so the steering controller runs in real time whatever the loop
+     * rate.
+     * \param frame The SensorFrame for this control tick
      */
-    void LineFollowing::correct_steering()
+    void LineFollowing::update_tick(const SensorFrame& frame)
     {
-        TRACE("correct_steering()");
+        TRACE("update_tick(frame)");
 
-        // Calculate available headroom for applying a forward
-        // correction
-        unsigned short int headroom = MOTOR_MAX_SPEED - this->_speed;
+        // Assume a normal tick for the first frame or after a pause
+        unsigned long long int elapsed = CONTROL_PERIOD;
+        if(this->_last_timestamp && frame.timestamp >= this->_last_timestamp)
+            elapsed = frame.timestamp - this->_last_timestamp;
+        if(elapsed > MAX_TICK_GAP) {
+            // The old error history no longer applies
+            elapsed = CONTROL_PERIOD;
+            this->reset_controller();
+        }
 
-        // Switch based on error direction
-        if(_left_error) {
-            DEBUG("Correcting a left error");
+        this->_last_timestamp = frame.timestamp;
+        this->_tick = static_cast<double>(elapsed) / 1000000.0;
+    }
 
-            // Calculate the required differential correction
-            unsigned short int correction = static_cast<unsigned short int>(
-                static_cast<double>(_left_error) * this->_integral_gain);
-            
-            DEBUG("Pre-cap correction: " << correction);
+    /**
+     * Pass a frame through the sensor filter, and keep the debounced
+     * sensors in the history if the frame is new.
+     * \param frame The SensorFrame for this control tick
+     */
+    void LineFollowing::observe(const SensorFrame& frame)
+    {
+        TRACE("observe(frame)");
+        if(this->_filter->update(frame))
+            this->_history->push(frame.timestamp, this->_filter->nibble());
+    }
 
-            // Cap correction
-            correction = cap_correction(correction);
+    /**
+     * Forget the steering controller's error history, for when we have
+     * not been following a line.
+     */
+    void LineFollowing::reset_controller()
+    {
+        TRACE("reset_controller()");
+        this->_error = this->_integral = this->_derivative = 0;
+        this->_estimator->reset();
+    }
 
-            DEBUG("Post-cap correction: " << correction);
+    /**
+     * Correct the steering of the robot after the error has been
+     * measured in follow_line, using a PID controller.
+     * \param error The signed steering error, positive if we have veered
+     * left of the line
+     * \param tracking Whether the LinePositionEstimator was updated from
+     * the line this tick, so its heading estimate is current
+     */
+    void LineFollowing::correct_steering(const double error,
+        const bool tracking)
+    {
+        TRACE("correct_steering(" << error << ", " << tracking << ")");
 
-            // Apply as much correction as possible to the left
-            // wheel forwards and whatever is left to right backwards
-            if(headroom >= correction) {
-                this->_hal->motor_left_forward(this->_speed + correction);
-                this->_hal->motor_right_forward(this->_speed);
-            } else {
-                this->_hal->motor_left_forward(this->_speed + headroom);
-                this->_hal->motor_right_forward(
-                    this->_speed - (correction - headroom));
-            }
+        // While we can see the line, the estimator's rate is how fast the
+        // offset is changing, which is our heading relative to the line,
+        // so it steers the derivative term. Otherwise the error changes
+        // in steps as the line crosses each sensor, so low pass filter
+        // its derivative to avoid kicking the motors. A repeated frame
+        // has no time between it and the last.
+        if(tracking) {
+            this->_derivative = this->_estimator->rate();
+        } else if(this->_tick > 0) {
+            double change = (error - this->_error) / this->_tick;
+            this->_derivative += (change - this->_derivative) * this->_tick
+                / (DERIVATIVE_FILTER_TIME + this->_tick);
+        }
+        this->_error = error;
 
-        } else if(_right_error) {
-            DEBUG("Correcting a right error");
+        double correction = this->_gains.proportional * error +
+            this->_gains.integral * this->_integral +
+            this->_gains.derivative * this->_derivative;
 
-            // Calculate the required differential correction
-            unsigned short int correction = static_cast<unsigned short int>(
-                static_cast<double>(_right_error) * this->_integral_gain);
-            
-            DEBUG("Pre-cap correction: " << correction);
+        // Don't wind up the integral while the correction is saturated in
+        // the direction it would push it, or we overshoot on coming back
+        if((correction < MAX_CORRECTION || error < 0) &&
+            (correction > -MAX_CORRECTION || error > 0))
+        {
+            this->_integral += error * this->_tick;
+            if(this->_gains.integral > 0) {
+                double limit = MAX_CORRECTION / this->_gains.integral;
+                if(this->_integral > limit)
+                    this->_integral = limit;
+                else if(this->_integral < -limit)
+                    this->_integral = -limit;
+            }
+        }
 
-            // Cap correction
-            correction = cap_correction(correction);
+        DEBUG("Error " << error << ", integral " << this->_integral <<
+            ", derivative " << this->_derivative << ", correction " <<
+            correction);
 
-            DEBUG("Post-cap correction: " << correction);
+        // Cap correction
+        unsigned short int magnitude = cap_correction(
+            correction > MAX_CORRECTION || correction < -MAX_CORRECTION ?
+            MAX_CORRECTION : static_cast<unsigned short int>(
+                correction < 0 ? -correction : correction));
 
-            // Apply as much correction as possible to the right
-            // wheel forwards and whatever is right to left backwards
-            if(headroom >= correction) {
-                this->_hal->motor_right_forward(this->_speed + correction);
-                this->_hal->motor_left_forward(this->_speed);
-            } else {
-                this->_hal->motor_right_forward(this->_speed + headroom);
-                this->_hal->motor_left_forward(
-                    this->_speed - (correction - headroom));
-            }
+        // Calculate available headroom for applying a forward
+        // correction
+        unsigned short int headroom = MOTOR_MAX_SPEED - this->_speed;
+
+        // The wheel on the far side from the line speeds up by as much of
+        // the correction as the headroom allows, and the other wheel
+        // slows down by whatever is left.
+        int fast = this->_speed;
+        int slow = this->_speed;
+        if(headroom >= magnitude) {
+            fast += magnitude;
         } else {
-            // No correction required so drive forwards
-            DEBUG("No correction required");
-            this->_hal->motors_forward(this->_speed);
+            fast += headroom;
+            slow -= magnitude - headroom;
         }
+
+        if(correction > 0)
+            this->_hal->set_wheels(fast, slow);
+        else
+            this->_hal->set_wheels(slow, fast);
     }
 
     /**
@@ -231,7 +439,7 @@ namespace IDP {
             unsigned short int skip_lines)
     {
         TRACE("turn_left(" << skip_lines << ")");
-        return this->turn(TURN_LEFT, skip_lines);
+        return this->turn(TURN_LEFT, this->_hal->sample(), skip_lines);
     }
 
     /**
@@ -243,7 +451,7 @@ namespace IDP {
             unsigned short int skip_lines)
     {
         TRACE("turn_right(" << skip_lines << ")");
-        return this->turn(TURN_RIGHT, skip_lines);
+        return this->turn(TURN_RIGHT, this->_hal->sample(), skip_lines);
     }
 
     /**
@@ -255,7 +463,7 @@ namespace IDP {
             unsigned short int skip_lines)
     {
         TRACE("turn_around_cw(" << skip_lines << ")");
-        return this->turn(TURN_AROUND_CW, skip_lines);
+        return this->turn(TURN_AROUND_CW, this->_hal->sample(), skip_lines);
     }
 
     /**
@@ -268,7 +476,7 @@ namespace IDP {
             unsigned short int skip_lines)
     {
         TRACE("turn_around_ccw(" << skip_lines << ")");
-        return this->turn(TURN_AROUND_CCW, skip_lines);
+        return this->turn(TURN_AROUND_CCW, this->_hal->sample(), skip_lines);
     }
 
     /**
@@ -277,10 +485,16 @@ namespace IDP {
     LineFollowingStatus LineFollowing::turn_around_delivery()
     {
         TRACE("turn_around_delivery()");
-        LineFollowingStatus status = this->turn(TURN_AROUND_CW, 0);
+
+        // We stop as soon as the line goes, so there is no open loop
+        // part of this turn, and it must not overshoot
+        if(this->_turn_phase == TURN_IDLE)
+            this->begin_turn(TURN_SLOWING);
+
+        LineFollowingStatus status = this->turn(TURN_AROUND_CW,
+            this->_hal->sample());
         if(this->_lost_turning_line) {
-            this->_lost_turning_line = false;
-            this->_lost_time = 0;
+            this->end_turn();
             return ACTION_COMPLETED;
         } else {
             return status;
@@ -288,42 +502,88 @@ namespace IDP {
     }
 
     /**
-     * Return whether we can see a junction or not, without
-     * changing motor settings.
+     * Sample the sensors and return whether we can see a junction or not,
+     * without changing motor settings.
      * \returns A LineFollowingStatus indicating junctions or
      * NO_TURNS_FOUND if no junctions found.
      */
     LineFollowingStatus LineFollowing::junction_status()
     {
         TRACE("junction_status()");
+        return this->junction_status(this->_hal->sample());
+    }
 
-        // Read the state of the IR sensors from hal
-        const LineSensors s = _hal->line_following_sensors();
-
-        // If the inner sensors do not detect a line, it implies we
-        // are not really at a junction anyway, but maybe have drifted
-        // far enough to a side that we think the main line is a junction.
-        // Therefore, return early in this case.
-        //
-        // Otherwise, we check the outer sensors for junctions.
-        if(s.line_left == NO_LINE || s.line_right == NO_LINE) {
-            DEBUG("Not looking at edge sensors as inner sensors are NO_LINE");
-            return NO_TURNS_FOUND;
-        } else if(s.outer_left == LINE && s.outer_right == LINE) {
-            INFO("Found both turns");
+    /**
+     * Add a SensorFrame to the sensor filter and return whether a
+     * junction has been confirmed or not, without changing motor settings.
+     * \param frame The SensorFrame for this control tick
+     * \returns A LineFollowingStatus indicating junctions or
+     * NO_TURNS_FOUND if no junctions found.
+     */
+    LineFollowingStatus LineFollowing::junction_status(
+        const SensorFrame& frame)
+    {
+        TRACE("junction_status(frame)");
+
+        this->observe(frame);
+        LineFollowingStatus status = this->confirmed_junction();
+        if(status != NO_TURNS_FOUND)
+            INFO("Found " << LineFollowingStatusStrings[status]);
+        return status;
+    }
+
+    /**
+     * Check the sensor history for a junction we have just driven over,
+     * without changing motor settings. Each junction is only reported
+     * once, as soon as we are past it.
+     * \returns A LineFollowingStatus indicating the junction's turns, or
+     * NO_TURNS_FOUND if we have not just passed one.
+     */
+    LineFollowingStatus LineFollowing::passed_junction()
+    {
+        TRACE("passed_junction()");
+
+        unsigned char turns = this->_history->passed_junction(
+            this->_filter->confirm_frames());
+        if((turns & SENSOR_OUTER_LEFT) && (turns & SENSOR_OUTER_RIGHT)) {
+            INFO("Passed a junction with both turns");
             return BOTH_TURNS_FOUND;
-        } else if(s.outer_left == LINE) {
-            INFO("Found left turn");
+        } else if(turns & SENSOR_OUTER_LEFT) {
+            INFO("Passed a junction with a left turn");
             return LEFT_TURN_FOUND;
-        }  else if(s.outer_right == LINE) {
-            INFO("Found right turn");
+        } else if(turns & SENSOR_OUTER_RIGHT) {
+            INFO("Passed a junction with a right turn");
             return RIGHT_TURN_FOUND;
         } else {
-            DEBUG("No turns found");
             return NO_TURNS_FOUND;
         }
     }
 
+    /**
+     * Work out which turns the sensor filter has confirmed.
+     *
+     * The filter only confirms a junction while both inner sensors are on
+     * the line, as otherwise we may have drifted far enough to one side
+     * that the main line looks like a junction.
+     *
+     * \returns A LineFollowingStatus indicating junctions or
+     * NO_TURNS_FOUND if no junction is confirmed.
+     */
+    LineFollowingStatus LineFollowing::confirmed_junction() const
+    {
+        TRACE("confirmed_junction()");
+
+        unsigned char turns = this->_filter->junction();
+        if((turns & SENSOR_OUTER_LEFT) && (turns & SENSOR_OUTER_RIGHT))
+            return BOTH_TURNS_FOUND;
+        else if(turns & SENSOR_OUTER_LEFT)
+            return LEFT_TURN_FOUND;
+        else if(turns & SENSOR_OUTER_RIGHT)
+            return RIGHT_TURN_FOUND;
+        else
+            return NO_TURNS_FOUND;
+    }
+
     /**
      * Set the speed that motors will be driven at
      * \param speed How fast to drive the motors, 0 to MOTOR_MAX_SPEED.
@@ -333,81 +593,123 @@ namespace IDP {
         TRACE("set_speed(" << speed << ")");
         DEBUG("set_speed called with speed=" << speed);
 
+        // Navigation changes the speed often as it speeds up and slows
+        // down, so only mention it when debugging
         if(speed < MOTOR_MAX_SPEED) {
-            INFO("Setting motor speed to " << speed);
+            DEBUG("Setting motor speed to " << speed);
             this->_speed = speed;
         } else {
-            INFO("Setting motor speed to MOTOR_MAX_SPEED (" <<
+            DEBUG("Setting motor speed to MOTOR_MAX_SPEED (" <<
                 MOTOR_MAX_SPEED << ")");
             this->_speed = MOTOR_MAX_SPEED;
         }
 
-        // Update the gain of LineFollowing's integral controller
-        // to compensate for the new speed
+        // Look up the steering gains for the new speed, interpolating
+        // between the two nearest entries in the gain schedule
+        const std::vector<LineFollowingGains>& schedule =
+            this->_gain_schedule;
+        std::vector<LineFollowingGains>::size_type i = 0;
+        while(i < schedule.size() && schedule[i].speed < this->_speed)
+            i++;
+        if(i == 0) {
+            this->_gains = schedule.front();
+        } else if(i == schedule.size()) {
+            this->_gains = schedule.back();
+        } else {
+            const LineFollowingGains& lo = schedule[i - 1];
+            const LineFollowingGains& hi = schedule[i];
+            double t = static_cast<double>(this->_speed - lo.speed) /
+                (hi.speed - lo.speed);
+            this->_gains.speed = this->_speed;
+            this->_gains.proportional = lo.proportional +
+                t * (hi.proportional - lo.proportional);
+            this->_gains.integral = lo.integral +
+                t * (hi.integral - lo.integral);
+            this->_gains.derivative = lo.derivative +
+                t * (hi.derivative - lo.derivative);
+        }
+        DEBUG("Setting new gains to P=" << this->_gains.proportional <<
+            " I=" << this->_gains.integral << " D=" <<
+            this->_gains.derivative);
+
         unsigned short int diff = MOTOR_MAX_SPEED - this->_speed;
-        double new_gain = 5.0 - (static_cast<double>(diff) / 36.0);
-        DEBUG("Setting new gain to " << new_gain);
-        this->_integral_gain = new_gain;
 
-        // Update the LOST_TIMEOUT loop iterations to account for
-        // the change in robot speed
-        unsigned int new_timeout = BASELINE_STRAIGHT_TIMEOUT + (diff/5);
+        // Slower robots take longer to find the line again, so give them
+        // longer before deciding we are LOST
+        unsigned int new_timeout = BASELINE_STRAIGHT_TIMEOUT +
+            diff * TIMEOUT_PER_SPEED_STEP;
         DEBUG("Setting new LOST timeout to " << new_timeout);
         this->_lost_timeout = new_timeout;
 
-        // Now update the LOST_TIMEOUT for turning actions
-        new_timeout = BASELINE_TURN_TIMEOUT + (diff/5);
-        DEBUG("Setting new LOST TURNING timeout to " << new_timeout);
-        this->_turning_timeout = new_timeout;
+        // Slower robots see each junction for more frames
+        this->_filter->set_speed(this->_speed);
     }
 
     /**
-     * Return the current line status, depending on turning direction.
-     * \param dir The turning direction
-     * \returns a LineFollowingLineStatus
+     * The speed the motors are being driven at.
+     * \returns The speed last set with set_speed()
      */
-    LineFollowingLineStatus LineFollowing::line_status(
-        LineFollowingTurnDirection dir)
+    unsigned short int LineFollowing::speed() const
     {
-        TRACE("line_status(" << LineFollowingTurnDirectionStrings[dir] << ")");
+        return this->_speed;
+    }
 
-        // Read the IR sensors from HAL
-        const LineSensors s = _hal->line_following_sensors();
-        
-        if(s.line_left == LINE && s.line_right == LINE &&
-            s.outer_left == NO_LINE && s.outer_right == NO_LINE)
-        {
-            // Dead on the line
-            DEBUG("Line status: We are perfectly on the line");
-            return ON_LINE;
-        } else if(s.line_left == NO_LINE && s.line_right == NO_LINE &&
-                  s.outer_left == NO_LINE && s.outer_right == NO_LINE)
+    /**
+     * Load a steering gain schedule. See misc/gainsfile_format.
+     * \param filename The file to read it from
+     * \returns true if a valid schedule was loaded, otherwise false and
+     * the current schedule is kept
+     *
+     * The new gains take effect at the next call to set_speed().
+     */
+    bool LineFollowing::load_gain_schedule(const char* filename)
+    {
+        TRACE("load_gain_schedule(" << filename << ")");
+
+        std::ifstream f(filename);
+        if(!f.is_open()) {
+            DEBUG("Could not open " << filename);
+            return false;
+        }
+
+        std::vector<LineFollowingGains> schedule;
+        LineFollowingGains gains;
+        while(f >> gains.speed >> gains.proportional >> gains.integral
+            >> gains.derivative)
         {
-            // Totally off the line
-            DEBUG("Line status: We cannot see the line at all");
-            return LOST_LINE;
-        } else {
-            // Different cases for different directions
-            if(
-                (dir == TURN_LEFT &&
-                    (s.line_left == LINE && s.line_right == NO_LINE)) ||
-                (dir == TURN_RIGHT &&
-                    (s.line_left == NO_LINE && s.line_right == LINE)) ||
-                (dir == TURN_AROUND_CW &&
-                    (s.outer_right == LINE)) ||
-                (dir == TURN_AROUND_CCW &&
-                    (s.line_left == LINE && s.line_right == NO_LINE))
-            ) {
-                DEBUG("Line status: on the line for our turning direction");
-                return ON_LINE;
-            } else {
-                DEBUG("Line status: other");
-                return OTHER;
+            if(!schedule.empty() && gains.speed <= schedule.back().speed) {
+                ERROR("Gain schedule in " << filename <<
+                    " is not in order of increasing speed, ignoring it");
+                return false;
             }
+            schedule.push_back(gains);
         }
+        f.close();
 
-        // We shouldn't ever get here but the compiler can get confused.
-        return OTHER;
+        if(schedule.empty()) {
+            ERROR("No gains found in " << filename << ", ignoring it");
+            return false;
+        }
+
+        INFO("Read " << schedule.size() << " gain schedule entries from " <<
+            filename);
+        this->_gain_schedule = schedule;
+        return true;
+    }
+
+    /**
+     * Write the turn rates out to TURN_RATES_FILE for the next run, if any
+     * turns have been learned since they were last saved. This is left
+     * until the mission is over, rather than done in the middle of a
+     * control tick after every turn.
+     */
+    void LineFollowing::save_turn_rates()
+    {
+        TRACE("save_turn_rates()");
+        if(!this->_turn_rates_learned)
+            return;
+        if(this->_turn_rates->save(TURN_RATES_FILE))
+            this->_turn_rates_learned = false;
     }
 
     /**
@@ -417,39 +719,88 @@ namespace IDP {
      * all essentially just wrappers for this functions. They stop it
      * being called with silly arguments, at least.
      *
+     * The turn starts open loop at full speed. Once the learned turn
+     * rate says the line is TURN_SLOWDOWN_FRACTION of the turn away we
+     * slow to half the line following speed, and once any sensor sees
+     * the line we creep round at TURN_CAPTURE_SPEED until it is under
+     * the inner sensors. When there are lines to skip we cannot tell how
+     * far round the right one is, so go at the slower speed throughout.
+     * How far we turned is then used to refine the learned rate.
+     *
      * \param dir The direction to turn in
+     * \param frame The SensorFrame for this control tick
      * \param skip_lines How many lines we should detect and skip over
      */
     LineFollowingStatus LineFollowing::turn(LineFollowingTurnDirection dir,
-            unsigned short int skip_lines)
+            const SensorFrame& frame, unsigned short int skip_lines)
     {
         TRACE("turn(" << LineFollowingTurnDirectionStrings[dir] << ")");
         INFO("Executing a " << LineFollowingTurnDirectionStrings[dir]);
 
-        // Set the motors going
-        this->set_motors_turning(dir);
+        // We are not following a line, so the steering controller starts
+        // afresh afterwards.
+        this->update_tick(frame);
+        this->reset_controller();
+        this->observe(frame);
+
+        // If we turned right past the line, search for it, and count
+        // finding any line as the end of the turn
+        if(this->_recovery_phase != RECOVERY_IDLE) {
+            if(!this->recovered())
+                return this->recover_turn();
+            this->end_turn();
+            return ACTION_COMPLETED;
+        }
+
+        if(this->_turn_phase == TURN_IDLE)
+            this->begin_turn(skip_lines ? TURN_SLOWING : TURN_OPEN_LOOP);
+
+        // How far the wheels have turned us, as the difference between
+        // their speeds integrated over time, which is what the turn
+        // rates are learned against
+        const Odometry& odometry = this->_hal->odometry();
+        this->_turn_rotation = std::fabs(odometry.heading() -
+            this->_turn_start_heading) * odometry.wheel_base() /
+            odometry.mm_per_speed_unit();
+
+        // How far round we think we are, against how far the line should
+        // be at most, in radians
+        double rate = this->_turn_rates->rate(dir);
+        double turned = rate * this->_turn_rotation;
+        double expected = TURN_ANGLES[dir];
+        if(skip_lines)
+            expected += TURN_SKIP_MARGIN;
+        DEBUG("Turned " << turned << " of " << expected << " in " <<
+            LineFollowingTurnPhaseStrings[this->_turn_phase]);
 
         // Check the current line status for this turn direction
-        LineFollowingLineStatus status = this->line_status(dir);
+        LineFollowingLineStatus status =
+            TURN_ACTIONS[dir][this->_filter->nibble()].line;
+        DEBUG("Line status: " << LineFollowingLineStatusStrings[status]);
 
         if(status == ON_LINE) {
             // If we are on the line, we have either just started to turn
             // and not yet moved much, so keep turning, or have re-found
             // the line after turning, so indicate success.
             DEBUG("Turning, currently on the line");
+            this->_lost_since = 0;
             if(!this->_lost_turning_line) {
                 DEBUG("Still starting the turn");
-                return ACTION_IN_PROGRESS;
             } else {
                 INFO("Found a line again");
                 this->_lost_turning_line = false;
                 if(this->_lines_seen < skip_lines) {
                     INFO("Skipping this line");
                     this->_lines_seen++;
-                    return ACTION_IN_PROGRESS;
+                    this->_turn_phase = TURN_SLOWING;
                 } else {
                     INFO("Found final line, ending turn");
-                    this->_lines_seen = 0;
+                    if(!skip_lines && this->_turn_rotation > 0) {
+                        this->_turn_rates->learn(dir,
+                            TURN_ANGLES[dir] / this->_turn_rotation);
+                        this->_turn_rates_learned = true;
+                    }
+                    this->end_turn();
                     return ACTION_COMPLETED;
                 }
             }
@@ -462,53 +813,212 @@ namespace IDP {
                 this->_lost_turning_line = true;
             }
 
-            // Increment the lost_time counter so if we don't find the line
-            // we can think about recovering rather than going in circles
-            // forever.
-            this->_lost_time++;
-            if(this->_lost_time > this->_turning_timeout) {
-                ERROR("Haven't seen the line for ages while turning, LOST");
-                this->_lost_time--; //prevent overflow
-                return LOST;
+            // If we have gone far past where the line should be, give up
+            // rather than going in circles forever.
+            if(turned > TURN_LOST_FACTOR * expected) {
+                INFO("Turned " << turned << " without finding the line, "
+                    "searching");
+                this->begin_recovery(RECOVERY_ARC,
+                    dir == TURN_LEFT || dir == TURN_AROUND_CCW ? 1 : -1);
+                return this->recover_turn();
             }
 
-            return ACTION_IN_PROGRESS;
+            // Slow down for the end of the turn, or if the line we were
+            // capturing slipped away again
+            if((this->_turn_phase == TURN_OPEN_LOOP &&
+                turned > (1 - TURN_SLOWDOWN_FRACTION) * expected) ||
+                this->_turn_phase == TURN_CAPTURE)
+            {
+                DEBUG("Nearly round, slowing down");
+                this->_turn_phase = TURN_SLOWING;
+            }
+        } else if(status == NEAR_LINE && this->_lost_turning_line) {
+            // The line we are turning towards is coming into view
+            DEBUG("Turning, line coming into view");
+            this->_turn_phase = TURN_CAPTURE;
         } else {
             // Other states are acceptable and mostly transition states.
             // Keep on turning.
             DEBUG("Turning, in an unhandled state");
-            return ACTION_IN_PROGRESS;
         }
+
+        // Set the motors going at the speed for this phase
+        unsigned short int speed = MOTOR_MAX_SPEED;
+        if(this->_turn_phase == TURN_SLOWING)
+            speed = this->_speed / 2;
+        else if(this->_turn_phase == TURN_CAPTURE)
+            speed = TURN_CAPTURE_SPEED < this->_speed / 2 ?
+                TURN_CAPTURE_SPEED : this->_speed / 2;
+        this->set_motors_turning(dir, speed);
+
+        return ACTION_IN_PROGRESS;
     } 
 
+    /**
+     * Start searching for a lost line.
+     * \param phase The phase to start the search in. A turn that has
+     * gone past the line has already swept round, so goes straight to
+     * RECOVERY_ARC.
+     * \param side Which way to search, 1 for anticlockwise or -1 for
+     * clockwise
+     */
+    void LineFollowing::begin_recovery(const LineFollowingRecoveryPhase phase,
+        const int side)
+    {
+        TRACE("begin_recovery(" << LineFollowingRecoveryPhaseStrings[phase]
+            << ", " << side << ")");
+
+        this->_recovery_phase = phase;
+        this->_recovery_side = side;
+        this->_recovery_heading = this->_hal->odometry().heading();
+        this->_recovery_distance = this->_hal->odometry().distance();
+    }
+
+    /**
+     * Check whether a search has found a line, and stop searching if so.
+     * \returns true if an inner sensor can see a line
+     */
+    bool LineFollowing::recovered()
+    {
+        TRACE("recovered()");
+
+        if(!(this->_filter->nibble() & (SENSOR_LINE_LEFT | SENSOR_LINE_RIGHT)))
+            return false;
+
+        INFO("Found the line again");
+        this->_recovery_phase = RECOVERY_IDLE;
+        this->_lost_since = 0;
+        this->reset_controller();
+        return true;
+    }
+
+    /**
+     * Drive one tick of the search for a lost line.
+     *
+     * Spin towards the side the line was last seen until we have turned
+     * RECOVERY_SWEEP_ANGLE, then as far the other way, then spiral out
+     * back towards the first side. The inner wheel speeds up as we go,
+     * so the spiral gets wider, and after RECOVERY_MAX_DISTANCE we give
+     * up.
+     *
+     * \returns ACTION_IN_PROGRESS while searching, or LOST if we have
+     * given up
+     */
+    LineFollowingStatus LineFollowing::recover()
+    {
+        TRACE("recover()");
+
+        const Odometry& odometry = this->_hal->odometry();
+        int side = this->_recovery_side;
+
+        double turned = side * (odometry.heading() - this->_recovery_heading);
+        if(this->_recovery_phase == RECOVERY_SWEEP) {
+            if(turned < RECOVERY_SWEEP_ANGLE) {
+                DEBUG("Sweeping, turned " << turned);
+                this->_hal->set_wheels(-side * RECOVERY_SPEED,
+                    side * RECOVERY_SPEED);
+                return ACTION_IN_PROGRESS;
+            }
+            DEBUG("Line not found, sweeping back");
+            this->_recovery_phase = RECOVERY_SWEEP_BACK;
+        }
+
+        if(this->_recovery_phase == RECOVERY_SWEEP_BACK) {
+            if(turned > -RECOVERY_SWEEP_ANGLE) {
+                DEBUG("Sweeping back, turned " << turned);
+                this->_hal->set_wheels(side * RECOVERY_SPEED,
+                    -side * RECOVERY_SPEED);
+                return ACTION_IN_PROGRESS;
+            }
+            INFO("Line not found sweeping, spiralling out");
+            this->_recovery_phase = RECOVERY_ARC;
+            this->_recovery_distance = odometry.distance();
+        }
+
+        double driven = odometry.distance() - this->_recovery_distance;
+        if(driven > RECOVERY_MAX_DISTANCE) {
+            ERROR("Could not find the line, LOST");
+            this->_recovery_phase = RECOVERY_IDLE;
+            this->_hal->motors_stop();
+            return LOST;
+        }
+
+        DEBUG("Spiralling, driven " << driven);
+        int inner = static_cast<int>(RECOVERY_SPEED / 2 *
+            (1 + driven / RECOVERY_MAX_DISTANCE));
+        if(side > 0)
+            this->_hal->set_wheels(inner, RECOVERY_SPEED);
+        else
+            this->_hal->set_wheels(RECOVERY_SPEED, inner);
+        return ACTION_IN_PROGRESS;
+    }
+
+    /**
+     * Keep searching for the line a turn went past. If we give up, the
+     * turn is over, so the next one starts afresh rather than carrying
+     * on from this one.
+     * \returns ACTION_IN_PROGRESS while searching, or LOST if we have
+     * given up
+     */
+    LineFollowingStatus LineFollowing::recover_turn()
+    {
+        TRACE("recover_turn()");
+        LineFollowingStatus status = this->recover();
+        if(status == LOST)
+            this->end_turn();
+        return status;
+    }
+
+    /**
+     * Start a new turn.
+     * \param phase The phase to start the turn in
+     */
+    void LineFollowing::begin_turn(const LineFollowingTurnPhase phase)
+    {
+        TRACE("begin_turn(" << LineFollowingTurnPhaseStrings[phase] << ")");
+        this->_turn_phase = phase;
+        this->_turn_rotation = 0;
+        this->_turn_start_heading = this->_hal->odometry().heading();
+    }
+
+    /**
+     * Forget the state of the current turn, ready for the next one.
+     */
+    void LineFollowing::end_turn()
+    {
+        TRACE("end_turn()");
+        this->_lost_turning_line = false;
+        this->_lost_since = 0;
+        this->_lines_seen = 0;
+        this->_turn_phase = TURN_IDLE;
+    }
+
     /**
      * Set the motors to the correct steering speeds.
      * \param dir Which direction to turn in
+     * \param speed How fast to drive the moving wheels
      *
      * This will set the left and right motors either forwards,
      * backwards or stationary as appropriate to execute a turn.
      */
-    void LineFollowing::set_motors_turning(LineFollowingTurnDirection dir)
+    void LineFollowing::set_motors_turning(LineFollowingTurnDirection dir,
+            unsigned short int speed)
     {
         TRACE("set_motors_turning(" << LineFollowingTurnDirectionStrings[dir]
-            << ")");
+            << ", " << speed << ")");
 
         if(dir == TURN_LEFT) {
             DEBUG("Steering left");
-            this->_hal->motor_left_forward(0);
-            this->_hal->motor_right_forward(this->_speed);
+            this->_hal->set_wheels(0, speed);
         } else if(dir == TURN_RIGHT) {
             DEBUG("Steering right");
-            this->_hal->motor_right_forward(0);
-            this->_hal->motor_left_forward(this->_speed);
+            this->_hal->set_wheels(speed, 0);
         } else if(dir == TURN_AROUND_CW) {
             DEBUG("Steering around, clockwise");
-            this->_hal->motor_right_backward(this->_speed / 2);
-            this->_hal->motor_left_forward(this->_speed / 2);
+            this->_hal->set_wheels(speed, -speed);
         } else if(dir == TURN_AROUND_CCW) {
             DEBUG("Steering around, anticlockwise");
-            this->_hal->motor_right_forward(this->_speed / 2);
-            this->_hal->motor_left_backward(this->_speed / 2);
+            this->_hal->set_wheels(-speed, speed);
         }
     }
 
@@ -520,5 +1030,20 @@ namespace IDP {
         else
             return correction;
     }
+
+    // Documented in line_following.h
+    // Intentionally not part of the class.
+    unsigned char sensor_nibble(const LineSensors& sensors) {
+        unsigned char nibble = 0;
+        if(sensors.outer_left == LINE)
+            nibble |= SENSOR_OUTER_LEFT;
+        if(sensors.line_left == LINE)
+            nibble |= SENSOR_LINE_LEFT;
+        if(sensors.line_right == LINE)
+            nibble |= SENSOR_LINE_RIGHT;
+        if(sensors.outer_right == LINE)
+            nibble |= SENSOR_OUTER_RIGHT;
+        return nibble;
+    }
 }
 
@@ -10,9 +10,17 @@
 #ifndef LIBIDP_LINE_FOLLOWING_H
 #define LIBIDP_LINE_FOLLOWING_H
 
+#include <vector>
+
 namespace IDP {
 
     class HardwareAbstractionLayer;
+    class LinePositionEstimator;
+    class LineSensorFilter;
+    class SensorHistory;
+    class TurnRates;
+    struct LineSensors;
+    struct SensorFrame;
 
     /**
      * Maximum differential correction value before it gets capped
@@ -20,25 +28,47 @@ namespace IDP {
     const short unsigned int MAX_CORRECTION = 127;
 
     /**
-     * Baseline integral gain for full speed operation
+     * File the steering gain schedule is read from
+     */
+    const char* const LINE_FOLLOWING_GAINS_FILE = "gainsfile";
+
+    /**
+     * Time constant of the low pass filter on the error derivative, used
+     * while the line is out of sight, in seconds
+     */
+    const double DERIVATIVE_FILTER_TIME = 0.02;
+
+    /**
+     * Baseline LOST timeout for full speed straight line navigation, in
+     * microseconds
+     */
+    const unsigned int BASELINE_STRAIGHT_TIMEOUT = 250000;
+
+    /**
+     * How much longer the LOST timeout gets for each unit of speed below
+     * MOTOR_MAX_SPEED, in microseconds
      */
-    const double BASELINE_INTEGRAL_GAIN = 5.0;
+    const unsigned int TIMEOUT_PER_SPEED_STEP = 1000;
 
     /**
-     * Baseline LOST timeout for full speed straight line navigation
+     * Longest gap between frames, in microseconds, that the error
+     * integrators will count. A longer gap means line following was
+     * paused, and is counted as a single control period.
      */
-    const short unsigned int BASELINE_STRAIGHT_TIMEOUT = 50;
+    const unsigned int MAX_TICK_GAP = 100000;
 
     /**
-     * Baseline LOST timeout for full speed turning actions
+     * Steering error when only an outer sensor can see the line, in units
+     * of the error when only one inner sensor can. The line is between the
+     * two when an inner and outer sensor on the same side both see it.
      */
-    const short unsigned int BASELINE_TURN_TIMEOUT = 200;
+    const int EDGE_ERROR = 3;
 
     /**
-     * How much an outer sensor seeing the edge of a line should add
-     * to the appropriate error
+     * Steering error assumed while the line is lost, beyond whichever
+     * outer sensor saw it last
      */
-    const unsigned int EDGE_ERROR = 2;
+    const int SEARCH_ERROR = 4;
 
     /**
      * Line following return status codes.
@@ -76,15 +106,167 @@ namespace IDP {
     };
 
     /**
-     * Possible line statuses, used internally.
+     * Phases of a turn. The robot turns open loop as fast as it can until
+     * the line is expected back, slows down for the last part of the
+     * turn, then creeps round once a sensor sees the line until it is
+     * between the inner sensors.
+     */
+    enum LineFollowingTurnPhase {
+        TURN_IDLE,
+        TURN_OPEN_LOOP,
+        TURN_SLOWING,
+        TURN_CAPTURE,
+        MAX_TURN_PHASE
+    };
+
+    /**
+     * What fraction of a turn, by learned turn rate, to make at the
+     * slower speed before we expect to see the line.
+     */
+    const double TURN_SLOWDOWN_FRACTION = 0.25;
+
+    /**
+     * Wheel speed to creep round at once a sensor sees the line.
+     */
+    const unsigned short int TURN_CAPTURE_SPEED = 32;
+
+    /**
+     * How many times further than expected we may turn without seeing
+     * the line before we decide we are LOST.
+     */
+    const double TURN_LOST_FACTOR = 2.5;
+
+    /**
+     * How much further than its usual angle a turn that skips lines may
+     * have to go to reach the final line, in radians. The lines skipped
+     * are passed on the way round, so do not add a whole turn each, but
+     * the final line may be further round than usual.
+     */
+    const double TURN_SKIP_MARGIN = 0.7854;
+
+    /**
+     * Phases of the search for a line we have lost. We first spin on the
+     * spot towards the side the line was last seen, then back past where
+     * we started to look on the other side, then drive out in a widening
+     * spiral.
+     */
+    enum LineFollowingRecoveryPhase {
+        RECOVERY_IDLE,
+        RECOVERY_SWEEP,
+        RECOVERY_SWEEP_BACK,
+        RECOVERY_ARC,
+        MAX_RECOVERY_PHASE
+    };
+
+    /**
+     * Wheel speed to search for a lost line at.
+     */
+    const unsigned short int RECOVERY_SPEED = 64;
+
+    /**
+     * How far to spin either side of where we lost the line, in radians.
+     */
+    const double RECOVERY_SWEEP_ANGLE = 0.6;
+
+    /**
+     * How far to drive while spiralling out before giving up and
+     * reporting LOST, in millimetres.
+     */
+    const double RECOVERY_MAX_DISTANCE = 600.0;
+
+    /**
+     * Possible line statuses, used internally. NEAR_LINE is when only the
+     * outer sensor on the side a turn is heading towards sees a line.
      */
     enum LineFollowingLineStatus {
         ON_LINE,
         LOST_LINE,
         OTHER,
+        NEAR_LINE,
         MAX_LINE_STATUS
     };
 
+    /**
+     * Bits of a line sensor nibble, each set when that sensor sees a LINE.
+     * These match the sensor bits of port 0.
+     */
+    const unsigned char SENSOR_OUTER_LEFT = (1<<0);
+    const unsigned char SENSOR_LINE_LEFT = (1<<1);
+    const unsigned char SENSOR_LINE_RIGHT = (1<<2);
+    const unsigned char SENSOR_OUTER_RIGHT = (1<<3);
+
+    /**
+     * Number of distinct line sensor nibbles, and so entries per action
+     * table.
+     */
+    const unsigned int SENSOR_STATES = 16;
+
+    /**
+     * Steering actions for a line sensor state, used internally.
+     *
+     * STEER_STRAIGHT clears the steering errors.
+     *
+     * STEER_LEFT and STEER_RIGHT build up the left or right error and
+     * clear the other.
+     *
+     * STEER_HOLD keeps steering as before.
+     *
+     * STEER_SEARCH builds up whichever error was last seen while trying to
+     * find the line again, until the LOST timeout runs out.
+     *
+     * STEER_TURN keeps the motors turning.
+     */
+    enum LineFollowingSteering {
+        STEER_STRAIGHT,
+        STEER_LEFT,
+        STEER_RIGHT,
+        STEER_HOLD,
+        STEER_SEARCH,
+        STEER_TURN,
+        MAX_STEERING
+    };
+
+    /**
+     * What to do for one line sensor state.
+     *
+     * steering is the action to take, error the signed steering error it
+     * measures, positive when we have veered left of the line, status what
+     * to return, and line how the state looks for the current mode.
+     */
+    struct LineFollowingAction
+    {
+        LineFollowingSteering steering;
+        signed char error;
+        LineFollowingStatus status;
+        LineFollowingLineStatus line;
+    };
+
+    /**
+     * Steering controller gains for one speed.
+     *
+     * The correction is the error times proportional, plus the integral
+     * of the error over seconds times integral, plus the derivative of
+     * the error per second times derivative.
+     */
+    struct LineFollowingGains
+    {
+        unsigned short int speed;
+        double proportional;
+        double integral;
+        double derivative;
+    };
+
+    /**
+     * Action table for following a line, indexed by sensor nibble.
+     */
+    extern const LineFollowingAction FOLLOW_ACTIONS[SENSOR_STATES];
+
+    /**
+     * Action tables for each turn direction, indexed by sensor nibble.
+     */
+    extern const LineFollowingAction
+        TURN_ACTIONS[MAX_TURN_DIRECTION][SENSOR_STATES];
+
     /**
      * String representations of LineFollowingStatus
      */
@@ -109,6 +291,28 @@ namespace IDP {
         "MAX_TURN_DIRECTION"
     };
 
+    /**
+     * String representation of LineFollowingTurnPhase
+     */
+    static const char* const LineFollowingTurnPhaseStrings[] = {
+        "TURN_IDLE",
+        "TURN_OPEN_LOOP",
+        "TURN_SLOWING",
+        "TURN_CAPTURE",
+        "MAX_TURN_PHASE"
+    };
+
+    /**
+     * String representation of LineFollowingRecoveryPhase
+     */
+    static const char* const LineFollowingRecoveryPhaseStrings[] = {
+        "RECOVERY_IDLE",
+        "RECOVERY_SWEEP",
+        "RECOVERY_SWEEP_BACK",
+        "RECOVERY_ARC",
+        "MAX_RECOVERY_PHASE"
+    };
+
     /**
      * String representation of LineFollowingLineStatus
      */
@@ -116,9 +320,23 @@ namespace IDP {
         "ON_LINE",
         "LOST_LINE",
         "OTHER",
+        "NEAR_LINE",
         "MAX_LINE_STATUS"
     };
 
+    /**
+     * String representation of LineFollowingSteering
+     */
+    static const char* const LineFollowingSteeringStrings[] = {
+        "STEER_STRAIGHT",
+        "STEER_LEFT",
+        "STEER_RIGHT",
+        "STEER_HOLD",
+        "STEER_SEARCH",
+        "STEER_TURN",
+        "MAX_STEERING"
+    };
+
 
     /**
      * Cap a line following correction value to MAX_CORRECTION
@@ -127,6 +345,13 @@ namespace IDP {
      */
     unsigned short int cap_correction(const unsigned short int correction);
 
+    /**
+     * Pack the line sensors into a nibble of SENSOR_ bits
+     * \param sensors The line sensor states
+     * \returns The nibble, from 0 to SENSOR_STATES - 1
+     */
+    unsigned char sensor_nibble(const LineSensors& sensors);
+
     /**
      * Maintain the robot position correctly with respect to the white
      * line markers, during driving and manouvering
@@ -135,7 +360,9 @@ namespace IDP {
     {
         public:
             LineFollowing(HardwareAbstractionLayer* hal);
+            ~LineFollowing();
             LineFollowingStatus follow_line(void);
+            LineFollowingStatus follow_line(const SensorFrame& frame);
             LineFollowingStatus turn_left(
                     unsigned short int skip_lines = 0);
             LineFollowingStatus turn_right(
@@ -145,27 +372,58 @@ namespace IDP {
             LineFollowingStatus turn_around_ccw(
                     unsigned short int skip_lines = 0);
             LineFollowingStatus turn_around_delivery();
+            LineFollowingStatus turn(LineFollowingTurnDirection dir,
+                    const SensorFrame& frame,
+                    unsigned short int skip_lines = 0);
             LineFollowingStatus junction_status(void);
+            LineFollowingStatus junction_status(const SensorFrame& frame);
+            LineFollowingStatus passed_junction();
             void set_speed(unsigned short int speed);
+            unsigned short int speed() const;
+            bool load_gain_schedule(const char* filename);
+            void save_turn_rates();
 
         private:
-            void correct_steering(void);
-            void set_motors_turning(LineFollowingTurnDirection dir);
-            LineFollowingStatus turn(LineFollowingTurnDirection dir,
-                    unsigned short int skip_lines);
-            LineFollowingLineStatus line_status(
-                LineFollowingTurnDirection dir);
+            void update_tick(const SensorFrame& frame);
+            void observe(const SensorFrame& frame);
+            void reset_controller(void);
+            void correct_steering(const double error, const bool tracking);
+            LineFollowingStatus confirmed_junction() const;
+            void begin_recovery(const LineFollowingRecoveryPhase phase,
+                    const int side);
+            bool recovered();
+            LineFollowingStatus recover(void);
+            LineFollowingStatus recover_turn(void);
+            void begin_turn(const LineFollowingTurnPhase phase);
+            void end_turn(void);
+            void set_motors_turning(LineFollowingTurnDirection dir,
+                    unsigned short int speed);
 
             HardwareAbstractionLayer* _hal; 
-            unsigned short int _left_error;
-            unsigned short int _right_error;
+            LineSensorFilter* _filter;
+            SensorHistory* _history;
+            LinePositionEstimator* _estimator;
+            TurnRates* _turn_rates;
+            bool _turn_rates_learned;
+            double _error;
+            double _integral;
+            double _derivative;
             unsigned short int _speed;
             bool _lost_turning_line;
-            unsigned short int _lost_time;
+            unsigned long long int _lost_since;
+            unsigned long long int _last_timestamp;
+            double _tick;
             unsigned short int _lines_seen;
-            double _integral_gain;
+            LineFollowingTurnPhase _turn_phase;
+            double _turn_rotation;
+            double _turn_start_heading;
+            LineFollowingRecoveryPhase _recovery_phase;
+            int _recovery_side;
+            double _recovery_heading;
+            double _recovery_distance;
+            LineFollowingGains _gains;
+            std::vector<LineFollowingGains> _gain_schedule;
             unsigned int _lost_timeout;
-            unsigned int _turning_timeout;
     };
 }
 
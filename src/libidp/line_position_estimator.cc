@@ -0,0 +1,110 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// line_position_estimator.cc
+// Line Position Estimator class implementation
+
+#include "line_position_estimator.h"
+
+// Debug functionality
+#define MODULE_NAME "LinePosition"
+#define TRACE_ENABLED   false
+#define DEBUG_ENABLED   false
+#define INFO_ENABLED    true
+#define ERROR_ENABLED   true
+#include "debug.h"
+
+namespace IDP {
+
+    /**
+     * Start with no idea where the line is.
+     */
+    LinePositionEstimator::LinePositionEstimator(): _known(false),
+        _level(0), _edge(0), _edge_time(0), _rate(0), _offset(0)
+    {
+        TRACE("LinePositionEstimator()");
+    }
+
+    /**
+     * Forget everything, for when the line has not been watched for a
+     * while.
+     */
+    void LinePositionEstimator::reset()
+    {
+        TRACE("reset()");
+        this->_known = false;
+        this->_edge_time = 0;
+        this->_rate = this->_offset = 0;
+    }
+
+    /**
+     * Update the estimate with the level the sensors show now.
+     * \param timestamp When the sensors were sampled, in microseconds
+     * \param level The steering error the sensors show
+     */
+    void LinePositionEstimator::update(const unsigned long long int timestamp,
+        const int level)
+    {
+        TRACE("update(" << timestamp << ", " << level << ")");
+
+        if(!this->_known) {
+            this->_known = true;
+            this->_level = level;
+            this->_offset = level;
+            return;
+        }
+
+        if(level != this->_level) {
+            // The line is halfway between the levels right now
+            double edge = (this->_level + level) / 2.0;
+            if(this->_edge_time && timestamp > this->_edge_time) {
+                double elapsed = (timestamp - this->_edge_time) / 1000000.0;
+                if(edge != this->_edge) {
+                    this->_rate = (edge - this->_edge) / elapsed;
+                } else {
+                    // Crossed straight back over the same edge, so we
+                    // turned around somewhere in between. Assume we come
+                    // back as fast as we went.
+                    this->_rate = -this->_rate;
+                }
+            } else {
+                this->_rate = 0;
+            }
+            DEBUG("Crossed " << edge << " moving at " << this->_rate << "/s");
+            this->_edge = edge;
+            this->_edge_time = timestamp;
+            this->_level = level;
+        }
+
+        // Extrapolate from the last edge, but no further than the middle
+        // of the level the sensors can see, as we cannot tell how far
+        // into it the line has gone after that
+        double since = (timestamp - this->_edge_time) / 1000000.0;
+        double offset = this->_edge + this->_rate * since;
+        if(this->_edge_time && this->_edge < level && this->_rate > 0)
+            this->_offset = offset < level ? offset : level;
+        else if(this->_edge_time && this->_edge > level && this->_rate < 0)
+            this->_offset = offset > level ? offset : level;
+        else
+            this->_offset = level;
+    }
+
+    /**
+     * The estimated lateral offset of the line.
+     * \returns The offset, in the same units as the steering error
+     */
+    double LinePositionEstimator::offset() const
+    {
+        return this->_offset;
+    }
+
+    /**
+     * The estimated heading error, as the rate the offset is changing.
+     * \returns The rate, in steering error units per second
+     */
+    double LinePositionEstimator::rate() const
+    {
+        return this->_rate;
+    }
+}
+
@@ -0,0 +1,49 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// line_position_estimator.h
+// Line Position Estimator class definition
+//
+// Line Position Estimator - interpolate where the line is between the
+// coarse steps the line sensors can see
+
+#pragma once
+#ifndef LIBIDP_LINE_POSITION_ESTIMATOR_H
+#define LIBIDP_LINE_POSITION_ESTIMATOR_H
+
+namespace IDP {
+
+    /**
+     * Estimate the line's lateral offset more finely than the sensors
+     * can see it.
+     *
+     * The line sensors only show which of a few coarse levels the line
+     * is at, in the same units as the steering error. The line is known
+     * to be exactly halfway between two levels at the moment the sensors
+     * change from one to the other. Timing the last two changes gives how
+     * fast the offset is changing, which is our heading relative to the
+     * line, and the offset in between is extrapolated from the last
+     * change at that rate, as far as the middle of the level the sensors
+     * show.
+     */
+    class LinePositionEstimator
+    {
+        public:
+            LinePositionEstimator();
+            void reset();
+            void update(const unsigned long long int timestamp,
+                const int level);
+            double offset() const;
+            double rate() const;
+        private:
+            bool _known;
+            int _level;
+            double _edge;
+            unsigned long long int _edge_time;
+            double _rate;
+            double _offset;
+    };
+}
+
+#endif /* LIBIDP_LINE_POSITION_ESTIMATOR_H */
+
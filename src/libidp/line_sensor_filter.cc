@@ -0,0 +1,128 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// line_sensor_filter.cc
+// Line Sensor Filter class implementation
+
+#include "hal.h"
+#include "line_following.h"
+#include "line_sensor_filter.h"
+
+// Debug functionality
+#define MODULE_NAME "LineFilter"
+#define TRACE_ENABLED   false
+#define DEBUG_ENABLED   false
+#define INFO_ENABLED    true
+#define ERROR_ENABLED   true
+#include "debug.h"
+
+namespace IDP {
+
+    /**
+     * Construct a filter with no history, confirming junctions at full
+     * speed.
+     */
+    LineSensorFilter::LineSensorFilter(): _nibble(0), _primed(false),
+        _last_timestamp(0), _confirm_frames(JUNCTION_CONFIRM_FRAMES),
+        _junction_frames(0), _junction_turns(0)
+    {
+        TRACE("LineSensorFilter()");
+        this->_history[0] = this->_history[1] = this->_history[2] = 0;
+    }
+
+    /**
+     * Scale the number of frames needed to confirm a junction to the
+     * speed we are driving at.
+     * \param speed The line following speed, 0 to MOTOR_MAX_SPEED
+     */
+    void LineSensorFilter::set_speed(const unsigned short int speed)
+    {
+        TRACE("set_speed(" << speed << ")");
+
+        unsigned int frames = MAX_JUNCTION_CONFIRM_FRAMES;
+        if(speed)
+            frames = (JUNCTION_CONFIRM_FRAMES * MOTOR_MAX_SPEED + speed - 1)
+                / speed;
+        if(frames > MAX_JUNCTION_CONFIRM_FRAMES)
+            frames = MAX_JUNCTION_CONFIRM_FRAMES;
+
+        DEBUG("Confirming junctions over " << frames << " frames");
+        this->_confirm_frames = frames;
+    }
+
+    /**
+     * Add a frame to the filter, unless it has already been added.
+     * \param frame The SensorFrame for this control tick
+     * \returns true if the frame was new
+     */
+    bool LineSensorFilter::update(const SensorFrame& frame)
+    {
+        TRACE("update(frame)");
+
+        if(this->_primed && frame.timestamp == this->_last_timestamp)
+            return false;
+
+        unsigned char raw = sensor_nibble(frame.line_sensors);
+        if(!this->_primed) {
+            // Nothing to vote against yet, so trust the first frame
+            this->_history[0] = this->_history[1] = raw;
+            this->_primed = true;
+        }
+        this->_last_timestamp = frame.timestamp;
+
+        // Majority vote on each bit over the last three frames
+        this->_history[2] = this->_history[1];
+        this->_history[1] = this->_history[0];
+        this->_history[0] = raw;
+        const unsigned char* h = this->_history;
+        this->_nibble = (h[0] & h[1]) | (h[0] & h[2]) | (h[1] & h[2]);
+
+        if(this->_nibble != raw) {
+            DEBUG("Debounced sensors " << static_cast<int>(raw) << " to " <<
+                static_cast<int>(this->_nibble));
+        }
+
+        // Count how long we have been looking at a junction for
+        const unsigned char inner = SENSOR_LINE_LEFT | SENSOR_LINE_RIGHT;
+        const unsigned char outer = SENSOR_OUTER_LEFT | SENSOR_OUTER_RIGHT;
+        if((this->_nibble & inner) == inner && (this->_nibble & outer)) {
+            this->_junction_frames++;
+            this->_junction_turns |= this->_nibble & outer;
+        } else {
+            this->_junction_frames = 0;
+            this->_junction_turns = 0;
+        }
+        return true;
+    }
+
+    /**
+     * The debounced line sensors.
+     * \returns A nibble of SENSOR_ bits
+     */
+    unsigned char LineSensorFilter::nibble() const
+    {
+        return this->_nibble;
+    }
+
+    /**
+     * The turns at a confirmed junction.
+     * \returns SENSOR_OUTER_LEFT and/or SENSOR_OUTER_RIGHT for each turn
+     * found, or 0 if no junction has been confirmed
+     */
+    unsigned char LineSensorFilter::junction() const
+    {
+        if(this->_junction_frames < this->_confirm_frames)
+            return 0;
+        return this->_junction_turns;
+    }
+
+    /**
+     * How many frames it takes to confirm a junction at this speed.
+     * \returns The number of frames
+     */
+    unsigned int LineSensorFilter::confirm_frames() const
+    {
+        return this->_confirm_frames;
+    }
+}
+
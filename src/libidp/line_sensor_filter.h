@@ -0,0 +1,66 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// line_sensor_filter.h
+// Line Sensor Filter class definition
+//
+// Line Sensor Filter - debounce the line sensors and confirm junctions
+// over several frames
+
+#pragma once
+#ifndef LIBIDP_LINE_SENSOR_FILTER_H
+#define LIBIDP_LINE_SENSOR_FILTER_H
+
+namespace IDP {
+
+    struct SensorFrame;
+
+    /**
+     * How many consecutive frames must show a junction before it is
+     * confirmed, at MOTOR_MAX_SPEED. Slower robots spend longer over
+     * each junction, so need proportionally more.
+     */
+    const unsigned int JUNCTION_CONFIRM_FRAMES = 3;
+
+    /**
+     * Most frames ever needed to confirm a junction, however slowly we
+     * are going.
+     */
+    const unsigned int MAX_JUNCTION_CONFIRM_FRAMES = 12;
+
+    /**
+     * Filter the line sensors over successive frames.
+     *
+     * Each sensor bit is debounced by taking the majority of the last
+     * three frames, so a single noisy frame never changes the result. A
+     * junction is then only confirmed once enough consecutive debounced
+     * frames show both inner sensors on the line and an outer sensor
+     * seeing a turn. The confirmed turns are every outer sensor seen
+     * during that run, so a junction crossed at an angle still shows
+     * both turns.
+     *
+     * update() may be called more than once with the same frame, and
+     * only counts it once.
+     */
+    class LineSensorFilter
+    {
+        public:
+            LineSensorFilter();
+            void set_speed(const unsigned short int speed);
+            bool update(const SensorFrame& frame);
+            unsigned char nibble() const;
+            unsigned char junction() const;
+            unsigned int confirm_frames() const;
+        private:
+            unsigned char _history[3];
+            unsigned char _nibble;
+            bool _primed;
+            unsigned long long int _last_timestamp;
+            unsigned int _confirm_frames;
+            unsigned int _junction_frames;
+            unsigned char _junction_turns;
+    };
+}
+
+#endif /* LIBIDP_LINE_SENSOR_FILTER_H */
+
@@ -0,0 +1,89 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// link_log.cc
+// Link recorder class implementation
+
+#include "link_log.h"
+
+#include <time.h>
+
+// Debug functionality
+#define MODULE_NAME "LinkLog"
+#define TRACE_ENABLED   false
+#define DEBUG_ENABLED   false
+#define INFO_ENABLED    true
+#define ERROR_ENABLED   true
+#include "debug.h"
+
+namespace IDP {
+
+    /**
+     * Open a new log file, replacing any existing one.
+     * \param filename The file to record to
+     */
+    LinkRecorder::LinkRecorder(const char* filename):
+        _file(filename, std::ios::out | std::ios::binary | std::ios::trunc),
+        _used(0)
+    {
+        TRACE("LinkRecorder(" << filename << ")");
+        if(this->_file.is_open()) {
+            INFO("Recording link to " << filename);
+        } else {
+            ERROR("Could not open " << filename << " for recording");
+        }
+    }
+
+    /**
+     * Write out anything still buffered.
+     */
+    LinkRecorder::~LinkRecorder()
+    {
+        TRACE("~LinkRecorder()");
+        this->flush();
+    }
+
+    /**
+     * Append one exchange to the log.
+     * \param kind Whether this was a command or a request
+     * \param opcode The opcode
+     * \param argument The command argument, or 0 for a request
+     * \param response The request's response, or whether the command was
+     * sent
+     */
+    void LinkRecorder::record(const LinkLogKind kind, const int opcode,
+        const int argument, const int response)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        LinkLogRecord& r = this->_buffer[this->_used++];
+        r.kind = static_cast<unsigned char>(kind);
+        r.opcode = static_cast<unsigned char>(opcode);
+        r.argument = static_cast<unsigned char>(argument);
+        r.padding = 0;
+        r.response = response;
+        r.timestamp = static_cast<unsigned long long int>(now.tv_sec)
+            * 1000000000ULL + static_cast<unsigned long long int>(now.tv_nsec);
+
+        if(this->_used == LINK_LOG_BUFFER_SIZE)
+            this->flush();
+    }
+
+    /**
+     * Write the buffered records to the file.
+     */
+    void LinkRecorder::flush()
+    {
+        TRACE("flush()");
+        if(!this->_used)
+            return;
+
+        DEBUG("Writing " << this->_used << " records");
+        this->_file.write(reinterpret_cast<const char*>(this->_buffer),
+            this->_used * sizeof(LinkLogRecord));
+        this->_file.flush();
+        this->_used = 0;
+    }
+}
+
@@ -0,0 +1,81 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// link_log.h
+// Link log record and recorder definitions
+//
+// Link Log - record every exchange with the robot to a compact binary log,
+// which the replay backend can play back
+
+#pragma once
+#ifndef LIBIDP_LINK_LOG_H
+#define LIBIDP_LINK_LOG_H
+
+#include <fstream>
+
+namespace IDP {
+
+    /**
+     * The file link sessions are recorded to and replayed from.
+     */
+    const char* const LINK_LOG_FILE = "linklog";
+
+    /**
+     * The file a replayed session is recorded to, for comparison with the
+     * original.
+     */
+    const char* const LINK_LOG_REPLAY_FILE = "linklog.replay";
+
+    /**
+     * How many records the recorder buffers before writing them out.
+     */
+    const unsigned int LINK_LOG_BUFFER_SIZE = 4096;
+
+    /**
+     * What kind of exchange a LinkLogRecord holds.
+     */
+    enum LinkLogKind {
+        LINK_LOG_COMMAND,
+        LINK_LOG_REQUEST
+    };
+
+    /**
+     * One exchange with the robot. The log file is a plain array of these
+     * in the order they happened, written in the host's byte order.
+     * Commands record a response of 1 if sent and 0 if not; the timestamp
+     * is in nanoseconds on the monotonic clock.
+     */
+    struct LinkLogRecord
+    {
+        unsigned char kind;
+        unsigned char opcode;
+        unsigned char argument;
+        unsigned char padding;
+        int response;
+        unsigned long long int timestamp;
+    };
+
+    /**
+     * Append link exchanges to a log file.
+     *
+     * Records go into a preallocated buffer which is written out only
+     * when it fills or is flushed, so recording costs no allocation or
+     * file write per exchange.
+     */
+    class LinkRecorder
+    {
+        public:
+            LinkRecorder(const char* filename);
+            ~LinkRecorder();
+            void record(const LinkLogKind kind, const int opcode,
+                const int argument, const int response);
+            void flush();
+        private:
+            std::ofstream _file;
+            LinkLogRecord _buffer[LINK_LOG_BUFFER_SIZE];
+            unsigned int _used;
+    };
+}
+
+#endif /* LIBIDP_LINK_LOG_H */
+
@@ -0,0 +1,154 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// link_stats.cc
+// Link Statistics class implementation
+
+#include "link_stats.h"
+
+#include <cstring>
+#include <sstream>
+
+// Debug functionality
+#define MODULE_NAME "LinkStats"
+#define TRACE_ENABLED   false
+#define DEBUG_ENABLED   false
+#define INFO_ENABLED    true
+#define ERROR_ENABLED   true
+#include "debug.h"
+
+namespace IDP {
+
+    /**
+     * Start with every histogram empty.
+     */
+    LinkStats::LinkStats(): _send_errs(0), _recv_errs(0), _cmd_errs(0)
+    {
+        TRACE("LinkStats()");
+        std::memset(this->_histogram, 0, sizeof(this->_histogram));
+        std::memset(this->_count, 0, sizeof(this->_count));
+        std::memset(this->_total_us, 0, sizeof(this->_total_us));
+    }
+
+    /**
+     * Record how long one exchange took.
+     * \param opcode The command or request opcode
+     * \param latency_us How long the exchange took, in microseconds
+     */
+    void LinkStats::record(const int opcode,
+        const unsigned long long int latency_us)
+    {
+        unsigned int op = static_cast<unsigned int>(opcode) & 0xFF;
+        __sync_fetch_and_add(
+            &this->_histogram[op][LinkStats::bucket(latency_us)], 1);
+        __sync_fetch_and_add(&this->_count[op], 1);
+        __sync_fetch_and_add(&this->_total_us[op],
+            static_cast<unsigned int>(latency_us));
+    }
+
+    /**
+     * Store the latest robot_link error counters.
+     * \param send_errs robot_link::send_errs
+     * \param recv_errs robot_link::recv_errs
+     * \param cmd_errs robot_link::cmd_errs
+     */
+    void LinkStats::update_errors(const int send_errs, const int recv_errs,
+        const int cmd_errs)
+    {
+        this->_send_errs = send_errs;
+        this->_recv_errs = recv_errs;
+        this->_cmd_errs = cmd_errs;
+    }
+
+    /**
+     * How many exchanges of an opcode have been recorded.
+     * \param opcode The opcode
+     * \returns The number of exchanges
+     */
+    unsigned int LinkStats::count(const int opcode) const
+    {
+        return this->_count[static_cast<unsigned int>(opcode) & 0xFF];
+    }
+
+    /**
+     * How many exchanges of an opcode fell in a latency bucket.
+     * \param opcode The opcode
+     * \param bucket The bucket, 0 to LINK_STATS_BUCKETS - 1
+     * \returns The number of exchanges in that bucket
+     */
+    unsigned int LinkStats::count(const int opcode,
+        const unsigned int bucket) const
+    {
+        if(bucket >= LINK_STATS_BUCKETS)
+            return 0;
+        return this->_histogram[static_cast<unsigned int>(opcode) & 0xFF]
+            [bucket];
+    }
+
+    /**
+     * Total time spent on an opcode.
+     * \param opcode The opcode
+     * \returns The summed latency in microseconds
+     */
+    unsigned int LinkStats::total_us(const int opcode) const
+    {
+        return this->_total_us[static_cast<unsigned int>(opcode) & 0xFF];
+    }
+
+    /**
+     * The most recently stored link error counters.
+     * \returns A LinkErrors
+     */
+    LinkErrors LinkStats::errors() const
+    {
+        LinkErrors errors;
+        errors.send_errs = this->_send_errs;
+        errors.recv_errs = this->_recv_errs;
+        errors.cmd_errs = this->_cmd_errs;
+        return errors;
+    }
+
+    /**
+     * Print the error counters, then the count, mean latency and
+     * histogram of every opcode seen.
+     */
+    void LinkStats::dump() const
+    {
+        TRACE("dump()");
+        INFO("Link errors: send=" << this->_send_errs << " recv=" <<
+            this->_recv_errs << " cmd=" << this->_cmd_errs);
+
+        for(unsigned int op = 0; op < LINK_STATS_OPCODES; op++) {
+            unsigned int n = this->_count[op];
+            if(!n)
+                continue;
+
+            // Histogram as "bucket_floor_us:count" for non-empty buckets
+            std::ostringstream histogram;
+            for(unsigned int b = 0; b < LINK_STATS_BUCKETS; b++) {
+                if(this->_histogram[op][b])
+                    histogram << " " << (1u << b) << ":" <<
+                        this->_histogram[op][b];
+            }
+
+            INFO("Opcode " << op << ": n=" << n << " mean=" <<
+                this->_total_us[op] / n << "us" << histogram.str());
+        }
+    }
+
+    /**
+     * Find the histogram bucket for a latency.
+     * \param latency_us The latency in microseconds
+     * \returns The bucket index
+     */
+    unsigned int LinkStats::bucket(unsigned long long int latency_us)
+    {
+        unsigned int b = 0;
+        while(latency_us > 1 && b < LINK_STATS_BUCKETS - 1) {
+            latency_us >>= 1;
+            b++;
+        }
+        return b;
+    }
+}
+
@@ -0,0 +1,71 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// link_stats.h
+// Link Statistics class definition
+//
+// Link Statistics - per-opcode latency histograms and error counts for the
+// link to the robot
+
+#pragma once
+#ifndef LIBIDP_LINK_STATS_H
+#define LIBIDP_LINK_STATS_H
+
+namespace IDP {
+
+    /**
+     * Number of opcodes tracked, one per possible opcode byte.
+     */
+    const unsigned int LINK_STATS_OPCODES = 256;
+
+    /**
+     * Number of latency buckets per opcode. Bucket n counts latencies
+     * from 2^n up to 2^(n+1) microseconds, except that the first bucket
+     * also counts anything under 1us and the last counts everything
+     * longer.
+     */
+    const unsigned int LINK_STATS_BUCKETS = 16;
+
+    /**
+     * Snapshot of the robot_link error counters.
+     */
+    struct LinkErrors
+    {
+        int send_errs;
+        int recv_errs;
+        int cmd_errs;
+    };
+
+    /**
+     * Collect latency histograms for each link opcode.
+     *
+     * record() only uses atomic increments, so it may be called from the
+     * control thread and the link I/O thread at once without locking.
+     */
+    class LinkStats
+    {
+        public:
+            LinkStats();
+            void record(const int opcode,
+                const unsigned long long int latency_us);
+            void update_errors(const int send_errs, const int recv_errs,
+                const int cmd_errs);
+            unsigned int count(const int opcode) const;
+            unsigned int count(const int opcode,
+                const unsigned int bucket) const;
+            unsigned int total_us(const int opcode) const;
+            LinkErrors errors() const;
+            void dump() const;
+        private:
+            static unsigned int bucket(unsigned long long int latency_us);
+            unsigned int _histogram[LINK_STATS_OPCODES][LINK_STATS_BUCKETS];
+            unsigned int _count[LINK_STATS_OPCODES];
+            unsigned int _total_us[LINK_STATS_OPCODES];
+            volatile int _send_errs;
+            volatile int _recv_errs;
+            volatile int _cmd_errs;
+    };
+}
+
+#endif /* LIBIDP_LINK_STATS_H */
+
@@ -0,0 +1,419 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// localiser.cc
+// Localiser class implementation
+
+#include <cmath>
+
+#include "localiser.h"
+#include "navigation_graph.h"
+#include "odometry.h"
+
+// Debug functionality
+#define MODULE_NAME "Localiser"
+#define TRACE_ENABLED   false
+#define DEBUG_ENABLED   true
+#define INFO_ENABLED    true
+#define ERROR_ENABLED   true
+#include "debug.h"
+
+namespace IDP {
+
+    /**
+     * What LineFollowing should see at each NavigationTurn. Lines going
+     * straight on do not show up, so the end of a line looks like no
+     * junction at all.
+     */
+    static const NavigationCachedJunction EXPECTED_JUNCTIONS[MAX_TURNS] = {
+        NO_TURNS,   // STRAIGHT
+        LEFT_TURN,  // LEFT
+        RIGHT_TURN, // RIGHT
+        BOTH_TURNS, // BOTH
+        LEFT_TURN,  // LEFT_AND_STRAIGHT
+        RIGHT_TURN, // RIGHT_AND_STRAIGHT
+        BOTH_TURNS, // BOTH_AND_STRAIGHT
+        NO_TURNS    // END_OF_LINE
+    };
+
+    /**
+     * How likely the junction in each row is to be seen where the graph
+     * has the one in each column. Missing one side of a junction is much
+     * more likely than seeing a line that is not there.
+     */
+    static const double JUNCTION_LIKELIHOOD[NO_TURNS + 1][NO_TURNS + 1] = {
+        // NO_CACHE LEFT_TURN RIGHT_TURN BOTH_TURNS NO_TURNS expected
+        {0.0,       0.0,      0.0,       0.0,       0.0 }, // NO_CACHE
+        {0.0,       0.8,      0.02,      0.15,      0.05}, // LEFT_TURN
+        {0.0,       0.02,     0.8,       0.15,      0.05}, // RIGHT_TURN
+        {0.0,       0.1,      0.1,       0.7,       0.05}, // BOTH_TURNS
+        {0.0,       0.0,      0.0,       0.0,       0.0 }  // NO_TURNS
+    };
+
+    /**
+     * How likely each junction is to be seen where there is no node.
+     */
+    static const double FALSE_JUNCTION_LIKELIHOOD = 1.0 / 3;
+
+    /**
+     * Start out sure of nothing; Navigation resets us to where it starts.
+     * \param graph The NavigationGraph to localise on
+     * \param odometry The Odometry to measure distances with
+     */
+    Localiser::Localiser(const NavigationGraph* graph,
+        const Odometry* odometry): _graph(graph), _odometry(odometry),
+        _mark(0), _observed(false)
+    {
+        TRACE("Localiser(" << graph << ", " << odometry << ")");
+        this->reset(MAX_NODE, MAX_NODE);
+    }
+
+    /**
+     * Take the robot to be at the start of an edge, as when it has just
+     * been put somewhere known. Passing an edge that is not in the graph
+     * spreads the belief evenly over every edge.
+     * \param from The node behind the robot
+     * \param to The node in front of the robot
+     */
+    void Localiser::reset(const NavigationNode from, const NavigationNode to)
+    {
+        TRACE("reset(" << NavigationNodeStrings[from] << ", " <<
+            NavigationNodeStrings[to] << ")");
+
+        bool known = from != MAX_NODE && to != MAX_NODE &&
+            this->_graph->edge(from, to).present;
+
+        int edges = 0;
+        for(int f = 0; f < MAX_NODE; f++)
+            for(int t = 0; t < MAX_NODE; t++)
+                if(this->_graph->edge(static_cast<NavigationNode>(f),
+                    static_cast<NavigationNode>(t)).present)
+                    edges++;
+
+        double rest = 1.0 / edges;
+        if(known && edges > 1)
+            rest = (1.0 - LOCALISER_RESET_CONFIDENCE) / (edges - 1);
+
+        for(int f = 0; f < MAX_NODE; f++) {
+            for(int t = 0; t < MAX_NODE; t++) {
+                this->_belief[f][t] = 0;
+                this->_offset[f][t] = -1;
+                this->_arrived[f][t] = this->_false[f][t] = 0;
+                if(!this->_graph->edge(static_cast<NavigationNode>(f),
+                    static_cast<NavigationNode>(t)).present)
+                    continue;
+                this->_belief[f][t] = rest;
+            }
+        }
+
+        if(known) {
+            this->_belief[from][to] = edges > 1 ?
+                LOCALISER_RESET_CONFIDENCE : 1.0;
+            this->_offset[from][to] = 0;
+        }
+
+        this->_mark = this->_odometry->total();
+        this->_observed = false;
+    }
+
+    /**
+     * Weigh a junction LineFollowing has just confirmed. This may be
+     * called again for the same junction before move(), and replaces
+     * what was worked out before.
+     * \param junction The junction seen
+     */
+    void Localiser::observe(const NavigationCachedJunction junction)
+    {
+        TRACE("observe(" << NavigationCachedJunctionStrings[junction] <<
+            ")");
+
+        double driven = this->_odometry->total() - this->_mark;
+        double total = 0;
+
+        for(int f = 0; f < MAX_NODE; f++)
+            for(int t = 0; t < MAX_NODE; t++)
+                this->_arrived[f][t] = this->_false[f][t] = 0;
+
+        for(int f = 0; f < MAX_NODE; f++) {
+            for(int t = 0; t < MAX_NODE; t++) {
+                double belief = this->_belief[f][t];
+                if(belief <= 0)
+                    continue;
+
+                const NavigationNode from = static_cast<NavigationNode>(f);
+                const NavigationNode to = static_cast<NavigationNode>(t);
+                const NavigationEdge& e = this->_graph->edge(from, to);
+                double travelled = -1;
+                if(this->_offset[f][t] >= 0)
+                    travelled = this->_offset[f][t] + driven;
+
+                // The node at the end of this edge
+                double weight = belief * (1 - LOCALISER_FALSE_JUNCTION -
+                    LOCALISER_MISSED_JUNCTION) * JUNCTION_LIKELIHOOD[
+                    junction][this->expected_junction(from, to)] *
+                    this->distance_likelihood(e.length, travelled);
+                this->_arrived[f][t] += weight;
+                total += weight;
+
+                // The node after that, having gone straight over the
+                // node at the end of this edge without seeing it
+                NavigationNode next = e.exits[STRAIGHT];
+                if(next != MAX_NODE) {
+                    const NavigationEdge& n = this->_graph->edge(to, next);
+                    weight = belief * LOCALISER_MISSED_JUNCTION *
+                        JUNCTION_LIKELIHOOD[junction][this->expected_junction(
+                        to, next)] * this->distance_likelihood(
+                        e.length + n.length, travelled);
+                    this->_arrived[t][next] += weight;
+                    total += weight;
+                }
+
+                // Not a node at all, so still on this edge
+                weight = belief * LOCALISER_FALSE_JUNCTION *
+                    FALSE_JUNCTION_LIKELIHOOD;
+                if(travelled < 0)
+                    weight *= LOCALISER_UNKNOWN_DISTANCE;
+                else if(travelled > e.length)
+                    weight *= LOCALISER_DISTANCE_FLOOR;
+                this->_false[f][t] += weight;
+                total += weight;
+            }
+        }
+
+        if(total <= 0) {
+            ERROR("Nowhere could have seen " <<
+                NavigationCachedJunctionStrings[junction] <<
+                ", ignoring it");
+            this->_observed = false;
+            return;
+        }
+
+        for(int f = 0; f < MAX_NODE; f++) {
+            for(int t = 0; t < MAX_NODE; t++) {
+                this->_arrived[f][t] /= total;
+                this->_false[f][t] /= total;
+            }
+        }
+        this->_observed = true;
+
+        NavigationNode from, to;
+        bool false_junction;
+        this->best(from, to, false_junction);
+        DEBUG("Saw " << NavigationCachedJunctionStrings[junction] <<
+            " after " << driven << "mm, most likely " <<
+            (false_junction ? "a false junction between " : "arriving at ") <<
+            NavigationNodeStrings[to] << " from " <<
+            NavigationNodeStrings[from]);
+    }
+
+    /**
+     * Move the belief on by a step Navigation has just taken. For every
+     * step but STEP_TURN_AROUND that is at the junction last observed, or
+     * at the node ahead if none has been since the last move.
+     * \param step The step taken
+     */
+    void Localiser::move(const NavigationStep& step)
+    {
+        TRACE("move(" << NavigationActionStrings[step.action] << ")");
+
+        double driven = this->_odometry->total() - this->_mark;
+        this->_mark = this->_odometry->total();
+
+        double belief[MAX_NODE][MAX_NODE];
+        double offset[MAX_NODE][MAX_NODE];
+        for(int f = 0; f < MAX_NODE; f++) {
+            for(int t = 0; t < MAX_NODE; t++) {
+                belief[f][t] = 0;
+                offset[f][t] = -1;
+                if(!this->_observed) {
+                    this->_arrived[f][t] = this->_belief[f][t];
+                    this->_false[f][t] = 0;
+                }
+            }
+        }
+
+        for(int f = 0; f < MAX_NODE; f++) {
+            for(int t = 0; t < MAX_NODE; t++) {
+                const NavigationNode from = static_cast<NavigationNode>(f);
+                const NavigationNode to = static_cast<NavigationNode>(t);
+                const NavigationEdge& e = this->_graph->edge(from, to);
+
+                if(step.action == STEP_TURN_AROUND) {
+                    // Turned around part way along the edge, which puts
+                    // us back along it by however far we had come
+                    if(this->_belief[f][t] <= 0)
+                        continue;
+                    double travelled = -1;
+                    if(this->_offset[f][t] >= 0)
+                        travelled = this->_offset[f][t] + driven;
+                    NavigationNode new_from = to;
+                    NavigationNode new_to = from;
+                    if(e.turn_around != TURN_AROUND_NEVER) {
+                        new_from = e.turn_around_from;
+                        new_to = e.turn_around_to;
+                    }
+                    if(!this->_graph->edge(new_from, new_to).present)
+                        continue;
+                    double left = -1;
+                    if(travelled >= 0 && new_from == to && new_to == from)
+                        left = e.length > travelled ?
+                            e.length - travelled : 0;
+                    this->add(belief, offset, new_from, new_to,
+                        this->_belief[f][t], left);
+                    continue;
+                }
+
+                // Did the same at the node ahead
+                if(this->_arrived[f][t] > 0) {
+                    if(step.action == STEP_JUNCTION) {
+                        if(step.turn < MAX_EXIT &&
+                            e.exits[step.turn] != MAX_NODE)
+                            this->add(belief, offset, to, e.exits[step.turn],
+                                this->_arrived[f][t], 0);
+                    } else if(step.action == STEP_ARRIVE) {
+                        const NavigationStep& arrive = this->_graph->route(
+                            from, to, to);
+                        if(arrive.action == STEP_ARRIVE)
+                            this->add(belief, offset, arrive.from, arrive.to,
+                                this->_arrived[f][t], 0);
+                    } else if(step.action == STEP_TURN_AROUND_AT_NODE) {
+                        if(e.turn_around != TURN_AROUND_NEVER)
+                            this->add(belief, offset, e.turn_around_from,
+                                e.turn_around_to, this->_arrived[f][t],
+                                e.turn_around_from == to ? 0 : -1);
+                    }
+                }
+
+                // Carried on along the edge over a false junction, and
+                // anything else turned off the lines we know of
+                if(this->_false[f][t] > 0 && step.action == STEP_JUNCTION &&
+                    step.turn == STRAIGHT)
+                {
+                    double travelled = -1;
+                    if(this->_offset[f][t] >= 0)
+                        travelled = this->_offset[f][t] + driven;
+                    this->add(belief, offset, from, to, this->_false[f][t],
+                        travelled);
+                }
+            }
+        }
+
+        double total = 0;
+        int edges = 0;
+        for(int f = 0; f < MAX_NODE; f++) {
+            for(int t = 0; t < MAX_NODE; t++) {
+                total += belief[f][t];
+                if(this->_graph->edge(static_cast<NavigationNode>(f),
+                    static_cast<NavigationNode>(t)).present)
+                    edges++;
+            }
+        }
+
+        if(total <= 0) {
+            ERROR("Nowhere could have taken that step, trusting it");
+            this->reset(step.from, step.to);
+            return;
+        }
+
+        for(int f = 0; f < MAX_NODE; f++) {
+            for(int t = 0; t < MAX_NODE; t++) {
+                this->_belief[f][t] = belief[f][t] / total *
+                    (1 - LOCALISER_DRIFT);
+                if(this->_graph->edge(static_cast<NavigationNode>(f),
+                    static_cast<NavigationNode>(t)).present)
+                    this->_belief[f][t] += LOCALISER_DRIFT / edges;
+                this->_offset[f][t] = offset[f][t];
+                this->_arrived[f][t] = this->_false[f][t] = 0;
+            }
+        }
+        this->_observed = false;
+    }
+
+    /**
+     * Find the most likely place for the robot. After observe() this is
+     * where the junction seen most likely is, and before it, the edge the
+     * robot is most likely on.
+     * \param from Set to the node behind the robot
+     * \param to Set to the node in front of the robot
+     * \param false_junction Set to whether the junction seen is most
+     * likely not a node at all, with the robot still part way along the
+     * edge
+     */
+    void Localiser::best(NavigationNode& from, NavigationNode& to,
+        bool& false_junction) const
+    {
+        from = to = MAX_NODE;
+        false_junction = false;
+        double most = 0;
+        for(int f = 0; f < MAX_NODE; f++) {
+            for(int t = 0; t < MAX_NODE; t++) {
+                double arrived = this->_observed ?
+                    this->_arrived[f][t] : this->_belief[f][t];
+                if(arrived > most) {
+                    most = arrived;
+                    from = static_cast<NavigationNode>(f);
+                    to = static_cast<NavigationNode>(t);
+                    false_junction = false;
+                }
+                if(this->_observed && this->_false[f][t] > most) {
+                    most = this->_false[f][t];
+                    from = static_cast<NavigationNode>(f);
+                    to = static_cast<NavigationNode>(t);
+                    false_junction = true;
+                }
+            }
+        }
+    }
+
+    /**
+     * What LineFollowing should see on reaching a node.
+     * \param from The node behind the robot
+     * \param to The node in front of the robot
+     * \returns The junction, or NO_TURNS where it should see nothing
+     */
+    NavigationCachedJunction Localiser::expected_junction(
+        const NavigationNode from, const NavigationNode to) const
+    {
+        return EXPECTED_JUNCTIONS[this->_graph->edge(from, to).junction];
+    }
+
+    /**
+     * How likely a distance driven along an edge is to have reached its
+     * end.
+     * \param length The length of the edge in millimetres
+     * \param travelled How far we have driven along it, or negative if
+     * not known
+     * \returns A likelihood, 1 where the distance is exactly right
+     */
+    double Localiser::distance_likelihood(const unsigned int length,
+        const double travelled) const
+    {
+        if(travelled < 0)
+            return LOCALISER_UNKNOWN_DISTANCE;
+        double error = LOCALISER_DISTANCE_ERROR +
+            LOCALISER_DISTANCE_ERROR_FRACTION * length;
+        double z = (travelled - length) / error;
+        return LOCALISER_DISTANCE_FLOOR + std::exp(-z * z / 2);
+    }
+
+    /**
+     * Add to the belief in an edge. The distance along it kept is that
+     * of whichever addition outweighs everything added before it.
+     * \param belief The belief to add to
+     * \param offset The distances along each edge
+     * \param from The node behind the robot
+     * \param to The node in front of the robot
+     * \param weight How much belief to add
+     * \param distance How far along the edge, or negative if not known
+     */
+    void Localiser::add(double belief[MAX_NODE][MAX_NODE],
+        double offset[MAX_NODE][MAX_NODE], const NavigationNode from,
+        const NavigationNode to, const double weight,
+        const double distance) const
+    {
+        if(weight > belief[from][to])
+            offset[from][to] = distance;
+        belief[from][to] += weight;
+    }
+}
+
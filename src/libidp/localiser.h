@@ -0,0 +1,120 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// localiser.h
+// Localiser class definition
+//
+// Localiser - keep track of how likely the robot is to be on each edge
+// of the node graph, from the junctions it sees and how far it drives
+
+#pragma once
+#ifndef LIBIDP_LOCALISER_H
+#define LIBIDP_LOCALISER_H
+
+#include "navigation.h"
+
+namespace IDP {
+
+    class NavigationGraph;
+    class Odometry;
+    struct NavigationStep;
+
+    /**
+     * Chance that a junction LineFollowing confirms is not really there,
+     * such as a mark on the table.
+     */
+    const double LOCALISER_FALSE_JUNCTION = 0.05;
+
+    /**
+     * Chance of driving over a node without LineFollowing confirming it.
+     */
+    const double LOCALISER_MISSED_JUNCTION = 0.05;
+
+    /**
+     * Error in the odometry distance to a node, in millimetres, plus
+     * LOCALISER_DISTANCE_ERROR_FRACTION of the length of the edge.
+     */
+    const double LOCALISER_DISTANCE_ERROR = 60.0;
+
+    /**
+     * Error in the odometry distance to a node as a fraction of the
+     * length of the edge, on top of LOCALISER_DISTANCE_ERROR.
+     */
+    const double LOCALISER_DISTANCE_ERROR_FRACTION = 0.15;
+
+    /**
+     * Least likelihood given to any distance, however far out, so that
+     * odometry alone cannot rule out where we are.
+     */
+    const double LOCALISER_DISTANCE_FLOOR = 0.02;
+
+    /**
+     * Likelihood given to the distance driven along an edge where we do
+     * not know how far along it we started, which is about what a
+     * distance picked at random would get.
+     */
+    const double LOCALISER_UNKNOWN_DISTANCE = 0.2;
+
+    /**
+     * How sure we are of where we are told the robot is.
+     */
+    const double LOCALISER_RESET_CONFIDENCE = 0.95;
+
+    /**
+     * Share of the belief spread over every edge after each move, so
+     * that no position is ever ruled out for good.
+     */
+    const double LOCALISER_DRIFT = 0.01;
+
+    /**
+     * A discrete Bayes filter over the edges of the node graph.
+     *
+     * The belief is how likely the robot is to be on each edge, along
+     * with how far along it the robot most likely is. Each junction
+     * LineFollowing confirms is weighed, for every edge, as the node at
+     * its end, as the node after that with the one at its end missed,
+     * and as not being a node at all. Each is scored by how well the
+     * junction seen matches the one the graph has there and how well the
+     * odometry distance matches the length of the edge. Navigation then
+     * moves the belief by the step it takes, applying the same turn on
+     * every edge.
+     *
+     * Navigation should call observe() when it sees a junction that is
+     * not the one the map has ahead, move() once it has dealt with any
+     * junction or turned around, and reset() whenever it knows where it
+     * is by other means. A junction that does match the map is taken to
+     * be the node ahead without observe(), as the odometry distance alone
+     * is not trusted to say otherwise.
+     */
+    class Localiser
+    {
+        public:
+            Localiser(const NavigationGraph* graph,
+                const Odometry* odometry);
+            void reset(const NavigationNode from, const NavigationNode to);
+            void observe(const NavigationCachedJunction junction);
+            void move(const NavigationStep& step);
+            void best(NavigationNode& from, NavigationNode& to,
+                bool& false_junction) const;
+            NavigationCachedJunction expected_junction(
+                const NavigationNode from, const NavigationNode to) const;
+        private:
+            double distance_likelihood(const unsigned int length,
+                const double travelled) const;
+            void add(double belief[MAX_NODE][MAX_NODE],
+                double offset[MAX_NODE][MAX_NODE],
+                const NavigationNode from, const NavigationNode to,
+                const double weight, const double distance) const;
+            const NavigationGraph* _graph;
+            const Odometry* _odometry;
+            double _mark;
+            bool _observed;
+            double _belief[MAX_NODE][MAX_NODE];
+            double _offset[MAX_NODE][MAX_NODE];
+            double _arrived[MAX_NODE][MAX_NODE];
+            double _false[MAX_NODE][MAX_NODE];
+    };
+}
+
+#endif /* LIBIDP_LOCALISER_H */
+
@@ -12,6 +12,7 @@
 #include "line_following.h"
 #include "navigation.h"
 #include "clamp_control.h"
+#include "status_watchdog.h"
 
 // Debug functionality
 #define MODULE_NAME "MisSup"
@@ -27,8 +28,12 @@ namespace IDP {
      * Initialises a link to the specified robot number, or 0 if running
      * embedded.
      * \param robot Which robot to link to, or 0 if embedded
+     * \param backend Which HAL backend to drive
+     * \param record Whether to record the link traffic
+     * \param async Whether to run the link on its own I/O thread
      */
-    MissionSupervisor::MissionSupervisor(int robot = 0):
+    MissionSupervisor::MissionSupervisor(int robot = 0,
+        const HALBackend backend, const bool record, const bool async):
         _hal(0), _nav(0), _cc(0), _box_has_red(false), _box_has_green(false),
         _box_has_white(false), _already_delivered_box_one(false)
     {
@@ -36,7 +41,8 @@ namespace IDP {
         INFO("Constructing a MisionSupervisor, robot=" << robot);
 
         // Construct the hardware abstraction layer
-        this->_hal = new HardwareAbstractionLayer(robot);
+        this->_hal = new HardwareAbstractionLayer(robot, async, backend,
+            record);
 
         // Construct a Navigation
         this->_nav = new Navigation(this->_hal);
@@ -107,7 +113,8 @@ namespace IDP {
 
         if(!this->_already_delivered_box_one) {
             INFO("Filling box one");
-            this->fill_and_deliver(BOX1);
+            if(!this->fill_and_deliver(BOX1))
+                return;
             this->_already_delivered_box_one = true;
 
             // Drive forward a little to stop things breaking
@@ -122,9 +129,11 @@ namespace IDP {
         }
 
         INFO("Filling box two");
-        this->fill_and_deliver(BOX2);
+        if(!this->fill_and_deliver(BOX2))
+            return;
 
         INFO("All done!");
+        this->_nav->save_turn_rates();
 
     }
 
@@ -134,8 +143,9 @@ namespace IDP {
      * before picking the box up, driving to the delivery area and dropping
      * it off, then return to the start.
      * \param box Which Box to fill
+     * \returns false if the robot got lost on the way
      */
-    void MissionSupervisor::fill_and_deliver(Box box)
+    bool MissionSupervisor::fill_and_deliver(Box box)
     {
         NavigationStatus nav_status;
 
@@ -147,7 +157,11 @@ namespace IDP {
             INFO("Navigating to the box (" << BoxStrings[box] << ")");
             do {
                 nav_status = this->_nav->find_box_for_pickup(box);
+                if(!this->handle_status_events())
+                    nav_status = NAVIGATION_LOST;
             } while(nav_status == NAVIGATION_ENROUTE);
+            if(!this->arrived(nav_status))
+                return false;
 
             // Ensure the grabber jaw is open, then lower the arm to the box
             INFO("Lowering arm to box");
@@ -169,11 +183,17 @@ namespace IDP {
             INFO("Going to the first bobbin on the rack");
             do {
                 nav_status = this->_nav->find_bobbin();
+                if(!this->handle_status_events())
+                    nav_status = NAVIGATION_LOST;
             } while(nav_status == NAVIGATION_ENROUTE);
+            if(!this->arrived(nav_status))
+                return false;
 
             // Check bobbin colour and move to next until we find something
             // we like
             BobbinColour bobbin_colour = this->find_useful_bobbin();
+            if(bobbin_colour == BOBBIN_UNKNOWN_COLOUR)
+                return false;
 
             // Pick the bobbin up
             INFO("Picking the bobbin up");
@@ -183,7 +203,11 @@ namespace IDP {
             INFO("Returning to box");
             do {
                 nav_status = this->_nav->find_box_for_drop(box);
+                if(!this->handle_status_events())
+                    nav_status = NAVIGATION_LOST;
             } while(nav_status == NAVIGATION_ENROUTE);
+            if(!this->arrived(nav_status))
+                return false;
 
             // Drop the bobbin
             INFO("Putting the bobbin down in the box");
@@ -195,7 +219,13 @@ namespace IDP {
         }
         
         INFO("Box filled! Delivery time.");
-        this->_nav->find_box_for_pickup(box);
+        do {
+            nav_status = this->_nav->find_box_for_pickup(box);
+            if(!this->handle_status_events())
+                nav_status = NAVIGATION_LOST;
+        } while(nav_status == NAVIGATION_ENROUTE);
+        if(!this->arrived(nav_status))
+            return false;
 
         INFO("Picking box up");
         this->_cc->pick_up();
@@ -203,7 +233,11 @@ namespace IDP {
         INFO("Taking box to delivery");
         do {
             nav_status = this->_nav->go_to_delivery();
+            if(!this->handle_status_events())
+                nav_status = NAVIGATION_LOST;
         } while(nav_status == NAVIGATION_ENROUTE);
+        if(!this->arrived(nav_status))
+            return false;
 
         INFO("Delivering box");
         this->_cc->put_down();
@@ -211,22 +245,118 @@ namespace IDP {
         INFO("Leaving delivery zone");
         do {
             nav_status = this->_nav->finished_delivery();
+            if(!this->handle_status_events())
+                nav_status = NAVIGATION_LOST;
         } while(nav_status == NAVIGATION_ENROUTE);
+        if(!this->arrived(nav_status))
+            return false;
 
         INFO("Returning to start zone");
         do {
             nav_status = this->_nav->go_home();
+            if(!this->handle_status_events())
+                nav_status = NAVIGATION_LOST;
         } while(nav_status == NAVIGATION_ENROUTE);
+        if(!this->arrived(nav_status))
+            return false;
 
         INFO("Back home");
+        return true;
     }
 
     /**
-     * Stop.
+     * Stop, keeping what has been learned about turning.
      */
     void MissionSupervisor::stop()
     {
         this->_hal->motors_stop();
+        this->_nav->save_turn_rates();
+    }
+
+    /**
+     * Check how a navigation operation ended. If the robot got lost, stop
+     * it where it is rather than carry on as if it had arrived.
+     * \param status The NavigationStatus the operation finished with
+     * \returns true if the robot arrived
+     */
+    bool MissionSupervisor::arrived(const NavigationStatus status)
+    {
+        TRACE("arrived(" << NavigationStatusStrings[status] << ")");
+        if(status == NAVIGATION_ARRIVED)
+            return true;
+
+        ERROR("Lost, stopping the mission");
+        this->_hal->motors_stop();
+        return false;
+    }
+
+    /**
+     * Deal with any faults the status watchdog has raised since the last
+     * call, by holding the robot stopped until they clear. Called once per
+     * navigation tick.
+     * \returns false if the mission cannot go on, as when a replayed link
+     * log has run out
+     */
+    bool MissionSupervisor::handle_status_events()
+    {
+        if(this->_hal->replay_finished()) {
+            INFO("Replay finished, stopping the mission");
+            return false;
+        }
+
+        int events = this->_hal->status_events();
+        if(!events)
+            return true;
+
+        TRACE("handle_status_events(" << events << ")");
+
+        if(events & STATUS_EVENT_EMERGENCY_STOP) {
+            INFO("Emergency stop fired, holding until it clears");
+        }
+
+        if(events & STATUS_EVENT_MOTOR_FAULT) {
+            ERROR("Motor fault reported, holding until it clears");
+        }
+
+        if(events & STATUS_EVENT_LINK_ERROR) {
+            ERROR("Link error reported, holding until it clears");
+        }
+
+        return this->hold_stopped(events);
+    }
+
+    /**
+     * Keep the motors stopped and keep sampling until the faults raised
+     * have cleared. A link error clears on the first frame sampled without
+     * one; the faults read from STATUS clear on the next STATUS reading
+     * that no longer shows them. The navigation tick that follows drives
+     * the motors again.
+     * \param events The StatusEvent flags raised
+     * \returns false if the replayed link log ran out while holding
+     */
+    bool MissionSupervisor::hold_stopped(const int events)
+    {
+        TRACE("hold_stopped(" << events << ")");
+        const int status_faults = STATUS_EVENT_EMERGENCY_STOP |
+            STATUS_EVENT_MOTOR_FAULT;
+        int held = events;
+
+        this->_hal->motors_stop();
+        while(held) {
+            const SensorFrame& frame = this->_hal->sample();
+            if(this->_hal->replay_finished()) {
+                INFO("Replay finished while holding, stopping the mission");
+                return false;
+            }
+
+            const int raised = this->_hal->status_events();
+            held = (held & status_faults) | raised;
+            if(frame.status_read)
+                held &= raised | ~status_faults;
+        }
+
+        INFO("Faults cleared, resuming");
+        return true;
     }
 
     /**
@@ -280,7 +410,11 @@ namespace IDP {
                 NavigationStatus nav_status;
                 do {
                     nav_status = this->_nav->find_next_bobbin();
+                    if(!this->handle_status_events())
+                        nav_status = NAVIGATION_LOST;
                 } while(nav_status == NAVIGATION_ENROUTE);
+                if(!this->arrived(nav_status))
+                    return BOBBIN_UNKNOWN_COLOUR;
             }
         }
 
@@ -14,6 +14,7 @@
 // Required for their various enums
 #include "clamp_control.h"
 #include "navigation.h"
+#include "hal.h"
 
 /**
  * Contains all the IDP related functionality including libidp and some idpbin
@@ -21,8 +22,6 @@
  */
 namespace IDP {
 
-    class HardwareAbstractionLayer;
-
     /**
      * Control the overall robot behaviour and objective
      * fulfillment
@@ -30,7 +29,9 @@ namespace IDP {
     class MissionSupervisor
     {
         public:
-            MissionSupervisor(int robot);
+            MissionSupervisor(int robot,
+                const HALBackend backend = HAL_BACKEND_LINK,
+                const bool record = false, const bool async = false);
             ~MissionSupervisor();
             void run_task(void);
             void stop(void);
@@ -40,7 +41,10 @@ namespace IDP {
         private:
             void update_box_contents(BobbinColour colour);
             BobbinColour find_useful_bobbin(void);
-            void fill_and_deliver(Box box);
+            bool fill_and_deliver(Box box);
+            bool arrived(const NavigationStatus status);
+            bool handle_status_events(void);
+            bool hold_stopped(const int events);
             HardwareAbstractionLayer* _hal;
             Navigation* _nav;
             ClampControl* _cc;
@@ -7,6 +7,10 @@
 #include "navigation.h"
 #include "line_following.h"
 #include "clamp_control.h"
+#include "velocity_planner.h"
+#include "navigation_graph.h"
+#include "localiser.h"
+#include "odometry.h"
 #include "hal.h"
 
 // Debug functionality
@@ -22,32 +26,6 @@
 
 namespace IDP {
 
-    /**
-     * The turns at each node.
-     *
-     * Indexed by NavigationDirection and then by NavigationNode
-     */
-    const NavigationTurn NAVIGATION_NODE_TURNS[MAX_DIRECTION][MAX_NODE] = {
-        {STRAIGHT, BOTH_AND_STRAIGHT, BOTH_AND_STRAIGHT, BOTH,
-            BOTH_AND_STRAIGHT, BOTH_AND_STRAIGHT, BOTH_AND_STRAIGHT,
-            BOTH_AND_STRAIGHT, BOTH_AND_STRAIGHT, RIGHT, END_OF_LINE},
-        {END_OF_LINE, BOTH_AND_STRAIGHT, BOTH_AND_STRAIGHT, RIGHT_AND_STRAIGHT,
-            BOTH_AND_STRAIGHT, BOTH_AND_STRAIGHT, BOTH_AND_STRAIGHT,
-            BOTH_AND_STRAIGHT, BOTH_AND_STRAIGHT, LEFT, STRAIGHT}
-    };
-
-    /**
-     * Turns that should be taken at each node in each direction.
-     *
-     * Indexed by NavigationDirection and then by NavigationNode
-     */
-    const NavigationTurn NAVIGATION_TURN_MAP[MAX_DIRECTION][MAX_NODE] = {
-        {STRAIGHT, STRAIGHT, STRAIGHT, RIGHT, STRAIGHT, RIGHT, STRAIGHT,
-            STRAIGHT, STRAIGHT, RIGHT, END_OF_LINE},
-        {END_OF_LINE, STRAIGHT, STRAIGHT, LEFT, STRAIGHT, LEFT, STRAIGHT,
-            STRAIGHT, STRAIGHT, LEFT, STRAIGHT}
-    };
-
     /**
      * The lookup table of NavigationLocations to a pair of NavigationNodes
      * indicating the start and end node (with implied direction).
@@ -59,15 +37,31 @@ namespace IDP {
     };
 
     /**
-     * The route to take, node by node
+     * The node to stop at for each Box
      */
-    const NavigationNode NAVIGATION_ROUTE_MAP[MAX_DIRECTION][MAX_NODE] = {
-        {NODE2, NODE3, NODE4, NODE5, NODE6, NODE8, NODE8, NODE9, NODE10,
-            NODE11, NODE10},
-        {NODE2, NODE1, NODE2, NODE3, NODE4, NODE5, NODE6, NODE7, NODE8,
-            NODE9, NODE10}
-    };
+    const NavigationNode NAVIGATION_BOX_NODES[MAX_BOX] = {NODE7, NODE8};
+
+    /**
+     * How far to keep driving onto a junction that does not match the map
+     * before deciding where it is, in millimetres. This gives the filter
+     * time to confirm a side of it we reached late, such as when coming
+     * at it askew.
+     */
+    const double NAVIGATION_REOBSERVE_DISTANCE = 30.0;
+
+    /**
+     * How far to drive off a node we were stopped at before a junction
+     * can be the next node, in millimetres. The filter takes a few ticks
+     * to confirm the junction still under us when we set off again.
+     */
+    const double NAVIGATION_LEAVE_DISTANCE = 40.0;
 
+    /**
+     * The step taken to drive over a junction that is not on the map.
+     */
+    static const NavigationStep FALSE_JUNCTION_STEP = {
+        STEP_JUNCTION, STRAIGHT, TURN_LEFT, 0, MAX_NODE, MAX_NODE
+    };
 
     /**
      * Initialise the class, storing the pointer to the HAL.
@@ -81,8 +75,12 @@ namespace IDP {
      */
     Navigation::Navigation(HardwareAbstractionLayer* hal,
         const NavigationNode from, const NavigationNode to):
-        _hal(hal), _from(from), _to(to), _lf(0), _cc(0), 
-        _cached_junction(NO_CACHE), _reached_special_case_junction(false)
+        _hal(hal), _from(from), _to(to), _lf(0), _cc(0), _vp(0), _graph(0),
+        _localiser(0), _step(0), _segment_from(MAX_NODE),
+        _segment_to(MAX_NODE), _cached_junction(NO_CACHE),
+        _reobserving(false), _reobserve_start(0), _false_junction(false),
+        _leaving_node(false), _leave_start(0), _operation(OPERATION_NONE),
+        _phase(PHASE_DRIVING)
     {
         TRACE("Navigation(" << hal << ", " << NavigationNodeStrings[from] <<
             ", " << NavigationNodeStrings[to] << ")");
@@ -90,7 +88,18 @@ namespace IDP {
         
         // Initialise a new lf object
         this->_lf = new LineFollowing(hal);
-        this->_lf->set_speed(127);
+        this->_lf->set_speed(APPROACH_SPEED);
+
+        // Initialise a new vp object to speed us up from there
+        this->_vp = new VelocityPlanner(&hal->odometry());
+
+        // Initialise a new graph object, with any layout we have been given
+        this->_graph = new NavigationGraph();
+        this->_graph->load(NAVIGATION_GRAPH_FILE);
+
+        // Initialise a new localiser object, sure of where we start
+        this->_localiser = new Localiser(this->_graph, &hal->odometry());
+        this->_localiser->reset(from, to);
 
         // Initialise a new cc object
         this->_cc = new ClampControl(hal);
@@ -109,6 +118,12 @@ namespace IDP {
             delete this->_lf;
         if(this->_cc)
             delete this->_cc;
+        if(this->_vp)
+            delete this->_vp;
+        if(this->_localiser)
+            delete this->_localiser;
+        if(this->_graph)
+            delete this->_graph;
     }
 
     /**
@@ -121,28 +136,14 @@ namespace IDP {
     {
         TRACE("find_box_for_drop(" << BoxStrings[box] << ")");
 
-        // Reduce the speed whilst looking for a box so we don't
-        // overshoot the node
-        DEBUG("Setting speed to 80 to avoid node overshoot");
-        this->_lf->set_speed(80);
+        this->begin(OPERATION_BOX_FOR_DROP, PHASE_DRIVING);
 
-        NavigationStatus nav_status;
-        if (box == BOX1)
-        {
-            do {
-                nav_status = this->go_node(NODE7);
-            } while (nav_status == NAVIGATION_ENROUTE);
-        }
-        else if (box == BOX2)
-        {
-            do {
-                nav_status = this->go_node(NODE8);
-            } while (nav_status == NAVIGATION_ENROUTE);
+        NavigationStatus nav_status = this->drive(NAVIGATION_BOX_NODES[box]);
+        if(nav_status == NAVIGATION_ARRIVED) {
+            DEBUG("Found a box!");
+            this->_hal->motors_stop();
         }
-
-        DEBUG("Found a box!");
-        this->_hal->motors_stop();
-        return NAVIGATION_ARRIVED;
+        return this->finish(nav_status);
     }
 
     /**
@@ -155,38 +156,47 @@ namespace IDP {
     {
         TRACE("find_box_for_pickup(" << BoxStrings[box] << ")");
 
-        // Go to the relevant node for the box
-        this->find_box_for_drop(box);
+        this->begin(OPERATION_BOX_FOR_PICKUP, PHASE_DRIVING);
 
-        // Slow down to find the box by reflection
-        DEBUG("Reducing the speed to 48 for box detection");
-        this->_lf->set_speed(48);
+        // Go to the relevant node for the box
+        if(this->_phase == PHASE_DRIVING) {
+            NavigationStatus nav_status = this->drive(
+                NAVIGATION_BOX_NODES[box]);
+            if(nav_status != NAVIGATION_ARRIVED)
+                return this->finish(nav_status);
+
+            // Slow down to find the box by reflection
+            DEBUG("Reducing the speed to 48 for box detection");
+            this->_lf->set_speed(48);
+
+            // Stop while the jars and arms open
+            DEBUG("Stopping the motors to wait for actuators");
+            this->_hal->motors_stop();
 
-        // Stop while the jars and arms open
-        DEBUG("Stopping the motors to wait for actuators");
-        this->_hal->motors_stop();
+            // Open the jaw and lower the arm
+            DEBUG("Opening jaw and lowering arm");
+            this->_cc->open_jaw();
+            this->_cc->lower_arm();
 
-        // Open the jaw and lower the arm
-        DEBUG("Opening jaw and lowering arm");
-        this->_cc->open_jaw();
-        this->_cc->lower_arm();
+            this->_phase = PHASE_FINDING_BOX;
+            return NAVIGATION_ENROUTE;
+        }
 
         // Move slowly forwards until we detect a box top with the
-        // badness LDR
-        bool box_present;
-        do {
-            box_present = this->_cc->box_present();
-            this->_lf->follow_line();
-        } while (!box_present);
-
-        // Set the speed back to normal ready to continue driving
+        // badness LDR, checking and steering from the same frame
+        const SensorFrame& frame = this->_hal->sample();
+        bool box_present = this->_cc->box_present(frame);
+        this->_lf->follow_line(frame);
+        if(!box_present)
+            return NAVIGATION_ENROUTE;
+
+        // The velocity planner speeds us back up when we drive off
         DEBUG("Found box!");
         DEBUG("Stopping motors");
         this->_hal->motors_stop();
-        DEBUG("Resetting speed to 127");
-        this->_lf->set_speed(127);
+        this->_cc->end_presence();
 
-        return NAVIGATION_ARRIVED;
+        return this->finish(NAVIGATION_ARRIVED);
     }
 
     /**
@@ -198,81 +208,54 @@ namespace IDP {
     {
         TRACE("find_bobbin()");
 
-        // Get to the start box
-        DEBUG("Moving to the start box");
-        NavigationStatus nav_status;
-        do {
-            nav_status = this->go_node(NODE8);
-        } while (nav_status == NAVIGATION_ENROUTE);
-
-        // Stop while the jars and arms open
-        DEBUG("Stopping the motors to wait for actuators");
-        this->_hal->motors_stop();
+        if(this->begin(OPERATION_BOBBIN, PHASE_DRIVING)) {
+            DEBUG("Moving to the start box");
+        }
 
-        // Open the jaw and lower the arm
-        DEBUG("Opening jaw and lowering arm");
-        this->_cc->open_jaw();
-        this->_cc->lower_arm();
+        // Get to the start box
+        if(this->_phase == PHASE_DRIVING) {
+            NavigationStatus nav_status = this->drive(NODE8);
+            if(nav_status != NAVIGATION_ARRIVED)
+                return this->finish(nav_status);
 
-        DEBUG("Ready to begin the bobbin run");
+            // Stop while the jars and arms open
+            DEBUG("Stopping the motors to wait for actuators");
+            this->_hal->motors_stop();
 
-        // Start the bobbin run
-        do {
-            nav_status = this->find_next_bobbin();
-        } while (nav_status == NAVIGATION_ENROUTE);
+            // Open the jaw and lower the arm
+            DEBUG("Opening jaw and lowering arm");
+            this->_cc->open_jaw();
+            this->_cc->lower_arm();
 
-        DEBUG("Found a bobbin!");
+            DEBUG("Ready to begin the bobbin run");
+            DEBUG("Reducing speed to 20 for bobbin detection");
+            this->_lf->set_speed(20);
+            this->_phase = PHASE_LEAVING_BOBBIN;
+            return NAVIGATION_ENROUTE;
+        }
 
-        return nav_status;
+        // Do the bobbin run
+        NavigationStatus nav_status = this->next_bobbin();
+        if(nav_status == NAVIGATION_ARRIVED)
+            DEBUG("Found a bobbin!");
+        return this->finish(nav_status);
     }
 
     /**
-     * Drive forwards at a slow speed, and return only when a bobbin
-     * is present.
+     * Drive forwards at a slow speed, until a bobbin is present.
      * \returns A NavigationStatus code
      */
     NavigationStatus Navigation::find_next_bobbin()
     {
         TRACE("find_next_bobbin()");
-        
-        // Reduce the speed of the robot
-        DEBUG("Reducing speed to 20 for bobbin detection");
-        this->_lf->set_speed(20);
 
-        LineFollowingStatus lf_status;
-
-        // Lose the current bobbin
-        bool presence;
-        DEBUG("Losing current bobbin");
-        do {
-            presence = this->_cc->bobbin_present();
-            lf_status = this->_lf->follow_line();
-        } while(presence);
-        DEBUG("Lost current bobbin");
-
-        if(lf_status == BOTH_TURNS_FOUND) {
-            this->_from = NODE9;
-            this->_to = NODE10;
-        }
-
-        // Follow the line until ClampControl says we're at a bobbin
-        presence = this->_cc->bobbin_present();
-        if (!presence) {
-            lf_status = this->_lf->follow_line();
-            return NAVIGATION_ENROUTE;
+        if(this->begin(OPERATION_NEXT_BOBBIN, PHASE_LEAVING_BOBBIN)) {
+            // Reduce the speed of the robot
+            DEBUG("Reducing speed to 20 for bobbin detection");
+            this->_lf->set_speed(20);
         }
 
-        if(lf_status == BOTH_TURNS_FOUND) {
-            this->_from = NODE9;
-            this->_to = NODE10;
-        }
-
-        // Reset the speed back to full
-        DEBUG("Got a bobbin, stopping & resetting speed to 127");
-        this->_hal->motors_stop();
-        this->_lf->set_speed(127);
-
-        return NAVIGATION_ARRIVED;
+        return this->finish(this->next_bobbin());
     }
 
     /**
@@ -283,29 +266,29 @@ namespace IDP {
     {
         TRACE("go_to_delivery()");
 
-        // Reduce speed to minimise positioning errors caused by inertia
-        DEBUG("Reducing speed for delivery action");
-        this->_lf->set_speed(80);
+        this->begin(OPERATION_DELIVERY, PHASE_DRIVING);
 
-        NavigationStatus nav_status;
-        do {
-            nav_status = this->go_node(NODE3);
-        } while(nav_status == NAVIGATION_ENROUTE);
+        if(this->_phase == PHASE_DRIVING) {
+            NavigationStatus nav_status = this->drive(NODE3);
+            if(nav_status != NAVIGATION_ARRIVED)
+                return this->finish(nav_status);
 
-        DEBUG("At node 3, turning...");
+            // Reduce speed to minimise positioning errors caused by inertia
+            DEBUG("At node 3, reducing speed and turning...");
+            this->_lf->set_speed(80);
+            this->_phase = PHASE_TURNING;
+            return NAVIGATION_ENROUTE;
+        }
 
-        LineFollowingStatus lf_status;
-        do {
-            lf_status = this->_lf->turn_around_delivery();
-        } while(lf_status == ACTION_IN_PROGRESS);
+        LineFollowingStatus lf_status = this->_lf->turn_around_delivery();
+        if(lf_status == ACTION_IN_PROGRESS)
+            return NAVIGATION_ENROUTE;
+        else if(lf_status == LOST)
+            return this->finish(NAVIGATION_LOST);
 
         DEBUG("Finished delivery turn, ready to drop");
 
-        // Reset the speed to full
-        DEBUG("Resetting speed to 127");
-        this->_lf->set_speed(127);
-
-        return NAVIGATION_ARRIVED;
+        return this->finish(NAVIGATION_ARRIVED);
     }
 
     /**
@@ -316,28 +299,31 @@ namespace IDP {
     {
         TRACE("finished_delivery()");
 
-        // Reduce speed as this action can easily overshoot
-        DEBUG("Setting speed to 80 to get back onto line");
-        this->_lf->set_speed(80);
+        if(this->begin(OPERATION_FINISH_DELIVERY, PHASE_TURNING)) {
+            // Reduce speed as this action can easily overshoot
+            DEBUG("Setting speed to 80 to get back onto line");
+            this->_lf->set_speed(80);
 
-        DEBUG("Turning back onto the line towards node 4");
-        LineFollowingStatus lf_status;
-        do {
-            lf_status = this->_lf->turn_around_cw();
-        } while(lf_status == ACTION_IN_PROGRESS);
+            DEBUG("Turning back onto the line towards node 4");
+        }
+
+        LineFollowingStatus lf_status = this->_lf->turn_around_cw();
+        if(lf_status == ACTION_IN_PROGRESS)
+            return NAVIGATION_ENROUTE;
+        else if(lf_status == LOST)
+            return this->finish(NAVIGATION_LOST);
 
         DEBUG("Back on the line");
 
         this->_to = NODE4;
         this->_from = NODE3;
+        this->_localiser->reset(this->_from, this->_to);
 
-        this->_cached_junction = NO_CACHE;
-
-        // Set the speed back to full
-        DEBUG("Setting speed back to 127");
-        this->_lf->set_speed(127);
+        this->_reobserving = false;
+        this->_false_junction = false;
+        this->leave_node();
 
-        return NAVIGATION_ARRIVED;
+        return this->finish(NAVIGATION_ARRIVED);
     }
 
     /**
@@ -347,31 +333,8 @@ namespace IDP {
     NavigationStatus Navigation::go_node(const NavigationNode target)
     {
         TRACE("go_node(" << NavigationNodeStrings[target] << ")");
-        DEBUG("From " << NavigationNodeStrings[_from] << ", to " <<
-            NavigationNodeStrings[_to] << ", target " <<
-            NavigationNodeStrings[target]);
-
-        // Update our cached view of the junction status.
-        // This stores the last known junction when we start
-        // a turn so we don't get confused halfway through.
-        this->update_cache();
-
-        // Check if we need to turn, and do so
-        if(this->turn_around_required(target))
-            return this->turn_around();
-
-        // If we detect a junction, handle it, otherwise keep on
-        // driving straight.
-        if(this->_cached_junction == NO_TURNS) {
-            this->_cached_junction = NO_CACHE;
-            LineFollowingStatus status = this->_lf->follow_line();
-            if(status == LOST)
-                return NAVIGATION_LOST;
-            return NAVIGATION_ENROUTE;
-        } else {
-            return this->handle_junction(target);
-        }
-
+        this->_operation = OPERATION_NONE;
+        return this->drive(target);
     }
 
     /**
@@ -386,150 +349,191 @@ namespace IDP {
     }
 
     /**
-     * Check if we need to turn around
-     * \param target The NavigationNode we need to go to
-     * \returns A bool, true if we need to turn around
+     * Keep the turn rates LineFollowing has learned for the next run.
      */
-    bool Navigation::turn_around_required(const NavigationNode target) const
+    void Navigation::save_turn_rates()
     {
-        TRACE("turn_around_required(" << NavigationNodeStrings[target]<<")");
+        TRACE("save_turn_rates()");
+        this->_lf->save_turn_rates();
+    }
 
-        // If target is to, we don't need to turn.
-        if(target == this->_to)
+    /**
+     * Start an operation, unless it is already in progress.
+     * \param operation The operation being called
+     * \param phase The phase it starts in
+     * \returns true if the operation has just started
+     */
+    bool Navigation::begin(const NavigationOperation operation,
+        const NavigationPhase phase)
+    {
+        if(this->_operation == operation)
             return false;
 
-        // Determine direction we need to be travelling to get to
-        // the target, and also the direction we are currently
-        // travelling.
-        NavigationDirection target_direction, current_direction;
-        if(target > this->_to)
-            target_direction = NAVIGATION_CLOCKWISE;
-        else
-            target_direction = NAVIGATION_ANTICLOCKWISE;
-        if(this->_to > this->_from)
-            current_direction = NAVIGATION_CLOCKWISE;
-        else
-            current_direction = NAVIGATION_ANTICLOCKWISE;
-
-        return target_direction != current_direction;
+        DEBUG("Starting " << NavigationOperationStrings[operation] <<
+            " in " << NavigationPhaseStrings[phase]);
+        this->_operation = operation;
+        this->_phase = phase;
+
+        // Whatever junction the last operation left cached is behind us
+        if(phase == PHASE_DRIVING) {
+            this->_cached_junction = NO_CACHE;
+            this->_reobserving = false;
+            this->_false_junction = false;
+        }
+        return true;
     }
 
     /**
-     * Determine the current direction of travel and then execute an
-     * about turn.
-     * \returns A NavigationStatus of NAVIGATION_ENROUTE if currently
-     * turning, or NAVIGATION_LOST if line following got lost during
-     * the turn.
+     * Finish the operation in progress, if it is done.
+     * \param status What the operation returns from this tick
+     * \returns status
      */
-    NavigationStatus Navigation::turn_around()
+    NavigationStatus Navigation::finish(const NavigationStatus status)
     {
-        TRACE("turn_around()");
+        if(status != NAVIGATION_ENROUTE)
+            this->_operation = OPERATION_NONE;
+        return status;
+    }
 
-        // Determine the current direction of travel around the course
-        NavigationDirection current_direction;
-        if(this->_to > this->_from) {
-            DEBUG("We are travelling clockwise");
-            current_direction = NAVIGATION_CLOCKWISE;
-        } else {
-            DEBUG("We are travelling anticlockwise");
-            current_direction = NAVIGATION_ANTICLOCKWISE;
+    /**
+     * Creep forwards past the bobbin we are at, if any, and on until a
+     * bobbin is present. This is the bobbin run part of find_bobbin()
+     * and find_next_bobbin().
+     * \returns A NavigationStatus code
+     */
+    NavigationStatus Navigation::next_bobbin()
+    {
+        TRACE("next_bobbin()");
+
+        const SensorFrame& frame = this->_hal->sample();
+        bool presence = this->_cc->bobbin_present(frame);
+
+        // Lose the current bobbin
+        if(this->_phase == PHASE_LEAVING_BOBBIN) {
+            if(!presence) {
+                DEBUG("Lost current bobbin");
+                this->_phase = PHASE_FINDING_BOBBIN;
+            }
+        } else if(presence) {
+            DEBUG("Got a bobbin, stopping");
+            this->_hal->motors_stop();
+            this->_cc->end_presence();
+            return NAVIGATION_ARRIVED;
         }
 
-        // If we're in the start box and facing ccw, get to node 6 and then
-        // turn around. this is a bit awful in that it uses a loop, but times
-        // needs must
-        if((this->_from == NODE8 && this->_to == NODE7) ||
-           (this->_from == NODE7 && this->_to == NODE6))
-        {
-            //this->_lf->set_speed(30);
-            NavigationStatus status;
-            do {
-                status = this->go_node(NODE6);
-            } while(status == NAVIGATION_ENROUTE);
-
-            LineFollowingStatus lf_status;
-            do {
-                lf_status = this->_lf->turn_around_cw(2);
-            } while(lf_status == ACTION_IN_PROGRESS);
-
-            this->_from = NODE7;
-            this->_to = NODE8;
-            this->_cached_junction = NO_CACHE;
-            this->_reached_special_case_junction = false;
-            return NAVIGATION_ENROUTE;
+        // Follow the line until ClampControl says we're at a bobbin,
+        // noting if we pass the junction at the end of the rack. The
+        // junction we set off from is under us to begin with.
+        LineFollowingStatus lf_status;
+        lf_status = this->_lf->follow_line(frame);
+        bool junction = lf_status == LEFT_TURN_FOUND ||
+            lf_status == RIGHT_TURN_FOUND || lf_status == BOTH_TURNS_FOUND;
+        if(!this->leaving_node(junction) && lf_status == BOTH_TURNS_FOUND) {
+            this->_from = NODE9;
+            this->_to = NODE10;
+            this->_localiser->reset(this->_from, this->_to);
+            this->leave_node();
         }
 
-        // If we're starting in the start box, leave before turning
-        if(this->_from == NODE7 && this->_to == NODE8) {
-            DEBUG("Leaving the start box before turning");
-            LineFollowingStatus forwardstatus;
-            forwardstatus = this->_lf->follow_line();
-            if(forwardstatus == ACTION_IN_PROGRESS) {
-                DEBUG("LF is in progress *");
-                return NAVIGATION_ENROUTE;
-            } else if(forwardstatus == LOST) {
-                return NAVIGATION_LOST;
-            } else {
-                this->_cached_junction = BOTH_TURNS;
-                this->handle_junction(NODE9);
-                return NAVIGATION_ENROUTE;
+        return NAVIGATION_ENROUTE;
+    }
+
+    /**
+     * Drive one tick towards a particular NavigationNode. This is go_node()
+     * for the operations made up of driving to a node and then doing
+     * something else.
+     * \param target The NavigationNode to go to
+     * \returns A NavigationStatus code
+     */
+    NavigationStatus Navigation::drive(const NavigationNode target)
+    {
+        TRACE("drive(" << NavigationNodeStrings[target] << ")");
+        DEBUG("From " << NavigationNodeStrings[_from] << ", to " <<
+            NavigationNodeStrings[_to] << ", target " <<
+            NavigationNodeStrings[target]);
+
+        // Sample every sensor once for this tick
+        const SensorFrame frame = this->_hal->sample();
+
+        // Update our cached view of the junction status.
+        // This stores the last known junction when we start
+        // a turn so we don't get confused halfway through.
+        bool junction = this->update_cache(frame);
+
+        // Look up what to do next
+        this->_step = &this->_graph->route(this->_from, this->_to, target);
+
+        // Check a junction we have just come to against the map, unless
+        // we only saw it while spinning round to turn around. If it is
+        // what the map has ahead, it is the node ahead, as odometry alone
+        // is not trusted to say otherwise. If not, look again before
+        // deciding where it is.
+        if(junction && this->_step->action != STEP_TURN_AROUND) {
+            NavigationCachedJunction expected =
+                this->_localiser->expected_junction(this->_from, this->_to);
+            if(this->_cached_junction != expected) {
+                INFO("Saw " << NavigationCachedJunctionStrings[
+                    this->_cached_junction] << " where the map has " <<
+                    NavigationCachedJunctionStrings[expected] <<
+                    ", looking again");
+                this->_reobserving = true;
+                this->_reobserve_start = this->_hal->odometry().distance();
             }
         }
+        DEBUG("Next step is " << NavigationActionStrings[this->_step->action]);
+        if(this->_step->action == STEP_NO_ROUTE) {
+            this->_hal->motors_stop();
+            return NAVIGATION_LOST;
+        }
 
-        // Turning around is a dangerous business!
-        // Mostly we only want to turn around between nodes 8 and 9, or 9 and
-        // 10, as we drive along picking up bobbins. In either of these cases,
-        // drive until we get to the end node, then do the turn safely as we
-        // know where we are. In other cases, just turn and hope for the best -
-        // this is pretty unlikely to happen.
-        if(((this->_from == NODE8 && this->_to == NODE9) ||
-           (this->_from == NODE9 && this->_to == NODE10)) &&
-            !this->_reached_special_case_junction)
-        {
-            DEBUG("Turning around on top line, special casing");
-            LineFollowingStatus forwardstatus;
-            forwardstatus = this->_lf->follow_line();
-            if(forwardstatus == ACTION_IN_PROGRESS) {
-                DEBUG("LF is in progress");
-                this->_cached_junction = NO_CACHE;
-                return NAVIGATION_ENROUTE;
-            } else if(forwardstatus == LOST) {
-                DEBUG("Got lost");
+        // Check if we need to turn, and do so
+        if(this->_step->action == STEP_TURN_AROUND)
+            return this->turn_around(frame);
+
+        this->plan_speed(frame);
+
+        // If we detect a junction, handle it, otherwise keep on
+        // driving straight.
+        if(this->_cached_junction == NO_TURNS) {
+            this->_cached_junction = NO_CACHE;
+            LineFollowingStatus status = this->_lf->follow_line(frame);
+            if(status == LOST)
                 return NAVIGATION_LOST;
-            } else {
-                // We found the junction, so tell LF to skip a line
-                // and then do the turn.
-                DEBUG("Found end junction on turn around special case");
-                this->_reached_special_case_junction = true;
-                this->_cached_junction = NO_CACHE;
-            }
+            return NAVIGATION_ENROUTE;
+        } else if(this->_reobserving) {
+            return this->reobserve(frame);
+        } else {
+            return this->handle_junction(frame);
         }
 
-        unsigned short int skip_lines = 0;
-        if(this->_reached_special_case_junction)
-            //skip_lines = 1;
-            skip_lines = 0;
+    }
 
-        DEBUG("skip_lines="<<skip_lines<<", reached_s_c_j="<<
-                this->_reached_special_case_junction);
+    /**
+     * Turn around where we are.
+     * \param frame The SensorFrame for this control tick
+     * \returns A NavigationStatus of NAVIGATION_ENROUTE if currently
+     * turning, or NAVIGATION_LOST if line following got lost during
+     * the turn.
+     */
+    NavigationStatus Navigation::turn_around(const SensorFrame& frame)
+    {
+        TRACE("turn_around(frame)");
+        DEBUG("Turning around with a " <<
+            LineFollowingTurnDirectionStrings[this->_step->direction]);
 
         // Request LineFollowing to execute the required turn.
         LineFollowingStatus turnstatus;
-        if(current_direction == NAVIGATION_CLOCKWISE) {
-            DEBUG("Turning clockwise");
-            turnstatus = this->_lf->turn_around_cw(skip_lines);
-        } else {
-            DEBUG("Turning anticlockwise");
-            turnstatus = this->_lf->turn_around_ccw(skip_lines);
-        }
+        turnstatus = this->_lf->turn(this->_step->direction, frame,
+            this->_step->skip_lines);
         
         if(turnstatus == ACTION_COMPLETED) {
-            // Swap around to and from nodes
-            NavigationNode placeholder = this->_to;
-            this->_to = this->_from;
-            this->_from = placeholder;
-            this->_reached_special_case_junction = false;
+            this->_localiser->move(*this->_step);
+            this->_from = this->_step->from;
+            this->_to = this->_step->to;
             this->_cached_junction = NO_CACHE;
+            this->_reobserving = false;
+            this->_false_junction = false;
+            this->_leaving_node = false;
         } else if(turnstatus == LOST) {
             // If lost, bubble that up
             return NAVIGATION_LOST;
@@ -541,14 +545,21 @@ namespace IDP {
     /**
      * Check if we should update the cached junction status and
      * request a new one from LineFollowing if required.
+     * \param frame The SensorFrame for this control tick
+     * \returns true if a junction has just been seen
      */
-    void Navigation::update_cache()
+    bool Navigation::update_cache(const SensorFrame& frame)
     {
-        TRACE("update_cache()");
+        TRACE("update_cache(frame)");
 
         if(this->_cached_junction == NO_CACHE) {
-            LineFollowingStatus status = this->_lf->junction_status();
+            LineFollowingStatus status = this->_lf->junction_status(frame);
             DEBUG("Updating cache with " << LineFollowingStatusStrings[status]);
+
+            // The junction we stopped on is not the next node
+            if(this->leaving_node(status != NO_TURNS_FOUND))
+                status = NO_TURNS_FOUND;
+
             if(status == NO_TURNS_FOUND)
                 this->_cached_junction = NO_TURNS;
             else if(status == LEFT_TURN_FOUND)
@@ -557,9 +568,119 @@ namespace IDP {
                 this->_cached_junction = RIGHT_TURN;
             else if(status == BOTH_TURNS_FOUND)
                 this->_cached_junction = BOTH_TURNS;
+            return this->_cached_junction != NO_CACHE &&
+                this->_cached_junction != NO_TURNS;
         } else {
             DEBUG("Using cached status " << this->_cached_junction);
         }
+        return false;
+    }
+
+    /**
+     * Keep driving onto a junction that did not match the map for a
+     * little way, adding any side of it seen since to the cached junction.
+     * If it comes to match the map it is the node ahead. If it still does
+     * not once we have looked for long enough, work out where it most
+     * likely is, which may move where we think we are.
+     * \param frame The SensorFrame for this control tick
+     * \returns NAVIGATION_LOST if line following got lost, or
+     * NAVIGATION_ENROUTE otherwise
+     */
+    NavigationStatus Navigation::reobserve(const SensorFrame& frame)
+    {
+        TRACE("reobserve(frame)");
+
+        LineFollowingStatus status = this->_lf->junction_status(frame);
+        if(status == BOTH_TURNS_FOUND ||
+            (status == LEFT_TURN_FOUND &&
+                this->_cached_junction == RIGHT_TURN) ||
+            (status == RIGHT_TURN_FOUND &&
+                this->_cached_junction == LEFT_TURN))
+            this->_cached_junction = BOTH_TURNS;
+
+        if(this->_cached_junction == this->_localiser->expected_junction(
+            this->_from, this->_to))
+        {
+            DEBUG("Junction now matches the map");
+            this->_reobserving = false;
+        } else if(this->_hal->odometry().distance() - this->_reobserve_start
+            >= NAVIGATION_REOBSERVE_DISTANCE)
+        {
+            DEBUG("Settled on " <<
+                NavigationCachedJunctionStrings[this->_cached_junction]);
+            this->_reobserving = false;
+            this->localise();
+        }
+
+        status = this->_lf->follow_line(frame);
+        if(status == LOST)
+            return NAVIGATION_LOST;
+        return NAVIGATION_ENROUTE;
+    }
+
+    /**
+     * Work out where the junction just seen most likely is. If that is
+     * not the node ahead, take the robot to be where it most likely is
+     * instead, so the next step is planned from there. If it is most
+     * likely not a node at all, drive straight over it.
+     */
+    void Navigation::localise()
+    {
+        TRACE("localise()");
+
+        this->_localiser->observe(this->_cached_junction);
+
+        NavigationNode from, to;
+        bool false_junction;
+        this->_localiser->best(from, to, false_junction);
+
+        if(from != this->_from || to != this->_to) {
+            ERROR("Mislocalised: expected to reach " <<
+                NavigationNodeStrings[this->_to] << " from " <<
+                NavigationNodeStrings[this->_from] << " but most likely " <<
+                (false_junction ? "between " : "reaching ") <<
+                NavigationNodeStrings[to] << " from " <<
+                NavigationNodeStrings[from]);
+            this->_from = from;
+            this->_to = to;
+        }
+
+        if(false_junction) {
+            ERROR("Junction seen is most likely not on the map, " <<
+                "driving over it");
+        }
+        this->_false_junction = false_junction;
+    }
+
+    /**
+     * Forget the junction of the node we are at, which stays under the
+     * sensors as we set off again.
+     */
+    void Navigation::leave_node()
+    {
+        this->_cached_junction = NO_CACHE;
+        this->_leaving_node = true;
+        this->_leave_start = this->_hal->odometry().total();
+    }
+
+    /**
+     * Check whether we are still leaving the node we were at, which is
+     * until we have driven NAVIGATION_LEAVE_DISTANCE off it and no longer
+     * see its junction.
+     * \param junction Whether a junction is seen this tick
+     * \returns true if any junction seen is still the one we are leaving
+     */
+    bool Navigation::leaving_node(const bool junction)
+    {
+        if(!this->_leaving_node)
+            return false;
+        if(junction || this->_hal->odometry().total() - this->_leave_start
+            < NAVIGATION_LEAVE_DISTANCE)
+            return true;
+
+        DEBUG("Left the node behind");
+        this->_leaving_node = false;
+        return false;
     }
 
     /**
@@ -567,86 +688,125 @@ namespace IDP {
      * an intermediate one where a turn may be required.
      *
      * If we are at the target junction, return with NAVIGATION_ARRIVED,
-     * or at an intermediate junction look up the required action and
-     * then tell LineFollowing whether to go straight forward or turn,
-     * and keep calling Navigation::turn() as appropriate to execute
-     * the turn.
+     * or at an intermediate junction tell LineFollowing whether to go
+     * straight forward or turn as the planned step says, and keep
+     * calling LineFollowing::turn() as appropriate to execute the turn.
      *
-     * \returns NAVIGATION_ARRIVED if at the target junction, or
-     * NAVIGATION_ENROUTE otherwise.
+     * \param frame The SensorFrame for this control tick
+     * \returns NAVIGATION_ARRIVED if at the target junction,
+     * NAVIGATION_LOST if line following got lost, or NAVIGATION_ENROUTE
+     * otherwise.
      */
-    NavigationStatus Navigation::handle_junction(const NavigationNode target)
+    NavigationStatus Navigation::handle_junction(const SensorFrame& frame)
     {
-        TRACE("handle_junction("<<NavigationNodeStrings[target]<<")");
+        TRACE("handle_junction(frame)");
 
-        // Determine the current direction of travel around the course
-        NavigationDirection current_direction;
-        if(this->_to > this->_from) {
-            DEBUG("We are travelling clockwise");
-            current_direction = NAVIGATION_CLOCKWISE;
-        } else {
-            DEBUG("We are travelling anticlockwise");
-            current_direction = NAVIGATION_ANTICLOCKWISE;
+        // Store the result of the LineFollowing operation
+        LineFollowingStatus status;
+
+        // Carry on along the edge over a junction that is not on the map
+        if(this->_false_junction) {
+            DEBUG("Continuing straight over false junction");
+            status = this->_lf->follow_line(frame);
+            if(this->_lf->passed_junction() != NO_TURNS_FOUND) {
+                this->_localiser->move(FALSE_JUNCTION_STEP);
+                this->_cached_junction = NO_CACHE;
+                this->_false_junction = false;
+            } else if(status == LOST) {
+                return NAVIGATION_LOST;
+            }
+            return NAVIGATION_ENROUTE;
         }
 
         // See if we're there!
-        if(target == this->_to) {
+        if(this->_step->action == STEP_ARRIVE) {
             DEBUG("Found target junction");
-            this->_from = this->_to;
-            this->_to = NAVIGATION_ROUTE_MAP[current_direction][this->_to];
+            this->_hal->reset_odometry();
+            this->_localiser->move(*this->_step);
+            this->_from = this->_step->from;
+            this->_to = this->_step->to;
+            this->leave_node();
             return NAVIGATION_ARRIVED;
         }
 
-        // Look up which direction to go
-        NavigationTurn turn;
-        turn = NAVIGATION_TURN_MAP[current_direction][this->_to];
-
-        // Store the result of the LineFollowing operation
-        LineFollowingStatus status;
-
-        // Initialise status to a somewhat harmless default
-        status = ACTION_IN_PROGRESS;
-
-        // Number of lines to skip on the turn.
-        // Almost always zero, except when we are doing a
-        // right hand turn after NODE6 due to the starting
-        // box getting in the way.
-        unsigned short int skip_lines = 0;
-        if(turn == RIGHT && this->_to == NODE6 &&
-           current_direction == NAVIGATION_CLOCKWISE)
-        {
-            DEBUG("Telling LineFollowing to skip one line for NODE6");
-            skip_lines = 1;
-        }
-
-        if(turn == STRAIGHT) {
+        bool straight = this->_step->action == STEP_JUNCTION &&
+            this->_step->turn == STRAIGHT;
+        if(straight) {
             DEBUG("Continuing straight over junction");
-            status = this->_lf->follow_line();
-        } else if(turn == LEFT) {
-            DEBUG("Turning left");
-            status = this->_lf->turn_left();
-        } else if(turn == RIGHT) {
-            DEBUG("Turning right");
-            status = this->_lf->turn_right(skip_lines);
-        } else if(turn == END_OF_LINE) {
-            DEBUG("end of line :(");
-            this->_hal->motors_stop();
-            return NAVIGATION_ARRIVED;
+            status = this->_lf->follow_line(frame);
+        } else {
+            DEBUG("Turning with a " <<
+                LineFollowingTurnDirectionStrings[this->_step->direction] <<
+                ", skipping " << this->_step->skip_lines << " lines");
+            status = this->_lf->turn(this->_step->direction, frame,
+                this->_step->skip_lines);
         }
 
-        // If we're going straight, ACTION_IN_PROGRESS is an
-        // indication of completion, while ACTION_COMPLETED means
-        // a turn completed.
-        if((turn == STRAIGHT && status == ACTION_IN_PROGRESS)
+        // If we're going straight, the junction is done once the sensor
+        // history shows we have driven right over it, while
+        // ACTION_COMPLETED means a turn completed.
+        if((straight && this->_lf->passed_junction() != NO_TURNS_FOUND)
             || status == ACTION_COMPLETED)
         {
             DEBUG("Completed junction action");
+            this->_hal->reset_odometry();
+            this->_localiser->move(*this->_step);
             this->_cached_junction = NO_CACHE;
-            this->_from = this->_to;
-            this->_to = NAVIGATION_ROUTE_MAP[current_direction][this->_to];
+            this->_from = this->_step->from;
+            this->_to = this->_step->to;
+        } else if(status == LOST) {
+            return NAVIGATION_LOST;
         }
 
         return NAVIGATION_ENROUTE;
     }
+
+    /**
+     * Set the speed for this control tick from how far we think it is to
+     * the next node, and whether we need to turn or stop there.
+     *
+     * The speed is left alone while turning at a junction. If we have
+     * not just come from a known node, such as after being moved by a
+     * bobbin run, where we are on the segment is unknown so we treat
+     * ourselves as already at its end.
+     *
+     * \param frame The SensorFrame for this control tick
+     */
+    void Navigation::plan_speed(const SensorFrame& frame)
+    {
+        TRACE("plan_speed(frame)");
+
+        bool slow_at_end = this->_step->action != STEP_JUNCTION ||
+            this->_step->turn != STRAIGHT;
+
+        if(this->_cached_junction != NO_TURNS && slow_at_end)
+            return;
+
+        // Keep track of which segment we are on
+        if(this->_from != this->_segment_from ||
+            this->_to != this->_segment_to)
+        {
+            if(this->_from == this->_segment_to &&
+                this->_to == this->_segment_from)
+            {
+                DEBUG("Turned around, reversing the segment");
+                this->_vp->reverse();
+            } else if(this->_from == this->_segment_to) {
+                DEBUG("Starting a new segment");
+                this->_vp->start_segment(
+                    this->_graph->edge(this->_from, this->_to).length);
+            } else {
+                DEBUG("Not sure where we are on the segment");
+                this->_vp->start_segment(0);
+            }
+            this->_segment_from = this->_from;
+            this->_segment_to = this->_to;
+        }
+
+        unsigned short int speed = this->_vp->speed(frame.timestamp,
+            this->_lf->speed(), slow_at_end);
+        if(speed != this->_lf->speed())
+            this->_lf->set_speed(speed);
+    }
 }
 
@@ -15,6 +15,11 @@ namespace IDP {
     class HardwareAbstractionLayer;
     class LineFollowing;
     class ClampControl;
+    class VelocityPlanner;
+    class NavigationGraph;
+    class Localiser;
+    struct NavigationStep;
+    struct SensorFrame;
 
     /**
      * Current navigation status
@@ -69,6 +74,35 @@ namespace IDP {
         NO_CACHE, LEFT_TURN, RIGHT_TURN, BOTH_TURNS, NO_TURNS
     };
 
+    /**
+     * Navigation operations that take more than one tick. Only one is in
+     * progress at a time.
+     */
+    enum NavigationOperation {
+        OPERATION_NONE, OPERATION_BOX_FOR_DROP, OPERATION_BOX_FOR_PICKUP,
+        OPERATION_BOBBIN, OPERATION_NEXT_BOBBIN, OPERATION_DELIVERY,
+        OPERATION_FINISH_DELIVERY, MAX_OPERATION
+    };
+
+    /**
+     * Where an operation has got to.
+     *
+     * PHASE_DRIVING is driving to a node.
+     *
+     * PHASE_FINDING_BOX is creeping forwards until a box is under the jaw.
+     *
+     * PHASE_LEAVING_BOBBIN is creeping forwards until the bobbin we were
+     * at has gone.
+     *
+     * PHASE_FINDING_BOBBIN is creeping forwards until there is a bobbin.
+     *
+     * PHASE_TURNING is turning around in or out of the delivery area.
+     */
+    enum NavigationPhase {
+        PHASE_DRIVING, PHASE_FINDING_BOX, PHASE_LEAVING_BOBBIN,
+        PHASE_FINDING_BOBBIN, PHASE_TURNING, MAX_PHASE
+    };
+
     /**
      * String representations of NavigationStatus
      */
@@ -104,7 +138,7 @@ namespace IDP {
      * String representations of NavigationTurn
      */
     static const char* const NavigationTurnStrings[] = {
-        "STRIGHT", "LEFT", "RIGHT", "BOTH", "LEFT_AND_STRAIGHT",
+        "STRAIGHT", "LEFT", "RIGHT", "BOTH", "LEFT_AND_STRAIGHT",
         "RIGHT_AND_STRAIGHT", "BOTH_AND_STRAIGHT", "END_OF_LINE", "MAX_TURNS"
     };
 
@@ -122,9 +156,34 @@ namespace IDP {
         "NO_CACHE", "LEFT_TURN", "RIGHT_TURN", "BOTH_TURNS", "NO_TURNS"
     };
 
+    /**
+     * String representations of NavigationOperation
+     */
+    static const char* const NavigationOperationStrings[] = {
+        "OPERATION_NONE", "OPERATION_BOX_FOR_DROP", "OPERATION_BOX_FOR_PICKUP",
+        "OPERATION_BOBBIN", "OPERATION_NEXT_BOBBIN", "OPERATION_DELIVERY",
+        "OPERATION_FINISH_DELIVERY", "MAX_OPERATION"
+    };
+
+    /**
+     * String representations of NavigationPhase
+     */
+    static const char* const NavigationPhaseStrings[] = {
+        "PHASE_DRIVING", "PHASE_FINDING_BOX", "PHASE_LEAVING_BOBBIN",
+        "PHASE_FINDING_BOBBIN", "PHASE_TURNING", "MAX_PHASE"
+    };
+
     /**
      * Find a route from one place to another on the board, and
-     * maintain an estimate of the current position
+     * maintain an estimate of the current position.
+     *
+     * Every operation does one control tick of work per call and returns
+     * NAVIGATION_ENROUTE until it is done, so the caller can do other
+     * things between ticks. Calling a different operation abandons the
+     * one in progress, and the next call to it starts it afresh.
+     *
+     * Every junction seen is checked by a Localiser, and if the robot is
+     * most likely somewhere other than we thought, we carry on from there.
      */
     class Navigation
     {
@@ -141,18 +200,40 @@ namespace IDP {
             NavigationStatus finished_delivery();
             NavigationStatus go_node(const NavigationNode target);
             NavigationStatus go_home();
+            void save_turn_rates();
         private:
-            void update_cache();
-            bool turn_around_required(const NavigationNode target) const;
-            NavigationStatus turn_around();
-            NavigationStatus handle_junction(const NavigationNode target);
+            bool begin(const NavigationOperation operation,
+                const NavigationPhase phase);
+            NavigationStatus finish(const NavigationStatus status);
+            NavigationStatus drive(const NavigationNode target);
+            NavigationStatus next_bobbin();
+            bool update_cache(const SensorFrame& frame);
+            NavigationStatus reobserve(const SensorFrame& frame);
+            void localise();
+            void leave_node();
+            bool leaving_node(const bool junction);
+            NavigationStatus turn_around(const SensorFrame& frame);
+            NavigationStatus handle_junction(const SensorFrame& frame);
+            void plan_speed(const SensorFrame& frame);
             HardwareAbstractionLayer* _hal;
             NavigationNode _from;
             NavigationNode _to;
             LineFollowing* _lf;
             ClampControl* _cc;
+            VelocityPlanner* _vp;
+            NavigationGraph* _graph;
+            Localiser* _localiser;
+            const NavigationStep* _step;
+            NavigationNode _segment_from;
+            NavigationNode _segment_to;
             NavigationCachedJunction _cached_junction;
-            bool _reached_special_case_junction;
+            bool _reobserving;
+            double _reobserve_start;
+            bool _false_junction;
+            bool _leaving_node;
+            double _leave_start;
+            NavigationOperation _operation;
+            NavigationPhase _phase;
     };
 }
 
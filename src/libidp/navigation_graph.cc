@@ -0,0 +1,626 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// navigation_graph.cc
+// Navigation Graph class implementation
+
+#include <climits>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "navigation_graph.h"
+
+// Debug functionality
+#define MODULE_NAME "NavigationGraph"
+#define TRACE_ENABLED   false
+#define DEBUG_ENABLED   false
+#define INFO_ENABLED    true
+#define ERROR_ENABLED   true
+#include "debug.h"
+
+namespace IDP {
+
+    /**
+     * The competition table, as it would be written in a graphfile.
+     *
+     * Node 7 is the start box corner, which the robot does not stop at
+     * heading clockwise as the right turn at node 6 skips past it. The
+     * box is in the way of turning around between nodes 6 and 8, so that
+     * is done at node 6, and on the top line it is done at the next node
+     * where the robot knows where it is.
+     */
+    static const char* const NAVIGATION_DEFAULT_GRAPH =
+        "edge 1 2 570 BOTH_AND_STRAIGHT\n"
+        "exit 1 2 STRAIGHT 0 3\n"
+        "turnaround 1 2 TURN_AROUND_ON_EDGE TURN_AROUND_CW 0 2 1\n"
+        "edge 2 3 330 BOTH_AND_STRAIGHT\n"
+        "exit 2 3 STRAIGHT 0 4\n"
+        "turnaround 2 3 TURN_AROUND_ON_EDGE TURN_AROUND_CW 0 3 2\n"
+        "edge 3 4 1100 BOTH\n"
+        "exit 3 4 RIGHT 0 5\n"
+        "turnaround 3 4 TURN_AROUND_ON_EDGE TURN_AROUND_CW 0 4 3\n"
+        "edge 4 5 840 BOTH_AND_STRAIGHT\n"
+        "exit 4 5 STRAIGHT 0 6\n"
+        "turnaround 4 5 TURN_AROUND_ON_EDGE TURN_AROUND_CW 0 5 4\n"
+        "edge 5 6 840 BOTH_AND_STRAIGHT\n"
+        "exit 5 6 RIGHT 1 8\n"
+        "turnaround 5 6 TURN_AROUND_ON_EDGE TURN_AROUND_CW 0 6 5\n"
+        "edge 6 8 710 BOTH_AND_STRAIGHT\n"
+        "exit 6 8 STRAIGHT 0 9\n"
+        "turnaround 6 8 TURN_AROUND_ON_EDGE TURN_AROUND_CW 0 8 7\n"
+        "edge 7 8 560 BOTH_AND_STRAIGHT\n"
+        "exit 7 8 STRAIGHT 0 9\n"
+        "edge 8 9 400 BOTH_AND_STRAIGHT\n"
+        "exit 8 9 STRAIGHT 0 10\n"
+        "turnaround 8 9 TURN_AROUND_AT_NODE TURN_AROUND_CW 0 9 8\n"
+        "edge 9 10 1110 RIGHT\n"
+        "exit 9 10 RIGHT 0 11\n"
+        "turnaround 9 10 TURN_AROUND_AT_NODE TURN_AROUND_CW 0 10 9\n"
+        "edge 10 11 1310 END_OF_LINE\n"
+        "turnaround 10 11 TURN_AROUND_ON_EDGE TURN_AROUND_CW 0 11 10\n"
+        "edge 11 10 1310 LEFT\n"
+        "exit 11 10 LEFT 0 9\n"
+        "turnaround 11 10 TURN_AROUND_ON_EDGE TURN_AROUND_CCW 0 10 11\n"
+        "edge 10 9 1110 BOTH_AND_STRAIGHT\n"
+        "exit 10 9 STRAIGHT 0 8\n"
+        "turnaround 10 9 TURN_AROUND_ON_EDGE TURN_AROUND_CCW 0 9 10\n"
+        "edge 9 8 400 BOTH_AND_STRAIGHT\n"
+        "exit 9 8 STRAIGHT 0 7\n"
+        "turnaround 9 8 TURN_AROUND_ON_EDGE TURN_AROUND_CCW 0 8 9\n"
+        "edge 8 7 560 BOTH_AND_STRAIGHT\n"
+        "exit 8 7 STRAIGHT 0 6\n"
+        "edge 7 6 150 BOTH_AND_STRAIGHT\n"
+        "exit 7 6 LEFT 0 5\n"
+        "turnaround 7 6 TURN_AROUND_AT_NODE TURN_AROUND_CW 2 7 8\n"
+        "edge 6 5 840 BOTH_AND_STRAIGHT\n"
+        "exit 6 5 STRAIGHT 0 4\n"
+        "turnaround 6 5 TURN_AROUND_ON_EDGE TURN_AROUND_CCW 0 5 6\n"
+        "edge 5 4 840 LEFT_AND_STRAIGHT\n"
+        "exit 5 4 LEFT 0 3\n"
+        "turnaround 5 4 TURN_AROUND_ON_EDGE TURN_AROUND_CCW 0 4 5\n"
+        "edge 4 3 1100 BOTH_AND_STRAIGHT\n"
+        "exit 4 3 STRAIGHT 0 2\n"
+        "turnaround 4 3 TURN_AROUND_ON_EDGE TURN_AROUND_CCW 0 3 4\n"
+        "edge 3 2 330 BOTH_AND_STRAIGHT\n"
+        "exit 3 2 STRAIGHT 0 1\n"
+        "turnaround 3 2 TURN_AROUND_ON_EDGE TURN_AROUND_CCW 0 2 3\n"
+        "edge 2 1 570 END_OF_LINE\n"
+        "turnaround 2 1 TURN_AROUND_ON_EDGE TURN_AROUND_CCW 0 1 2\n";
+
+    /**
+     * What there is between two nodes with no edge between them
+     */
+    static const NavigationEdge NO_EDGE = {
+        false, 0, END_OF_LINE, {MAX_NODE, MAX_NODE, MAX_NODE}, {0, 0, 0},
+        TURN_AROUND_NEVER, TURN_AROUND_CW, 0, MAX_NODE, MAX_NODE
+    };
+
+    /**
+     * The step there is when a node cannot be reached
+     */
+    static const NavigationStep NO_ROUTE_STEP = {
+        STEP_NO_ROUTE, STRAIGHT, TURN_LEFT, 0, MAX_NODE, MAX_NODE
+    };
+
+    /**
+     * Cost of an edge we have not found a route to yet
+     */
+    static const unsigned int NO_ROUTE_COST = UINT_MAX;
+
+    /**
+     * Read a node, numbered from 1 as in misc/node_diagram.png.
+     * \param in The stream to read from
+     * \param node Set to the node read
+     * \returns true if a valid node was read
+     */
+    static bool read_node(std::istream& in, NavigationNode& node)
+    {
+        int number;
+        if(!(in >> number) || number < 1 || number > MAX_NODE)
+            return false;
+        node = static_cast<NavigationNode>(number - 1);
+        return true;
+    }
+
+    /**
+     * Read the name of an enum value.
+     * \param in The stream to read from
+     * \param strings The string representations of the enum
+     * \param count How many of the strings are allowed
+     * \param value Set to the value read
+     * \returns true if one of the allowed names was read
+     */
+    static bool read_name(std::istream& in, const char* const strings[],
+        const int count, int& value)
+    {
+        std::string name;
+        if(!(in >> name))
+            return false;
+        for(int i = 0; i < count; i++) {
+            if(name == strings[i]) {
+                value = i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Note a cheaper route to the end of an edge, if it is one.
+     * \param cost The cost of the best route to the end of each edge
+     * \param first The first step of the best route to each edge
+     * \param step The step that gets onto the edge
+     * \param step_cost The cost of the route through that step
+     * \param route_first The first step of the route through that step
+     */
+    static void relax(unsigned int cost[MAX_NODE][MAX_NODE],
+        NavigationStep first[MAX_NODE][MAX_NODE],
+        const NavigationStep& step, const unsigned int step_cost,
+        const NavigationStep& route_first)
+    {
+        if(step_cost < cost[step.from][step.to]) {
+            cost[step.from][step.to] = step_cost;
+            first[step.from][step.to] = route_first;
+        }
+    }
+
+    /**
+     * Start with the layout of the competition table.
+     */
+    NavigationGraph::NavigationGraph()
+    {
+        TRACE("NavigationGraph()");
+
+        std::istringstream in(NAVIGATION_DEFAULT_GRAPH);
+        if(!this->parse(in, this->_edges) || !this->validate(this->_edges)
+            || !this->build_routes())
+            ERROR("The built in layout is broken");
+    }
+
+    /**
+     * Load a layout in place of the current one. See
+     * misc/graphfile_format.
+     * \param filename The file to read it from
+     * \returns true if a valid layout was loaded, otherwise false and the
+     * current layout is kept
+     */
+    bool NavigationGraph::load(const char* filename)
+    {
+        TRACE("load(" << filename << ")");
+
+        std::ifstream f(filename);
+        if(!f.is_open()) {
+            DEBUG("Could not open " << filename);
+            return false;
+        }
+
+        NavigationEdge edges[MAX_NODE][MAX_NODE];
+        if(!this->parse(f, edges) || !this->validate(edges)) {
+            ERROR("Layout in " << filename << " is not valid, ignoring it");
+            return false;
+        }
+        f.close();
+
+        // Swap the new edges in, and back out if the routes over them
+        // turn out to be no good
+        for(int i = 0; i < MAX_NODE; i++) {
+            for(int j = 0; j < MAX_NODE; j++) {
+                NavigationEdge old = this->_edges[i][j];
+                this->_edges[i][j] = edges[i][j];
+                edges[i][j] = old;
+            }
+        }
+        if(!this->build_routes()) {
+            ERROR("Routes over the layout in " << filename <<
+                " do not work, ignoring it");
+            for(int i = 0; i < MAX_NODE; i++)
+                for(int j = 0; j < MAX_NODE; j++)
+                    this->_edges[i][j] = edges[i][j];
+            this->build_routes();
+            return false;
+        }
+
+        INFO("Read layout from " << filename);
+        return true;
+    }
+
+    /**
+     * Look up the edge between two nodes.
+     * \param from The node at the start of the edge
+     * \param to The node at the end of the edge
+     * \returns The edge, which is not present if there is no line from
+     * one to the other
+     */
+    const NavigationEdge& NavigationGraph::edge(const NavigationNode from,
+        const NavigationNode to) const
+    {
+        if(from >= MAX_NODE || to >= MAX_NODE)
+            return NO_EDGE;
+        return this->_edges[from][to];
+    }
+
+    /**
+     * Look up the first step of the fastest route to a node.
+     * \param from The node behind the robot
+     * \param to The node in front of the robot
+     * \param target The node to go to
+     * \returns The first step, which is STEP_NO_ROUTE if the target
+     * cannot be reached or we are not on an edge
+     */
+    const NavigationStep& NavigationGraph::route(const NavigationNode from,
+        const NavigationNode to, const NavigationNode target) const
+    {
+        if(from >= MAX_NODE || to >= MAX_NODE || target >= MAX_NODE)
+            return NO_ROUTE_STEP;
+        return this->_routes[from][to][target];
+    }
+
+    /**
+     * Read a layout. See misc/graphfile_format.
+     * \param in The stream to read it from
+     * \param edges Filled in with the edges read
+     * \returns true if it was read without error
+     */
+    bool NavigationGraph::parse(std::istream& in,
+        NavigationEdge edges[MAX_NODE][MAX_NODE]) const
+    {
+        TRACE("parse(in, edges)");
+
+        for(int i = 0; i < MAX_NODE; i++)
+            for(int j = 0; j < MAX_NODE; j++)
+                edges[i][j] = NO_EDGE;
+
+        std::string keyword;
+        while(in >> keyword) {
+            if(keyword[0] == '#') {
+                std::getline(in, keyword);
+                continue;
+            }
+
+            NavigationNode from, to;
+            if(!read_node(in, from) || !read_node(in, to)) {
+                ERROR("Bad nodes for " << keyword);
+                return false;
+            }
+            NavigationEdge& e = edges[from][to];
+
+            int value, place;
+            unsigned short int skip_lines;
+            NavigationNode next, other;
+            if(keyword == "edge") {
+                if(!(in >> e.length) ||
+                    !read_name(in, NavigationTurnStrings, MAX_TURNS, value))
+                {
+                    ERROR("Bad edge from " << NavigationNodeStrings[from] <<
+                        " to " << NavigationNodeStrings[to]);
+                    return false;
+                }
+                e.present = true;
+                e.junction = static_cast<NavigationTurn>(value);
+            } else if(keyword == "exit") {
+                if(!read_name(in, NavigationTurnStrings, MAX_EXIT, value) ||
+                    !(in >> skip_lines) || !read_node(in, next))
+                {
+                    ERROR("Bad exit at " << NavigationNodeStrings[to] <<
+                        " from " << NavigationNodeStrings[from]);
+                    return false;
+                }
+                e.exits[value] = next;
+                e.exit_skip_lines[value] = skip_lines;
+            } else if(keyword == "turnaround") {
+                if(!read_name(in, NavigationTurnAroundStrings,
+                        MAX_TURN_AROUND, place) ||
+                    !read_name(in, LineFollowingTurnDirectionStrings,
+                        MAX_TURN_DIRECTION, value) ||
+                    !(in >> skip_lines) || !read_node(in, next) ||
+                    !read_node(in, other))
+                {
+                    ERROR("Bad turn around from " <<
+                        NavigationNodeStrings[from] << " to " <<
+                        NavigationNodeStrings[to]);
+                    return false;
+                }
+                e.turn_around = static_cast<NavigationTurnAround>(place);
+                e.turn_around_direction =
+                    static_cast<LineFollowingTurnDirection>(value);
+                e.turn_around_skip_lines = skip_lines;
+                e.turn_around_from = next;
+                e.turn_around_to = other;
+            } else {
+                ERROR("Unknown line " << keyword);
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * Check every exit and turn around in a layout leads somewhere.
+     * \param edges The edges of the layout
+     * \returns true if the layout can be used
+     */
+    bool NavigationGraph::validate(
+        const NavigationEdge edges[MAX_NODE][MAX_NODE]) const
+    {
+        TRACE("validate(edges)");
+
+        bool valid = true;
+        int count = 0;
+        for(int i = 0; i < MAX_NODE; i++) {
+            for(int j = 0; j < MAX_NODE; j++) {
+                const NavigationEdge& e = edges[i][j];
+                bool used = e.turn_around != TURN_AROUND_NEVER;
+                for(int k = 0; k < MAX_EXIT; k++) {
+                    if(e.exits[k] == MAX_NODE)
+                        continue;
+                    used = true;
+                    if(!edges[j][e.exits[k]].present) {
+                        ERROR("Exit from " << NavigationNodeStrings[j] <<
+                            " to " << NavigationNodeStrings[e.exits[k]] <<
+                            " is not an edge");
+                        valid = false;
+                    }
+                }
+                if(e.turn_around != TURN_AROUND_NEVER &&
+                    !edges[e.turn_around_from][e.turn_around_to].present)
+                {
+                    ERROR("Turning around from " <<
+                        NavigationNodeStrings[i] << " to " <<
+                        NavigationNodeStrings[j] << " does not end up on "
+                        "an edge");
+                    valid = false;
+                }
+                if(!e.present) {
+                    if(used) {
+                        ERROR("No edge from " << NavigationNodeStrings[i] <<
+                            " to " << NavigationNodeStrings[j]);
+                        valid = false;
+                    }
+                    continue;
+                }
+                if(e.length == 0) {
+                    ERROR("Edge from " << NavigationNodeStrings[i] <<
+                        " to " << NavigationNodeStrings[j] << " has no "
+                        "length");
+                    valid = false;
+                }
+                count++;
+            }
+        }
+
+        if(count == 0) {
+            ERROR("There are no edges");
+            valid = false;
+        }
+        return valid;
+    }
+
+    /**
+     * Plan the routes from every edge to every node, then check each one
+     * gets to its target.
+     * \returns true if every route works
+     */
+    bool NavigationGraph::build_routes()
+    {
+        TRACE("build_routes()");
+
+        for(int i = 0; i < MAX_NODE; i++) {
+            for(int j = 0; j < MAX_NODE; j++) {
+                if(this->_edges[i][j].present) {
+                    this->plan(static_cast<NavigationNode>(i),
+                        static_cast<NavigationNode>(j));
+                } else {
+                    for(int k = 0; k < MAX_NODE; k++)
+                        this->_routes[i][j][k] = NO_ROUTE_STEP;
+                }
+            }
+        }
+
+        bool valid = true;
+        for(int i = 0; i < MAX_NODE; i++) {
+            for(int j = 0; j < MAX_NODE; j++) {
+                if(!this->_edges[i][j].present)
+                    continue;
+                for(int k = 0; k < MAX_NODE; k++) {
+                    if(!this->check_route(static_cast<NavigationNode>(i),
+                        static_cast<NavigationNode>(j),
+                        static_cast<NavigationNode>(k)))
+                        valid = false;
+                }
+            }
+        }
+        return valid;
+    }
+
+    /**
+     * Find the fastest routes from one edge to every node, and note the
+     * first step of each.
+     *
+     * We take the robot to be halfway along the edge, as we will not know
+     * any better.
+     *
+     * \param from The node at the start of the edge
+     * \param to The node at the end of the edge
+     */
+    void NavigationGraph::plan(const NavigationNode from,
+        const NavigationNode to)
+    {
+        TRACE("plan(" << NavigationNodeStrings[from] << ", " <<
+            NavigationNodeStrings[to] << ")");
+
+        NavigationStep* routes = this->_routes[from][to];
+        for(int i = 0; i < MAX_NODE; i++)
+            routes[i] = NO_ROUTE_STEP;
+        this->arrive(from, to, routes[to]);
+
+        const NavigationEdge& start = this->_edges[from][to];
+        unsigned int cost[MAX_NODE][MAX_NODE];
+        bool done[MAX_NODE][MAX_NODE];
+        NavigationStep first[MAX_NODE][MAX_NODE];
+        for(int i = 0; i < MAX_NODE; i++) {
+            for(int j = 0; j < MAX_NODE; j++) {
+                cost[i][j] = NO_ROUTE_COST;
+                done[i][j] = false;
+            }
+        }
+        cost[from][to] = start.length / 2;
+
+        NavigationStep step = NO_ROUTE_STEP;
+        if(start.turn_around == TURN_AROUND_ON_EDGE) {
+            step.action = STEP_TURN_AROUND;
+            step.direction = start.turn_around_direction;
+            step.skip_lines = start.turn_around_skip_lines;
+            step.from = start.turn_around_from;
+            step.to = start.turn_around_to;
+            relax(cost, first, step, NAVIGATION_TURN_AROUND_COST +
+                this->_edges[step.from][step.to].length / 2, step);
+        }
+
+        // Dijkstra's algorithm, with the edges as the vertices. There are
+        // few enough of them that a linear search for the next one is
+        // fine.
+        while(true) {
+            int best_from = MAX_NODE, best_to = MAX_NODE;
+            unsigned int best = NO_ROUTE_COST;
+            for(int i = 0; i < MAX_NODE; i++) {
+                for(int j = 0; j < MAX_NODE; j++) {
+                    if(!done[i][j] && cost[i][j] < best) {
+                        best = cost[i][j];
+                        best_from = i;
+                        best_to = j;
+                    }
+                }
+            }
+            if(best == NO_ROUTE_COST)
+                break;
+
+            // The first time we reach a node is the fastest way there
+            done[best_from][best_to] = true;
+            if(routes[best_to].action == STEP_NO_ROUTE) {
+                routes[best_to] = first[best_from][best_to];
+                DEBUG("Route from " << NavigationNodeStrings[from] << " to "
+                    << NavigationNodeStrings[to] << " for " <<
+                    NavigationNodeStrings[best_to] << " costs " << best <<
+                    "mm");
+            }
+
+            const NavigationNode node = static_cast<NavigationNode>(best_to);
+            const NavigationEdge& e = this->_edges[best_from][best_to];
+            const bool at_start = best_from == from && best_to == to;
+
+            step.action = STEP_JUNCTION;
+            for(int i = 0; i < MAX_EXIT; i++) {
+                if(e.exits[i] == MAX_NODE)
+                    continue;
+                step.turn = static_cast<NavigationTurn>(i);
+                step.direction = step.turn == LEFT ? TURN_LEFT : TURN_RIGHT;
+                step.skip_lines = e.exit_skip_lines[i];
+                step.from = node;
+                step.to = e.exits[i];
+                relax(cost, first, step, best +
+                    this->_edges[step.from][step.to].length +
+                    (step.turn == STRAIGHT ? 0 : NAVIGATION_TURN_COST),
+                    at_start ? step : first[best_from][best_to]);
+            }
+
+            if(e.turn_around != TURN_AROUND_NEVER) {
+                step.action = STEP_TURN_AROUND_AT_NODE;
+                step.turn = STRAIGHT;
+                step.direction = e.turn_around_direction;
+                step.skip_lines = e.turn_around_skip_lines;
+                step.from = e.turn_around_from;
+                step.to = e.turn_around_to;
+                relax(cost, first, step, best + NAVIGATION_TURN_AROUND_COST +
+                    this->_edges[step.from][step.to].length,
+                    at_start ? step : first[best_from][best_to]);
+            }
+        }
+    }
+
+    /**
+     * Follow the route from an edge to a node step by step, checking each
+     * step is one the layout allows and that we get there.
+     * \param from The node at the start of the edge
+     * \param to The node at the end of the edge
+     * \param target The node to go to
+     * \returns true if the route works, or there is no route at all
+     */
+    bool NavigationGraph::check_route(const NavigationNode from,
+        const NavigationNode to, const NavigationNode target) const
+    {
+        TRACE("check_route(" << NavigationNodeStrings[from] << ", " <<
+            NavigationNodeStrings[to] << ", " <<
+            NavigationNodeStrings[target] << ")");
+
+        NavigationNode f = from, t = to;
+        for(int i = 0; i < MAX_NODE * MAX_NODE; i++) {
+            const NavigationStep& step = this->_routes[f][t][target];
+            const NavigationEdge& e = this->_edges[f][t];
+
+            bool valid;
+            if(step.action == STEP_ARRIVE) {
+                valid = t == target;
+            } else if(step.action == STEP_NO_ROUTE) {
+                valid = i == 0;
+            } else if(step.action == STEP_JUNCTION) {
+                valid = step.from == t && e.exits[step.turn] == step.to;
+            } else {
+                valid = step.from == e.turn_around_from &&
+                    step.to == e.turn_around_to &&
+                    (step.action == STEP_TURN_AROUND ?
+                     e.turn_around == TURN_AROUND_ON_EDGE :
+                     e.turn_around != TURN_AROUND_NEVER);
+            }
+
+            if(!valid) {
+                ERROR("Route from " << NavigationNodeStrings[from] << " to "
+                    << NavigationNodeStrings[to] << " for " <<
+                    NavigationNodeStrings[target] << " goes wrong at " <<
+                    NavigationActionStrings[step.action] << " from " <<
+                    NavigationNodeStrings[f] << " to " <<
+                    NavigationNodeStrings[t]);
+                return false;
+            }
+            if(step.action == STEP_ARRIVE || step.action == STEP_NO_ROUTE)
+                return true;
+
+            f = step.from;
+            t = step.to;
+        }
+
+        ERROR("Route from " << NavigationNodeStrings[from] << " to " <<
+            NavigationNodeStrings[to] << " for " <<
+            NavigationNodeStrings[target] << " goes round in circles");
+        return false;
+    }
+
+    /**
+     * Work out the step for arriving at the node ahead. We are then taken
+     * to be heading on along the first way out of it of going straight,
+     * left or right, or back the way we came at the end of a line.
+     * \param from The node behind the robot
+     * \param to The node in front of the robot, which is the target
+     * \param step Set to the step
+     */
+    void NavigationGraph::arrive(const NavigationNode from,
+        const NavigationNode to, NavigationStep& step) const
+    {
+        TRACE("arrive(" << NavigationNodeStrings[from] << ", " <<
+            NavigationNodeStrings[to] << ")");
+
+        const NavigationEdge& e = this->_edges[from][to];
+        step = NO_ROUTE_STEP;
+        step.action = STEP_ARRIVE;
+        step.from = to;
+        step.to = from;
+        for(int i = 0; i < MAX_EXIT; i++) {
+            if(e.exits[i] != MAX_NODE) {
+                step.to = e.exits[i];
+                break;
+            }
+        }
+    }
+}
+
@@ -0,0 +1,180 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// navigation_graph.h
+// Navigation Graph class definition
+//
+// Navigation Graph - the lines on the table as a graph of nodes and the
+// edges between them, and the fastest route along it to any node
+
+#pragma once
+#ifndef LIBIDP_NAVIGATION_GRAPH_H
+#define LIBIDP_NAVIGATION_GRAPH_H
+
+#include <istream>
+
+#include "navigation.h"
+#include "line_following.h"
+
+namespace IDP {
+
+    /**
+     * File a layout is read from in place of the built in one
+     */
+    const char* const NAVIGATION_GRAPH_FILE = "graphfile";
+
+    /**
+     * Number of ways out of a junction: STRAIGHT, LEFT and RIGHT, which
+     * are the first three NavigationTurns.
+     */
+    const int MAX_EXIT = 3;
+
+    /**
+     * How long a left or right turn at a junction takes, as the distance
+     * we could have driven instead, in millimetres.
+     */
+    const unsigned int NAVIGATION_TURN_COST = 150;
+
+    /**
+     * How long turning around takes, as the distance we could have driven
+     * instead, in millimetres.
+     */
+    const unsigned int NAVIGATION_TURN_AROUND_COST = 400;
+
+    /**
+     * Where along an edge the robot may turn around.
+     *
+     * TURN_AROUND_ON_EDGE means anywhere, so straight away.
+     *
+     * TURN_AROUND_AT_NODE means only once it has reached the node at the
+     * end, such as where there is something beside the line.
+     *
+     * TURN_AROUND_NEVER means it has to drive on to another edge first.
+     */
+    enum NavigationTurnAround {
+        TURN_AROUND_NEVER, TURN_AROUND_ON_EDGE, TURN_AROUND_AT_NODE,
+        MAX_TURN_AROUND
+    };
+
+    /**
+     * What to do next to get to a target node.
+     *
+     * STEP_ARRIVE means drive to the node ahead, which is the target.
+     *
+     * STEP_JUNCTION means drive to the node ahead and take a turn there.
+     *
+     * STEP_TURN_AROUND means turn around where we are.
+     *
+     * STEP_TURN_AROUND_AT_NODE means drive to the node ahead and turn
+     * around there.
+     *
+     * STEP_NO_ROUTE means the target cannot be reached from here.
+     */
+    enum NavigationAction {
+        STEP_ARRIVE, STEP_JUNCTION, STEP_TURN_AROUND,
+        STEP_TURN_AROUND_AT_NODE, STEP_NO_ROUTE, MAX_ACTION
+    };
+
+    /**
+     * String representations of NavigationTurnAround
+     */
+    static const char* const NavigationTurnAroundStrings[] = {
+        "TURN_AROUND_NEVER", "TURN_AROUND_ON_EDGE", "TURN_AROUND_AT_NODE",
+        "MAX_TURN_AROUND"
+    };
+
+    /**
+     * String representations of NavigationAction
+     */
+    static const char* const NavigationActionStrings[] = {
+        "STEP_ARRIVE", "STEP_JUNCTION", "STEP_TURN_AROUND",
+        "STEP_TURN_AROUND_AT_NODE", "STEP_NO_ROUTE", "MAX_ACTION"
+    };
+
+    /**
+     * One step of a route.
+     *
+     * turn is the turn to take for STEP_JUNCTION, and direction is what
+     * LineFollowing should turn for anything but going STRAIGHT over a
+     * junction, skipping skip_lines lines. from and to are the nodes we
+     * will be between once the step is done.
+     */
+    struct NavigationStep {
+        NavigationAction action;
+        NavigationTurn turn;
+        LineFollowingTurnDirection direction;
+        unsigned short int skip_lines;
+        NavigationNode from;
+        NavigationNode to;
+    };
+
+    /**
+     * A line from one node to another, in that direction.
+     *
+     * junction is the junction seen on reaching the to node. exits are
+     * the nodes reached by going STRAIGHT, LEFT or RIGHT there, or
+     * MAX_NODE where there is no way on, and exit_skip_lines how many
+     * lines a turn has to skip to get onto the right one.
+     *
+     * Turning around leaves the robot between turn_around_from and
+     * turn_around_to. This is normally the same edge the other way, but
+     * need not be, for instance where the turn is made at a junction.
+     */
+    struct NavigationEdge {
+        bool present;
+        unsigned int length;
+        NavigationTurn junction;
+        NavigationNode exits[MAX_EXIT];
+        unsigned short int exit_skip_lines[MAX_EXIT];
+        NavigationTurnAround turn_around;
+        LineFollowingTurnDirection turn_around_direction;
+        unsigned short int turn_around_skip_lines;
+        NavigationNode turn_around_from;
+        NavigationNode turn_around_to;
+    };
+
+    /**
+     * The layout of the lines on the table, and the fastest way along
+     * them from anywhere to anywhere.
+     *
+     * The robot is always on an edge, heading from one node to another,
+     * so routes are planned over edges rather than nodes. This lets the
+     * planner account for the turn needed to get from one edge to the
+     * next, and for turning around. Routes are costed in millimetres of
+     * driving, with NAVIGATION_TURN_COST for each turn at a junction and
+     * NAVIGATION_TURN_AROUND_COST for each turn around.
+     *
+     * The first step of the route from every edge to every node is
+     * worked out whenever a layout is loaded, and checked by following
+     * it, so finding the next step while driving is a single lookup.
+     *
+     * The layout of the competition table is built in, and can be
+     * replaced by one read from a file. See misc/graphfile_format.
+     */
+    class NavigationGraph
+    {
+        public:
+            NavigationGraph();
+            bool load(const char* filename);
+            const NavigationEdge& edge(const NavigationNode from,
+                const NavigationNode to) const;
+            const NavigationStep& route(const NavigationNode from,
+                const NavigationNode to, const NavigationNode target) const;
+        private:
+            bool parse(std::istream& in, NavigationEdge
+                edges[MAX_NODE][MAX_NODE]) const;
+            bool validate(const NavigationEdge
+                edges[MAX_NODE][MAX_NODE]) const;
+            bool build_routes();
+            void plan(const NavigationNode from, const NavigationNode to);
+            bool check_route(const NavigationNode from,
+                const NavigationNode to, const NavigationNode target) const;
+            void arrive(const NavigationNode from, const NavigationNode to,
+                NavigationStep& step) const;
+            NavigationEdge _edges[MAX_NODE][MAX_NODE];
+            NavigationStep _routes[MAX_NODE][MAX_NODE][MAX_NODE];
+    };
+}
+
+#endif /* LIBIDP_NAVIGATION_GRAPH_H */
+
@@ -0,0 +1,272 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// odometry.cc
+// Odometry class implementation
+
+#include <cmath>
+#include <fstream>
+
+#include "odometry.h"
+#include "hal.h"
+
+// Debug functionality
+#define MODULE_NAME "Odometry"
+#define TRACE_ENABLED   false
+#define DEBUG_ENABLED   false
+#define INFO_ENABLED    true
+#define ERROR_ENABLED   true
+#include "debug.h"
+
+namespace IDP {
+
+    /**
+     * Start stopped, at the origin, with the default calibration.
+     */
+    Odometry::Odometry(): _mm_per_speed_unit(ODOMETRY_MM_PER_SPEED_UNIT),
+        _wheel_base(ODOMETRY_WHEEL_BASE),
+        _ramp_time_unit(ODOMETRY_RAMP_TIME_UNIT), _target_left(0),
+        _target_right(0), _left(0), _right(0), _last_timestamp(0),
+        _distance(0), _total(0), _heading(0), _x(0), _y(0)
+    {
+        TRACE("Odometry()");
+    }
+
+    /**
+     * Load a calibration. See misc/odometryfile_format.
+     * \param filename The file to read it from
+     * \returns true if it was read, false if the file is missing or bad,
+     * in which case the calibration is left alone
+     */
+    bool Odometry::load(const char* filename)
+    {
+        TRACE("load(" << filename << ")");
+
+        std::ifstream f(filename);
+        if(!f.is_open()) {
+            DEBUG("Could not open " << filename);
+            return false;
+        }
+
+        double mm_per_speed_unit, wheel_base, ramp_time_unit;
+        if(!(f >> mm_per_speed_unit >> wheel_base >> ramp_time_unit) ||
+            mm_per_speed_unit <= 0 || wheel_base <= 0 || ramp_time_unit <= 0)
+        {
+            ERROR("Missing or bad calibration in " << filename <<
+                ", ignoring it");
+            return false;
+        }
+        f.close();
+
+        this->calibrate(mm_per_speed_unit, wheel_base, ramp_time_unit);
+        INFO("Read odometry calibration from " << filename);
+        return true;
+    }
+
+    /**
+     * Save the calibration, so later runs start from it.
+     * \param filename The file to write it to
+     * \returns true if it was written
+     */
+    bool Odometry::save(const char* filename) const
+    {
+        TRACE("save(" << filename << ")");
+
+        std::ofstream f(filename);
+        if(!f.is_open()) {
+            ERROR("Could not write odometry calibration to " << filename);
+            return false;
+        }
+
+        f << this->_mm_per_speed_unit << std::endl
+            << this->_wheel_base << std::endl
+            << this->_ramp_time_unit << std::endl;
+        f.close();
+        return true;
+    }
+
+    /**
+     * Set the robot's measured dimensions.
+     * \param mm_per_speed_unit How far a wheel drives each second per unit
+     * of motor speed, in millimetres
+     * \param wheel_base Distance between the two drive wheels, in
+     * millimetres
+     * \param ramp_time_unit How long a motor takes to ramp from stopped to
+     * MOTOR_MAX_SPEED for each unit of MOTOR_RAMP_TIME, in seconds
+     */
+    void Odometry::calibrate(const double mm_per_speed_unit,
+        const double wheel_base, const double ramp_time_unit)
+    {
+        TRACE("calibrate(" << mm_per_speed_unit << ", " << wheel_base <<
+            ", " << ramp_time_unit << ")");
+        this->_mm_per_speed_unit = mm_per_speed_unit;
+        this->_wheel_base = wheel_base;
+        this->_ramp_time_unit = ramp_time_unit;
+    }
+
+    /**
+     * How far a wheel drives each second per unit of motor speed.
+     * \returns The distance in millimetres
+     */
+    double Odometry::mm_per_speed_unit() const
+    {
+        return this->_mm_per_speed_unit;
+    }
+
+    /**
+     * The distance between the two drive wheels.
+     * \returns The distance in millimetres
+     */
+    double Odometry::wheel_base() const
+    {
+        return this->_wheel_base;
+    }
+
+    /**
+     * How long a motor takes to ramp from stopped to MOTOR_MAX_SPEED for
+     * each unit of MOTOR_RAMP_TIME.
+     * \returns The time in seconds
+     */
+    double Odometry::ramp_time_unit() const
+    {
+        return this->_ramp_time_unit;
+    }
+
+    /**
+     * Note new wheel speeds, which apply from the last update() on.
+     * \param left The left wheel speed, -127 to 127
+     * \param right The right wheel speed, -127 to 127
+     */
+    void Odometry::command(const int left, const int right)
+    {
+        TRACE("command(" << left << ", " << right << ")");
+        this->_target_left = left;
+        this->_target_right = right;
+    }
+
+    /**
+     * Work out how far we have moved since the last update.
+     * \param timestamp The time now, in microseconds
+     */
+    void Odometry::update(const unsigned long long int timestamp)
+    {
+        TRACE("update(" << timestamp << ")");
+
+        double elapsed = 0;
+        if(this->_last_timestamp && timestamp > this->_last_timestamp)
+            elapsed = (timestamp - this->_last_timestamp) / 1000000.0;
+        this->_last_timestamp = timestamp;
+
+        // The ramp makes the wheel speeds change during the interval, so
+        // integrate in short steps
+        const double ramp_step = MOTOR_MAX_SPEED /
+            (MOTOR_RAMP_TIME * this->_ramp_time_unit);
+        while(elapsed > 0) {
+            double dt = elapsed < ODOMETRY_STEP ? elapsed : ODOMETRY_STEP;
+            elapsed -= dt;
+
+            this->ramp(this->_left, this->_target_left, ramp_step * dt);
+            this->ramp(this->_right, this->_target_right, ramp_step * dt);
+
+            double left = this->_left * this->_mm_per_speed_unit;
+            double right = this->_right * this->_mm_per_speed_unit;
+            double forward = (left + right) / 2 * dt;
+            double middle = this->_heading +
+                (right - left) / this->_wheel_base * dt / 2;
+
+            this->_distance += forward;
+            this->_total += forward;
+            this->_x += forward * std::cos(middle);
+            this->_y += forward * std::sin(middle);
+            this->_heading += (right - left) / this->_wheel_base * dt;
+        }
+
+        DEBUG("At " << this->_x << ", " << this->_y << " heading " <<
+            this->_heading << " after " << this->_distance << "mm");
+    }
+
+    /**
+     * Take where we are now as the origin, for when the robot is at a
+     * known place. The wheels keep the speeds they had.
+     */
+    void Odometry::reset()
+    {
+        TRACE("reset()");
+        this->_distance = this->_heading = this->_x = this->_y = 0;
+    }
+
+    /**
+     * How far the robot has driven since the last reset, counting
+     * reversing as negative.
+     * \returns The distance in millimetres
+     */
+    double Odometry::distance() const
+    {
+        return this->_distance;
+    }
+
+    /**
+     * How far the robot has driven since it was started, which reset()
+     * leaves alone, counting reversing as negative.
+     * \returns The distance in millimetres
+     */
+    double Odometry::total() const
+    {
+        return this->_total;
+    }
+
+    /**
+     * How far the robot has turned since the last reset.
+     * \returns The heading in radians, anticlockwise positive
+     */
+    double Odometry::heading() const
+    {
+        return this->_heading;
+    }
+
+    /**
+     * How far forwards of where it was at the last reset the robot is.
+     * \returns The distance in millimetres
+     */
+    double Odometry::x() const
+    {
+        return this->_x;
+    }
+
+    /**
+     * How far to the left of where it was at the last reset the robot is.
+     * \returns The distance in millimetres
+     */
+    double Odometry::y() const
+    {
+        return this->_y;
+    }
+
+    /**
+     * How fast the robot is driving forwards now.
+     * \returns The speed in millimetres per second
+     */
+    double Odometry::speed() const
+    {
+        return (this->_left + this->_right) / 2 *
+            this->_mm_per_speed_unit;
+    }
+
+    /**
+     * Move a modelled wheel speed towards its commanded speed.
+     * \param wheel The wheel speed to change
+     * \param target The commanded speed
+     * \param step The most the speed may change by
+     */
+    void Odometry::ramp(double& wheel, const double target,
+        const double step) const
+    {
+        if(wheel < target - step)
+            wheel += step;
+        else if(wheel > target + step)
+            wheel -= step;
+        else
+            wheel = target;
+    }
+}
+
@@ -0,0 +1,100 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// odometry.h
+// Odometry class definition
+//
+// Odometry - dead reckon the robot's movement from the wheel speeds it
+// has been told to drive at
+
+#pragma once
+#ifndef LIBIDP_ODOMETRY_H
+#define LIBIDP_ODOMETRY_H
+
+namespace IDP {
+
+    /**
+     * File the odometry calibration is kept in. See
+     * misc/odometryfile_format.
+     */
+    const char* const ODOMETRY_FILE = "odometryfile";
+
+    /**
+     * How far a wheel drives each second per unit of motor speed, in
+     * millimetres, until calibrated. Matches the simulator.
+     */
+    const double ODOMETRY_MM_PER_SPEED_UNIT = 2.0;
+
+    /**
+     * Distance between the two drive wheels, in millimetres, until
+     * calibrated. Matches the simulator.
+     */
+    const double ODOMETRY_WHEEL_BASE = 200.0;
+
+    /**
+     * How long the motor controller takes to ramp a motor from stopped to
+     * MOTOR_MAX_SPEED for each unit of MOTOR_RAMP_TIME, in seconds, until
+     * calibrated.
+     */
+    const double ODOMETRY_RAMP_TIME_UNIT = 0.02;
+
+    /**
+     * Longest step the movement is integrated over, in seconds.
+     */
+    const double ODOMETRY_STEP = 0.005;
+
+    /**
+     * Estimate how the robot has moved since it was last at a known
+     * place, from the wheel speeds commanded.
+     *
+     * The motor controller ramps each motor towards its commanded speed
+     * over MOTOR_RAMP_TIME rather than jumping straight to it, so the
+     * wheel speeds are modelled ramping the same way. Position is
+     * relative to where the robot was at the last reset(), with x
+     * forwards and y to the left, and the heading is anticlockwise
+     * positive. The total distance driven is kept across resets.
+     *
+     * The robot's dimensions start at the ODOMETRY_ defaults, and are
+     * replaced by load() with those measured by the odometry self test.
+     */
+    class Odometry
+    {
+        public:
+            Odometry();
+            bool load(const char* filename);
+            bool save(const char* filename) const;
+            void calibrate(const double mm_per_speed_unit,
+                const double wheel_base, const double ramp_time_unit);
+            double mm_per_speed_unit() const;
+            double wheel_base() const;
+            double ramp_time_unit() const;
+            void command(const int left, const int right);
+            void update(const unsigned long long int timestamp);
+            void reset();
+            double distance() const;
+            double total() const;
+            double heading() const;
+            double x() const;
+            double y() const;
+            double speed() const;
+        private:
+            void ramp(double& wheel, const double target,
+                const double step) const;
+            double _mm_per_speed_unit;
+            double _wheel_base;
+            double _ramp_time_unit;
+            int _target_left;
+            int _target_right;
+            double _left;
+            double _right;
+            unsigned long long int _last_timestamp;
+            double _distance;
+            double _total;
+            double _heading;
+            double _x;
+            double _y;
+    };
+}
+
+#endif /* LIBIDP_ODOMETRY_H */
+
@@ -0,0 +1,199 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// replay_link.cc
+// Replay Link class implementation
+
+#include "replay_link.h"
+
+#include <fstream>
+#include <robot_link.h>
+
+// Debug functionality
+#define MODULE_NAME "ReplayLink"
+#define TRACE_ENABLED   false
+#define DEBUG_ENABLED   false
+#define INFO_ENABLED    true
+#define ERROR_ENABLED   true
+#include "debug.h"
+
+/**
+ * How many divergences to describe before just counting them.
+ */
+static const unsigned int REPLAY_REPORTED_DIVERGENCES = 10;
+
+/**
+ * How many recorded requests to look through for the one asked for
+ * before giving up on it.
+ */
+static const unsigned int REPLAY_RESYNC_RECORDS = 8;
+
+namespace IDP {
+
+    /**
+     * Load a recorded link log.
+     * \param filename The log file to replay
+     */
+    ReplayLink::ReplayLink(const char* filename): _cursor(0),
+        _command_cursor(0), _timestamp(0), _divergences(0), _errors(0)
+    {
+        TRACE("ReplayLink(" << filename << ")");
+        INFO("Replaying link log " << filename);
+
+        std::ifstream f(filename, std::ios::in | std::ios::binary);
+        if(!f.is_open()) {
+            ERROR("Could not open link log " << filename);
+            return;
+        }
+
+        LinkLogRecord record;
+        while(f.read(reinterpret_cast<char*>(&record), sizeof(record)))
+            this->_records.push_back(record);
+
+        INFO("Loaded " << this->_records.size() << " records");
+    }
+
+    /**
+     * Report how closely the replay followed the recording.
+     */
+    ReplayLink::~ReplayLink()
+    {
+        TRACE("~ReplayLink()");
+        INFO("Replay finished with " << this->_divergences <<
+            " divergences");
+    }
+
+    /**
+     * Check a command against the next recorded command. Nothing is
+     * driven during replay.
+     * \param cmd The command opcode
+     * \param arg The command argument
+     * \returns true, unless the log has run out
+     */
+    bool ReplayLink::command(const command_instruction cmd, const int arg)
+    {
+        TRACE("command(" << cmd << ", " << arg << ")");
+
+        while(this->_command_cursor < this->_records.size() &&
+            this->_records[this->_command_cursor].kind != LINK_LOG_COMMAND)
+            this->_command_cursor++;
+
+        if(this->_command_cursor >= this->_records.size()) {
+            DEBUG("No recorded command left for " << cmd);
+            return false;
+        }
+
+        const LinkLogRecord& record = this->_records[this->_command_cursor++];
+        if(record.opcode != cmd ||
+            record.argument != static_cast<unsigned char>(arg))
+        {
+            if(this->_divergences++ < REPLAY_REPORTED_DIVERGENCES) {
+                INFO("Divergence at record " << this->_command_cursor - 1
+                    << ": sent " << cmd << "(" << arg << "), recorded " <<
+                    static_cast<int>(record.opcode) << "(" <<
+                    static_cast<int>(record.argument) << ")");
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Answer a request with the next recorded response to the same
+     * opcode, skipping over anything else in between. Only the next
+     * REPLAY_RESYNC_RECORDS requests are searched, so one request the
+     * original run never made does not throw away the rest of the log.
+     * If none of them match, only the next recorded request is skipped.
+     * \param req The request opcode
+     * \returns The recorded response, or REQUEST_ERROR if it could not be
+     * found or the log has run out
+     */
+    int ReplayLink::request(const request_instruction req)
+    {
+        TRACE("request(" << req << ")");
+
+        std::vector<LinkLogRecord>::size_type cursor = this->_cursor;
+        std::vector<LinkLogRecord>::size_type skip = this->_records.size();
+        unsigned int searched = 0;
+        while(cursor < this->_records.size() &&
+            searched < REPLAY_RESYNC_RECORDS)
+        {
+            const LinkLogRecord& record = this->_records[cursor++];
+            if(record.kind != LINK_LOG_REQUEST)
+                continue;
+            if(!searched++)
+                skip = cursor;
+            if(record.opcode != req)
+                continue;
+
+            // Skipping a request means the control code asked for
+            // something the original run didn't
+            this->_divergences += searched - 1;
+            this->_cursor = cursor;
+            this->_timestamp = record.timestamp;
+            return record.response;
+        }
+
+        if(searched) {
+            DEBUG("No recorded response to request " << req <<
+                " nearby, skipping one record");
+            this->_divergences++;
+            this->_cursor = skip;
+        } else {
+            DEBUG("No recorded response left for request " << req);
+            this->_cursor = cursor;
+        }
+        this->_errors++;
+        return REQUEST_ERROR;
+    }
+
+    /**
+     * Batched request, as robot_link::operator>>.
+     * \param req The request, whose parameter is filled with the response
+     * \returns This ReplayLink, for chaining
+     */
+    ReplayLink& ReplayLink::operator>>(robot_request& req)
+    {
+        req.parameter = static_cast<unsigned char>(this->request(req.opcode));
+        return *this;
+    }
+
+    /**
+     * Check whether every record has been played back.
+     * \returns true once the end of the log is reached
+     */
+    bool ReplayLink::finished() const
+    {
+        return this->_cursor >= this->_records.size();
+    }
+
+    /**
+     * When the most recently replayed response was originally recorded,
+     * so time moves as it did in the original run.
+     * \returns The recorded time in microseconds on the monotonic clock
+     */
+    unsigned long long int ReplayLink::timestamp() const
+    {
+        return this->_timestamp / 1000ULL;
+    }
+
+    /**
+     * How many times the replay has strayed from the recording.
+     * \returns The number of mismatched commands and skipped requests
+     */
+    unsigned int ReplayLink::divergences() const
+    {
+        return this->_divergences;
+    }
+
+    /**
+     * How many requests have gone unanswered, as robot_link counts its
+     * errors. A batched request cannot carry REQUEST_ERROR back, so this
+     * is how a failed batch is spotted.
+     * \returns The number of requests made after the log ran out
+     */
+    unsigned int ReplayLink::errors() const
+    {
+        return this->_errors;
+    }
+}
+
@@ -0,0 +1,53 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// replay_link.h
+// Replay Link class definition
+//
+// Replay Link - a stand in for robot_link which answers requests from a
+// recorded link log
+
+#pragma once
+#ifndef LIBIDP_REPLAY_LINK_H
+#define LIBIDP_REPLAY_LINK_H
+
+#include <vector>
+#include <robot_instr.h>
+
+#include "link_log.h"
+
+namespace IDP {
+
+    /**
+     * A robot_link replacement which plays back a recorded session.
+     *
+     * Each request is answered with the next recorded response to the
+     * same opcode, so the control code sees the sensor readings the robot
+     * saw. Commands are not driven anywhere, but are checked against the
+     * recorded commands in order, and any difference is reported as a
+     * divergence from the original run.
+     */
+    class ReplayLink
+    {
+        public:
+            ReplayLink(const char* filename);
+            ~ReplayLink();
+            bool command(const command_instruction cmd, const int arg);
+            int request(const request_instruction req);
+            ReplayLink& operator>>(robot_request& req);
+            bool finished() const;
+            unsigned long long int timestamp() const;
+            unsigned int divergences() const;
+            unsigned int errors() const;
+        private:
+            std::vector<LinkLogRecord> _records;
+            std::vector<LinkLogRecord>::size_type _cursor;
+            std::vector<LinkLogRecord>::size_type _command_cursor;
+            unsigned long long int _timestamp;
+            unsigned int _divergences;
+            unsigned int _errors;
+    };
+}
+
+#endif /* LIBIDP_REPLAY_LINK_H */
+
@@ -0,0 +1,136 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// scheduler.cc
+// Scheduler class implementation
+
+#include "scheduler.h"
+
+#include <errno.h>
+#include <time.h>
+
+// Debug functionality
+#define MODULE_NAME "Scheduler"
+#define TRACE_ENABLED   false
+#define DEBUG_ENABLED   false
+#define INFO_ENABLED    true
+#define ERROR_ENABLED   true
+#include "debug.h"
+
+/**
+ * Read the monotonic clock in nanoseconds.
+ */
+static unsigned long long int now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<unsigned long long int>(now.tv_sec) * 1000000000ULL
+        + static_cast<unsigned long long int>(now.tv_nsec);
+}
+
+namespace IDP {
+
+    /**
+     * Construct a Scheduler.
+     * \param rate Ticks per second, or 0 to never wait
+     */
+    Scheduler::Scheduler(const unsigned int rate): _period(0), _next(0),
+        _ticks(0), _overruns(0), _worst_overrun(0)
+    {
+        TRACE("Scheduler(" << rate << ")");
+        this->set_rate(rate);
+    }
+
+    /**
+     * Change the tick rate. The schedule restarts at the next tick.
+     * \param rate Ticks per second, or 0 to never wait
+     */
+    void Scheduler::set_rate(const unsigned int rate)
+    {
+        TRACE("set_rate(" << rate << ")");
+        INFO("Running control loop at " << rate << "Hz");
+        this->_period = rate ? 1000000000ULL / rate : 0;
+        this->_next = 0;
+    }
+
+    /**
+     * Sleep until the next tick is due.
+     */
+    void Scheduler::wait()
+    {
+        this->_ticks++;
+        if(!this->_period)
+            return;
+
+        unsigned long long int now = now_ns();
+
+        // First tick, or after idle(): start the schedule from now
+        if(!this->_next) {
+            DEBUG("Starting schedule");
+            this->_next = now + this->_period;
+            return;
+        }
+
+        if(now > this->_next) {
+            unsigned long long int late = now - this->_next;
+            if(late > SCHEDULER_STALL_PERIODS * this->_period) {
+                INFO("Stalled for " << late / 1000 << "us");
+            } else {
+                DEBUG("Overrun by " << late / 1000 << "us");
+            }
+            this->_overruns++;
+            if(late > this->_worst_overrun)
+                this->_worst_overrun = late;
+            this->_next = now + this->_period;
+            return;
+        }
+
+        struct timespec deadline;
+        deadline.tv_sec = static_cast<time_t>(this->_next / 1000000000ULL);
+        deadline.tv_nsec = static_cast<long>(this->_next % 1000000000ULL);
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, 0)
+            == EINTR)
+            continue;
+
+        this->_next += this->_period;
+    }
+
+    /**
+     * Say the loop is about to stop ticking on purpose, so the next tick
+     * starts a new schedule instead of counting as an overrun.
+     */
+    void Scheduler::idle()
+    {
+        TRACE("idle()");
+        this->_next = 0;
+    }
+
+    /**
+     * How many ticks have run.
+     * \returns The number of calls to wait()
+     */
+    unsigned int Scheduler::ticks() const
+    {
+        return this->_ticks;
+    }
+
+    /**
+     * How many ticks were late.
+     * \returns The number of overruns
+     */
+    unsigned int Scheduler::overruns() const
+    {
+        return this->_overruns;
+    }
+
+    /**
+     * Print the tick and overrun counts.
+     */
+    void Scheduler::dump() const
+    {
+        TRACE("dump()");
+        INFO("Ran " << this->_ticks << " ticks with " << this->_overruns <<
+            " overruns, worst " << this->_worst_overrun / 1000 << "us late");
+    }
+}
+
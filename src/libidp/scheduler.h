@@ -0,0 +1,62 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// scheduler.h
+// Scheduler class definition
+//
+// Scheduler - pace the control loop at a fixed rate on the monotonic clock
+
+#pragma once
+#ifndef LIBIDP_SCHEDULER_H
+#define LIBIDP_SCHEDULER_H
+
+namespace IDP {
+
+    /**
+     * Default control loop rate, in Hz.
+     */
+    const unsigned int CONTROL_RATE = 200;
+
+    /**
+     * Control loop period at CONTROL_RATE, in microseconds.
+     */
+    const unsigned int CONTROL_PERIOD = 1000000 / CONTROL_RATE;
+
+    /**
+     * A tick this many periods late is a stall, and is logged as soon as
+     * it happens as well as counted as an overrun.
+     */
+    const unsigned int SCHEDULER_STALL_PERIODS = 20;
+
+    /**
+     * Run a loop at a fixed rate.
+     *
+     * Each call to wait() sleeps until the next tick is due, measured from
+     * the previous tick rather than from when wait() was called, so the
+     * rate does not drift with the time spent in the loop body. A tick
+     * that is already late is an overrun; it runs immediately and the
+     * schedule restarts from it. A loop that stops ticking on purpose,
+     * e.g. while the clamp moves, calls idle() first so that the tick
+     * after is not counted.
+     */
+    class Scheduler
+    {
+        public:
+            Scheduler(const unsigned int rate = CONTROL_RATE);
+            void set_rate(const unsigned int rate);
+            void wait();
+            void idle();
+            unsigned int ticks() const;
+            unsigned int overruns() const;
+            void dump() const;
+        private:
+            unsigned long long int _period;
+            unsigned long long int _next;
+            unsigned int _ticks;
+            unsigned int _overruns;
+            unsigned long long int _worst_overrun;
+    };
+}
+
+#endif /* LIBIDP_SCHEDULER_H */
+
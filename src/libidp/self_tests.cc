@@ -16,6 +16,7 @@
 #include "navigation.h"
 #include "line_following.h"
 #include "clamp_control.h"
+#include "odometry.h"
 
 // Debug functionality
 #define MODULE_NAME "SelfTests"
@@ -31,12 +32,18 @@ namespace IDP {
      * Completely seperate to mission supervisor and initialises own
      * link to robot, with its own HAL instance
      * \param robot Which robot to link to, or 0 if embedded
+     * \param backend Which HAL backend to drive
+     * \param record Whether to record the link traffic
+     * \param async Whether to run the link on its own I/O thread
      */
-    SelfTests::SelfTests(int robot = 0): _robot(robot), _hal(0)
+    SelfTests::SelfTests(int robot = 0, const HALBackend backend,
+        const bool record, const bool async): _robot(robot), _hal(0)
     {
-        TRACE("SelfTests("<<robot<<")");
+        TRACE("SelfTests("<<robot<<", "<<backend<<", "<<record<<", "<<
+            async<<")");
         INFO("Initialising SelfTests");
-        this->_hal = new HardwareAbstractionLayer(robot);
+        this->_hal = new HardwareAbstractionLayer(robot, async, backend,
+            record);
     }
 
     /**
@@ -56,7 +63,7 @@ namespace IDP {
     {
         TRACE("drive_forward()");
         INFO("Driving forwards");
-        this->_hal->motors_forward(127);
+        this->_hal->set_wheels(127, 127);
         usleep(1000000);
         this->_hal->motors_stop();
         INFO("Finished driving.");
@@ -69,7 +76,7 @@ namespace IDP {
     {
         TRACE("drive_backwardi()");
         INFO("Driving backwards");
-        this->_hal->motors_backward(127);
+        this->_hal->set_wheels(-127, -127);
         usleep(1000000);
         this->_hal->motors_stop();
         INFO("Finished driving.");
@@ -93,8 +100,7 @@ namespace IDP {
     {
         TRACE("turn_left()");
         INFO("Turning left, both wheels driven");
-        this->_hal->motor_left_backward(64);
-        this->_hal->motor_right_forward(64);
+        this->_hal->set_wheels(-64, 64);
         usleep(1000000);
         this->_hal->motors_stop();
         INFO("Finished driving.");
@@ -108,8 +114,7 @@ namespace IDP {
     {
         TRACE("turn_right()");
         INFO("Turning right, both wheels driven");
-        this->_hal->motor_left_forward(64);
-        this->_hal->motor_right_backward(64);
+        this->_hal->set_wheels(64, -64);
         usleep(1000000);
         this->_hal->motors_stop();
         INFO("Finished driving.");
@@ -123,8 +128,7 @@ namespace IDP {
     {
         TRACE("steer_left()");
         INFO("Turning left, only left wheel driven");
-        this->_hal->motor_right_forward(127);
-        this->_hal->motor_left_forward(0);
+        this->_hal->set_wheels(0, 127);
         usleep(1000000);
         this->_hal->motors_stop();
         INFO("Finished driving.");
@@ -138,8 +142,7 @@ namespace IDP {
     {
         TRACE("steer_right()");
         INFO("Turning right, only left wheel driven");
-        this->_hal->motor_left_forward(127);
-        this->_hal->motor_right_forward(0);
+        this->_hal->set_wheels(127, 0);
         usleep(1000000);
         this->_hal->motors_stop();
         INFO("Finished driving.");
@@ -206,6 +209,7 @@ namespace IDP {
         // Read without LEDs
         this->_hal->colour_LED(false);
         this->_hal->bad_bobbin_LED(false);
+        this->_hal->flush();
         reading = this->_hal->colour_ldr();
         std::cout << "* No lights, colour: " << reading << std::endl;
         reading = this->_hal->bad_bobbin_ldr();
@@ -214,6 +218,7 @@ namespace IDP {
         // Again with colour LED
         this->_hal->colour_LED(true);
         this->_hal->bad_bobbin_LED(false);
+        this->_hal->flush();
         reading = this->_hal->colour_ldr();
         std::cout << "* Colour LED, colour: " << reading << std::endl;
         reading = this->_hal->bad_bobbin_ldr();
@@ -222,6 +227,7 @@ namespace IDP {
         // Now with the badness LED
         this->_hal->colour_LED(false);
         this->_hal->bad_bobbin_LED(true);
+        this->_hal->flush();
         reading = this->_hal->colour_ldr();
         std::cout << "* Badness LED, colour: " << reading << std::endl;
         reading = this->_hal->bad_bobbin_ldr();
@@ -230,6 +236,7 @@ namespace IDP {
         // And finally with both
         this->_hal->colour_LED(true);
         this->_hal->bad_bobbin_LED(true);
+        this->_hal->flush();
         reading = this->_hal->colour_ldr();
         std::cout << "* Both LEDs, colour: " << reading << std::endl;
         reading = this->_hal->bad_bobbin_ldr();
@@ -237,6 +244,7 @@ namespace IDP {
 
         this->_hal->colour_LED(false);
         this->_hal->bad_bobbin_LED(false);
+        this->_hal->flush();
         std::cout << "Done." << std::endl;
     }
 
@@ -249,15 +257,19 @@ namespace IDP {
         INFO("Testing actuators");
         std::cout << "Closing jaw..." << std::endl;
         this->_hal->grabber_jaw(true);
+        this->_hal->flush();
         usleep(1000000);
         std::cout << "Opening jaw..." << std::endl;
         this->_hal->grabber_jaw(false);
+        this->_hal->flush();
         usleep(1000000);
         std::cout << "Raising arm..." << std::endl;
         this->_hal->grabber_lift(true);
+        this->_hal->flush();
         usleep(1000000);
         std::cout << "Lowing arm..." << std::endl;
         this->_hal->grabber_lift(false);
+        this->_hal->flush();
     }
 
     /**
@@ -276,7 +288,8 @@ namespace IDP {
         INFO("following a line");
         do {
             status = lf.follow_line();
-        } while(status == ACTION_IN_PROGRESS);
+        } while(status == ACTION_IN_PROGRESS &&
+            !this->_hal->replay_finished());
     }
 
     /**
@@ -366,9 +379,15 @@ namespace IDP {
 
         std::getchar();
 
-        for(;;) {
-
-            bool present = cc.bobbin_present();
+        // Each check takes several ticks, so only report changes
+        bool present = cc.bobbin_present(this->_hal->sample());
+        std::cout << (present ? "Bobbin found!" : "No bobbin found.")
+            << std::endl;
+        while(!this->_hal->replay_finished()) {
+            bool now = cc.bobbin_present(this->_hal->sample());
+            if(now == present)
+                continue;
+            present = now;
 
             if(present)
                 std::cout << "Bobbin found!" << std::endl;
@@ -397,8 +416,15 @@ namespace IDP {
 
         std::getchar();
 
-        for(;;) {
-            bool present = cc.box_present();
+        // Each check takes several ticks, so only report changes
+        bool present = cc.box_present(this->_hal->sample());
+        std::cout << (present ? "Box found!" : "No box found.") << std::endl;
+        while(!this->_hal->replay_finished()) {
+            bool now = cc.box_present(this->_hal->sample());
+            if(now == present)
+                continue;
+            present = now;
+
             if(present)
                 std::cout << "Box found!" << std::endl;
             else
@@ -437,7 +463,8 @@ namespace IDP {
         NavigationStatus status;
         do {
             status = nav.go_node(target);
-        } while(status == NAVIGATION_ENROUTE);
+        } while(status == NAVIGATION_ENROUTE &&
+            !this->_hal->replay_finished());
 
         this->_hal->motors_stop();
         return;
@@ -460,7 +487,8 @@ namespace IDP {
         NavigationStatus status;
         do {
             status = nav.find_bobbin();
-        } while(status == NAVIGATION_ENROUTE);
+        } while(status == NAVIGATION_ENROUTE &&
+            !this->_hal->replay_finished());
 
         this->_hal->motors_stop();
 
@@ -504,7 +532,8 @@ namespace IDP {
         NavigationStatus status;
         do {
             status = nav.find_box_for_pickup(box);
-        } while(status == NAVIGATION_ENROUTE);
+        } while(status == NAVIGATION_ENROUTE &&
+            !this->_hal->replay_finished());
 
         this->_hal->motors_stop();
 
@@ -548,7 +577,8 @@ namespace IDP {
         NavigationStatus status;
         do {
             status = nav.find_box_for_drop(box);
-        } while(status == NAVIGATION_ENROUTE);
+        } while(status == NAVIGATION_ENROUTE &&
+            !this->_hal->replay_finished());
 
         this->_hal->motors_stop();
 
@@ -581,7 +611,8 @@ namespace IDP {
         NavigationStatus status;
         do {
             status = nav.go_to_delivery();
-        } while(status == NAVIGATION_ENROUTE);
+        } while(status == NAVIGATION_ENROUTE &&
+            !this->_hal->replay_finished());
 
         this->_hal->motors_stop();
 
@@ -592,7 +623,8 @@ namespace IDP {
 
         do {
             status = nav.finished_delivery();
-        } while(status == NAVIGATION_ENROUTE);
+        } while(status == NAVIGATION_ENROUTE &&
+            !this->_hal->replay_finished());
 
         this->_hal->motors_stop();
         return;
@@ -623,7 +655,8 @@ namespace IDP {
         NavigationStatus status;
         do {
             status = nav.go_to_delivery();
-        } while(status == NAVIGATION_ENROUTE);
+        } while(status == NAVIGATION_ENROUTE &&
+            !this->_hal->replay_finished());
 
         this->_hal->motors_stop();
 
@@ -631,11 +664,13 @@ namespace IDP {
 
         do {
             status = nav.finished_delivery();
-        } while(status == NAVIGATION_ENROUTE);
+        } while(status == NAVIGATION_ENROUTE &&
+            !this->_hal->replay_finished());
 
         do {
             status = nav.go_node(NODE4);
-        } while(status == NAVIGATION_ENROUTE);
+        } while(status == NAVIGATION_ENROUTE &&
+            !this->_hal->replay_finished());
 
         this->_hal->motors_stop();
         return;
@@ -658,20 +693,28 @@ namespace IDP {
     {
         TRACE("indicator_LEDs()");
         this->_hal->indication_LEDs(false, false, true);
+        this->_hal->flush();
         usleep(500000);
         this->_hal->indication_LEDs(false, true, false);
+        this->_hal->flush();
         usleep(500000);
         this->_hal->indication_LEDs(false, true, true);
+        this->_hal->flush();
         usleep(500000);
         this->_hal->indication_LEDs(true, false, false);
+        this->_hal->flush();
         usleep(500000);
         this->_hal->indication_LEDs(true, false, true);
+        this->_hal->flush();
         usleep(500000);
         this->_hal->indication_LEDs(true, true, false);
+        this->_hal->flush();
         usleep(500000);
         this->_hal->indication_LEDs(true, true, true);
+        this->_hal->flush();
         usleep(500000);
         this->_hal->indication_LEDs(false, false, false);
+        this->_hal->flush();
         usleep(500000);
     }
 
@@ -683,8 +726,10 @@ namespace IDP {
     {
         TRACE("colour_sensor_LEDs()");
         this->_hal->colour_LED(true);
+        this->_hal->flush();
         usleep(100000);
         this->_hal->colour_LED(false);
+        this->_hal->flush();
     }
 
     /**
@@ -694,8 +739,10 @@ namespace IDP {
     {
         TRACE("bad_bobbin_LED()");
         this->_hal->bad_bobbin_LED(true);
+        this->_hal->flush();
         usleep(500000);
         this->_hal->bad_bobbin_LED(false);
+        this->_hal->flush();
         usleep(500000);
     }
 
@@ -867,4 +914,98 @@ namespace IDP {
         std::cout << "Wrote file" << std::endl;
 
     }
+
+    /**
+     * Measure the robot's dimensions for the odometry, by driving straight
+     * and then spinning on the spot and asking how far it really went.
+     * The result is written to ODOMETRY_FILE for the next run.
+     */
+    void SelfTests::calibrate_odometry()
+    {
+        TRACE("calibrate_odometry()");
+        INFO("Calibrating odometry");
+        const Odometry& odometry = this->_hal->odometry();
+
+        std::cout << "Place Fluffy with a metre clear ahead of it and "
+            << "press enter." << std::endl;
+        std::getchar();
+        if(!this->drive_for(ODOMETRY_CALIBRATION_SPEED,
+            ODOMETRY_CALIBRATION_SPEED, ODOMETRY_CALIBRATION_TIME))
+            return;
+        const double estimated_distance = odometry.distance();
+
+        double distance;
+        std::cout << "Odometry says " << estimated_distance << "mm, enter "
+            << "how far Fluffy drove in mm: ";
+        std::cin >> distance;
+        std::getchar();
+
+        std::cout << "Place Fluffy with room to spin on the spot and press "
+            << "enter." << std::endl;
+        std::getchar();
+        if(!this->drive_for(-ODOMETRY_CALIBRATION_SPEED,
+            ODOMETRY_CALIBRATION_SPEED, ODOMETRY_CALIBRATION_TIME))
+            return;
+        const double estimated_angle = odometry.heading() * 180.0 / 3.1416;
+
+        double angle;
+        std::cout << "Odometry says " << estimated_angle << " degrees, "
+            << "enter how far Fluffy turned anticlockwise in degrees: ";
+        std::cin >> angle;
+        std::getchar();
+
+        if(distance <= 0 || angle <= 0 || estimated_distance <= 0 ||
+            estimated_angle <= 0)
+        {
+            ERROR("Distances and angles must be positive, not calibrating");
+            return;
+        }
+
+        // Distance scales with the speed constant, and the angle turned
+        // goes as that over the wheel base
+        const double mm_per_speed_unit = odometry.mm_per_speed_unit() *
+            distance / estimated_distance;
+        const double wheel_base = odometry.wheel_base() *
+            mm_per_speed_unit / odometry.mm_per_speed_unit() *
+            estimated_angle / angle;
+
+        Odometry calibrated;
+        calibrated.calibrate(mm_per_speed_unit, wheel_base,
+            odometry.ramp_time_unit());
+        if(calibrated.save(ODOMETRY_FILE))
+            std::cout << "Wrote " << mm_per_speed_unit << "mm per speed "
+                << "unit and a " << wheel_base << "mm wheel base to "
+                << ODOMETRY_FILE << std::endl;
+    }
+
+    /**
+     * Drive the wheels for a while from a known place, sampling so the
+     * odometry follows, then stop and let the motors ramp down.
+     * \param left The left wheel speed
+     * \param right The right wheel speed
+     * \param duration How long to drive for, in microseconds
+     * \returns false if a replay ran out first
+     */
+    bool SelfTests::drive_for(const int left, const int right,
+        const unsigned long long int duration)
+    {
+        TRACE("drive_for(" << left << ", " << right << ", " << duration <<
+            ")");
+        this->_hal->reset_odometry();
+        this->_hal->set_wheels(left, right);
+
+        const unsigned long long int start = this->_hal->sample().timestamp;
+        bool stopped = false;
+        while(!this->_hal->replay_finished()) {
+            const unsigned long long int elapsed =
+                this->_hal->sample().timestamp - start;
+            if(elapsed >= duration + ODOMETRY_CALIBRATION_SETTLE)
+                return true;
+            if(elapsed >= duration && !stopped) {
+                this->_hal->motors_stop();
+                stopped = true;
+            }
+        }
+        return false;
+    }
 }
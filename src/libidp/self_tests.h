@@ -13,9 +13,27 @@
 
 #include <robot_link.h>
 
+// Required for HALBackend
+#include "hal.h"
+
 namespace IDP {
 
-    class HardwareAbstractionLayer;
+    /**
+     * Wheel speed the odometry calibration drives and spins at.
+     */
+    const int ODOMETRY_CALIBRATION_SPEED = 64;
+
+    /**
+     * How long the odometry calibration drives or spins for, in
+     * microseconds.
+     */
+    const unsigned long long int ODOMETRY_CALIBRATION_TIME = 3000000;
+
+    /**
+     * How long the odometry calibration waits after stopping for the
+     * motors to ramp down, in microseconds.
+     */
+    const unsigned long long int ODOMETRY_CALIBRATION_SETTLE = 1000000;
 
     /**
      * Execute a variety of functionality self tests
@@ -23,7 +41,8 @@ namespace IDP {
     class SelfTests
     {
         public:
-            SelfTests(int robot);
+            SelfTests(int robot, const HALBackend backend = HAL_BACKEND_LINK,
+                const bool record = false, const bool async = false);
             ~SelfTests();
             void drive_forward(void);
             void drive_backward(void);
@@ -53,7 +72,10 @@ namespace IDP {
             void colour_sensor_LEDs(void);
             void bad_bobbin_LED(void);
             void calibrate(void);
+            void calibrate_odometry(void);
         private:
+            bool drive_for(const int left, const int right,
+                const unsigned long long int duration);
             int _robot;
             HardwareAbstractionLayer* _hal;
     };
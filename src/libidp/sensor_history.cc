@@ -0,0 +1,119 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// sensor_history.cc
+// Sensor History class implementation
+
+#include "line_following.h"
+#include "sensor_history.h"
+
+// Debug functionality
+#define MODULE_NAME "SensorHist"
+#define TRACE_ENABLED   false
+#define DEBUG_ENABLED   false
+#define INFO_ENABLED    true
+#define ERROR_ENABLED   true
+#include "debug.h"
+
+namespace IDP {
+
+    /**
+     * Start with an empty history.
+     */
+    SensorHistory::SensorHistory(): _head(0), _count(0), _last_junction(0)
+    {
+        TRACE("SensorHistory()");
+    }
+
+    /**
+     * Add the newest sensor state, dropping the oldest if full.
+     * \param timestamp When the state was sampled, in microseconds
+     * \param nibble The line sensors as a nibble of SENSOR_ bits
+     */
+    void SensorHistory::push(const unsigned long long int timestamp,
+        const unsigned char nibble)
+    {
+        this->_entries[this->_head].timestamp = timestamp;
+        this->_entries[this->_head].nibble = nibble;
+        this->_head = (this->_head + 1) % SENSOR_HISTORY_SIZE;
+        if(this->_count < SENSOR_HISTORY_SIZE)
+            this->_count++;
+    }
+
+    /**
+     * How many states are held.
+     * \returns The number of states, at most SENSOR_HISTORY_SIZE
+     */
+    unsigned int SensorHistory::size() const
+    {
+        return this->_count;
+    }
+
+    /**
+     * Look up a state by age.
+     * \param age How many states ago, 0 for the newest. Must be less than
+     * size().
+     * \returns The state
+     */
+    const SensorHistoryEntry& SensorHistory::at(const unsigned int age) const
+    {
+        return this->_entries[(this->_head + SENSOR_HISTORY_SIZE - 1 - age)
+            % SENSOR_HISTORY_SIZE];
+    }
+
+    /**
+     * Check whether we have just driven over a junction.
+     *
+     * Frames with an outer sensor on the line make up the junction, and
+     * those with both inner sensors on the line as well show which turns
+     * it has. Frames where the inner sensors came off the line only show
+     * that we drifted, so say nothing about the turns.
+     *
+     * \param min_frames How many frames must show a turn with both inner
+     * sensors on the line to count as a junction
+     * \returns SENSOR_OUTER_LEFT and/or SENSOR_OUTER_RIGHT for each turn
+     * at a junction we have just got past, or 0 if there is no junction
+     * or it has already been reported
+     */
+    unsigned char SensorHistory::passed_junction(
+        const unsigned int min_frames)
+    {
+        TRACE("passed_junction(" << min_frames << ")");
+
+        const unsigned char inner = SENSOR_LINE_LEFT | SENSOR_LINE_RIGHT;
+        const unsigned char outer = SENSOR_OUTER_LEFT | SENSOR_OUTER_RIGHT;
+
+        // Skip back over the frames since the outer sensors fell
+        unsigned int age = 0;
+        while(age < this->_count && !(this->at(age).nibble & outer))
+            age++;
+        if(age < JUNCTION_CLEAR_FRAMES || age == this->_count)
+            return 0;
+
+        // The last frame of a junction we have already reported
+        unsigned long long int end = this->at(age).timestamp;
+        if(end == this->_last_junction)
+            return 0;
+
+        // Work back to where the outer sensors rose
+        unsigned char turns = 0;
+        unsigned int frames = 0;
+        while(age < this->_count && (this->at(age).nibble & outer)) {
+            unsigned char nibble = this->at(age).nibble;
+            if((nibble & inner) == inner) {
+                turns |= nibble & outer;
+                frames++;
+            }
+            age++;
+        }
+
+        if(frames < min_frames)
+            return 0;
+
+        DEBUG("Passed a junction with turns " << static_cast<int>(turns) <<
+            " over " << frames << " frames");
+        this->_last_junction = end;
+        return turns;
+    }
+}
+
@@ -0,0 +1,64 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// sensor_history.h
+// Sensor History class definition
+//
+// Sensor History - a ring buffer of recent line sensor states, and a
+// matcher for the junctions we have driven over
+
+#pragma once
+#ifndef LIBIDP_SENSOR_HISTORY_H
+#define LIBIDP_SENSOR_HISTORY_H
+
+namespace IDP {
+
+    /**
+     * How many frames the sensor history holds. At 200Hz this is over half
+     * a second, enough to hold a whole junction even at slow speeds.
+     */
+    const unsigned int SENSOR_HISTORY_SIZE = 128;
+
+    /**
+     * How many frames with neither outer sensor on the line must follow a
+     * junction before we count ourselves past it.
+     */
+    const unsigned int JUNCTION_CLEAR_FRAMES = 2;
+
+    /**
+     * One line sensor state and when it was seen.
+     */
+    struct SensorHistoryEntry
+    {
+        unsigned long long int timestamp;
+        unsigned char nibble;
+    };
+
+    /**
+     * Keep the most recent line sensor states, oldest overwritten first.
+     *
+     * passed_junction() looks for the signature of driving over a
+     * junction: an outer sensor rising and then falling again while the
+     * inner sensors stay on the line, followed by JUNCTION_CLEAR_FRAMES
+     * frames with both outer sensors clear. Each junction is reported
+     * once, as soon as the robot is past it.
+     */
+    class SensorHistory
+    {
+        public:
+            SensorHistory();
+            void push(const unsigned long long int timestamp,
+                const unsigned char nibble);
+            unsigned int size() const;
+            const SensorHistoryEntry& at(const unsigned int age) const;
+            unsigned char passed_junction(const unsigned int min_frames);
+        private:
+            SensorHistoryEntry _entries[SENSOR_HISTORY_SIZE];
+            unsigned int _head;
+            unsigned int _count;
+            unsigned long long int _last_junction;
+    };
+}
+
+#endif /* LIBIDP_SENSOR_HISTORY_H */
+
@@ -0,0 +1,167 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// sim_link.cc
+// Simulated Link class implementation
+
+#include "sim_link.h"
+
+#include <cmath>
+
+// Debug functionality
+#define MODULE_NAME "SimLink"
+#define TRACE_ENABLED   false
+#define DEBUG_ENABLED   false
+#define INFO_ENABLED    true
+#define ERROR_ENABLED   true
+#include "debug.h"
+
+namespace IDP {
+
+    /**
+     * Place the simulated robot stationary on the line, a little way
+     * before the first junction.
+     */
+    SimulatedLink::SimulatedLink(): _x(100.0), _y(0.0), _heading(0.0),
+        _time(0.0), _motor_1(0), _motor_2(0), _port7(0xFF)
+    {
+        TRACE("SimulatedLink()");
+        INFO("Using the simulated robot");
+    }
+
+    /**
+     * Apply a command to the simulated robot.
+     * \param cmd The command opcode
+     * \param arg The command argument
+     * \returns true, as the simulated link never fails
+     */
+    bool SimulatedLink::command(const command_instruction cmd, const int arg)
+    {
+        TRACE("command(" << cmd << ", " << arg << ")");
+
+        if(cmd == MOTOR_1_GO) {
+            this->_motor_1 = arg;
+        } else if(cmd == MOTOR_2_GO) {
+            this->_motor_2 = arg;
+        } else if(cmd == BOTH_MOTORS_GO_SAME) {
+            this->_motor_1 = this->_motor_2 = arg;
+        } else if(cmd == BOTH_MOTORS_GO_OPPOSITE) {
+            this->_motor_1 = arg;
+            this->_motor_2 = (arg & 0x7F) ? (arg ^ (1<<7)) : 0;
+        } else if(cmd == WRITE_PORT_7) {
+            this->_port7 = arg;
+        }
+
+        return true;
+    }
+
+    /**
+     * Answer a request from the simulated robot. Reading port 0 advances
+     * the simulation by one time step.
+     * \param req The request opcode
+     * \returns The simulated response
+     */
+    int SimulatedLink::request(const request_instruction req)
+    {
+        TRACE("request(" << req << ")");
+
+        if(req == READ_PORT_0) {
+            this->step();
+            return this->read_port0();
+        } else if(req == READ_PORT_7) {
+            return this->_port7;
+        } else if(req == ADC0 || req == ADC1) {
+            // Nothing in the jaw and the LEDs make no difference
+            return 128;
+        } else {
+            // STATUS and everything else reads as clear
+            return 0;
+        }
+    }
+
+    /**
+     * Batched request, as robot_link::operator>>.
+     * \param req The request, whose parameter is filled with the response
+     * \returns This SimulatedLink, for chaining
+     */
+    SimulatedLink& SimulatedLink::operator>>(robot_request& req)
+    {
+        req.parameter = static_cast<unsigned char>(this->request(req.opcode));
+        return *this;
+    }
+
+    /**
+     * The simulated time, which only advances as the sensors are read.
+     * \returns Simulated microseconds since construction
+     */
+    unsigned long long int SimulatedLink::timestamp() const
+    {
+        return static_cast<unsigned long long int>(this->_time * 1e6 + 0.5);
+    }
+
+    /**
+     * Advance the robot's position by SIM_TIME_STEP at the current wheel
+     * speeds.
+     */
+    void SimulatedLink::step()
+    {
+        // The left motor drives forwards with bit 7 set and the right
+        // motor with bit 7 clear, as they face each other.
+        double left = (this->_motor_1 & 0x7F) * SIM_MM_PER_SPEED_UNIT;
+        double right = (this->_motor_2 & 0x7F) * SIM_MM_PER_SPEED_UNIT;
+        if(!(this->_motor_1 & (1<<7)))
+            left = -left;
+        if(this->_motor_2 & (1<<7))
+            right = -right;
+
+        double speed = (left + right) / 2.0;
+        double turn_rate = (right - left) / SIM_WHEEL_BASE;
+
+        this->_x += speed * std::cos(this->_heading) * SIM_TIME_STEP;
+        this->_y += speed * std::sin(this->_heading) * SIM_TIME_STEP;
+        this->_heading += turn_rate * SIM_TIME_STEP;
+        this->_time += SIM_TIME_STEP;
+
+        DEBUG("At " << this->_x << ", " << this->_y << " heading " <<
+            this->_heading);
+    }
+
+    /**
+     * Check whether a line sensor can see a line.
+     * \param offset The sensor's lateral offset from the centreline
+     * \returns true if the sensor is over the main line or a branch
+     */
+    bool SimulatedLink::sees_line(const double offset) const
+    {
+        double c = std::cos(this->_heading);
+        double s = std::sin(this->_heading);
+        double sensor_x = this->_x + SIM_SENSOR_AHEAD * c - offset * s;
+        double sensor_y = this->_y + SIM_SENSOR_AHEAD * s + offset * c;
+
+        if(std::fabs(sensor_y) < SIM_LINE_WIDTH / 2.0)
+            return true;
+
+        // Branches cross the line at every multiple of the spacing
+        double junction = std::floor(sensor_x / SIM_JUNCTION_SPACING + 0.5)
+            * SIM_JUNCTION_SPACING;
+        return junction > 0.0 &&
+            std::fabs(sensor_x - junction) < SIM_LINE_WIDTH / 2.0 &&
+            std::fabs(sensor_y) < SIM_BRANCH_LENGTH;
+    }
+
+    /**
+     * Build the port 0 value for the current position.
+     * \returns Line sensors in bits 0 to 3, high when seeing a line, and
+     * both switches released
+     */
+    int SimulatedLink::read_port0() const
+    {
+        int port = 0xF0;
+        for(int i = 0; i < 4; i++) {
+            if(this->sees_line(SIM_SENSOR_OFFSETS[i]))
+                port |= 1<<i;
+        }
+        return port;
+    }
+}
+
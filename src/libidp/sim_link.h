@@ -0,0 +1,91 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// sim_link.h
+// Simulated Link class definition
+//
+// Simulated Link - an in-process stand in for robot_link which models the
+// robot driving on a straight line with regularly spaced junctions
+
+#pragma once
+#ifndef LIBIDP_SIM_LINK_H
+#define LIBIDP_SIM_LINK_H
+
+#include <robot_instr.h>
+
+namespace IDP {
+
+    /**
+     * Simulated time that passes between each read of the sensor port,
+     * in seconds. Matches the control loop period.
+     */
+    const double SIM_TIME_STEP = 0.005;
+
+    /**
+     * Ground speed of a wheel per unit of motor speed, in mm/s.
+     */
+    const double SIM_MM_PER_SPEED_UNIT = 2.0;
+
+    /**
+     * Distance between the two drive wheels, in mm.
+     */
+    const double SIM_WHEEL_BASE = 200.0;
+
+    /**
+     * Distance from the wheel axle forward to the line sensors, in mm.
+     */
+    const double SIM_SENSOR_AHEAD = 60.0;
+
+    /**
+     * Lateral position of each line sensor from the centreline, left
+     * positive, in mm. Ordered as in LineSensors.
+     */
+    const double SIM_SENSOR_OFFSETS[4] = {30.0, 8.0, -8.0, -30.0};
+
+    /**
+     * Width of the white line, in mm.
+     */
+    const double SIM_LINE_WIDTH = 19.0;
+
+    /**
+     * Distance between junctions along the simulated line, in mm.
+     */
+    const double SIM_JUNCTION_SPACING = 600.0;
+
+    /**
+     * How far each junction branch extends either side of the line, in mm.
+     */
+    const double SIM_BRANCH_LENGTH = 300.0;
+
+    /**
+     * A robot_link replacement which simulates the robot in-process.
+     *
+     * The robot starts centred on a straight line running along the x
+     * axis, which is crossed by a branch line every SIM_JUNCTION_SPACING.
+     * Motor commands set the wheel speeds, and each read of port 0
+     * advances the simulation by SIM_TIME_STEP.
+     */
+    class SimulatedLink
+    {
+        public:
+            SimulatedLink();
+            bool command(const command_instruction cmd, const int arg);
+            int request(const request_instruction req);
+            SimulatedLink& operator>>(robot_request& req);
+            unsigned long long int timestamp() const;
+        private:
+            void step();
+            bool sees_line(const double offset) const;
+            int read_port0() const;
+            double _x;
+            double _y;
+            double _heading;
+            double _time;
+            int _motor_1;
+            int _motor_2;
+            int _port7;
+    };
+}
+
+#endif /* LIBIDP_SIM_LINK_H */
+
@@ -6,6 +6,7 @@
 //
 
 #include "status_watchdog.h"
+#include "hal.h"
 
 // Debug functionality
 #define MODULE_NAME "StatusWatch"
@@ -17,11 +18,64 @@
 
 namespace IDP {
     /**
-     * Read the STATUS register of the microcontroller and return the value
-     * \returns The error encountered, if any 
+     * Start with no events pending.
+     * \param decode_faults Whether to decode the fault bits of STATUS
+     * readings, which the HAL leaves to STATUS_DECODE_FAULTS
      */
-    int StatusWatchdog::check() const {
-        TRACE("check()");
-        return 0;
+    StatusWatchdog::StatusWatchdog(const bool decode_faults):
+        _decode_faults(decode_faults), _events(STATUS_EVENT_NONE)
+    {
+        TRACE("StatusWatchdog(" << decode_faults << ")");
+    }
+
+    /**
+     * Decode a frame's STATUS reading, if it has one and fault decoding
+     * is on, and raise an event for each fault
+     * found, along with any link failure.
+     * \param frame The newly sampled frame
+     * \param link_ok false if the link failed while sampling it
+     * \returns The events raised by this frame
+     */
+    int StatusWatchdog::check(const SensorFrame& frame, const bool link_ok)
+    {
+        TRACE("check(frame, " << link_ok << ")");
+        int events = STATUS_EVENT_NONE;
+
+        if(!link_ok)
+            events |= STATUS_EVENT_LINK_ERROR;
+
+        if(this->_decode_faults && frame.status_read) {
+            if(frame.status & STATUS_EMERGENCY_STOP)
+                events |= STATUS_EVENT_EMERGENCY_STOP;
+            if(frame.status & STATUS_MOTOR_FAULT)
+                events |= STATUS_EVENT_MOTOR_FAULT;
+            if(frame.status & STATUS_COMMS_FAULT)
+                events |= STATUS_EVENT_LINK_ERROR;
+        }
+
+        if(events) {
+            DEBUG("Raising events " << events << " from STATUS " <<
+                static_cast<int>(frame.status));
+            __sync_fetch_and_or(&this->_events, events);
+        }
+        return events;
+    }
+
+    /**
+     * Collect and clear every pending event.
+     * \returns The pending StatusEvent flags
+     */
+    int StatusWatchdog::take_events()
+    {
+        return __sync_fetch_and_and(&this->_events, STATUS_EVENT_NONE);
+    }
+
+    /**
+     * Look at the pending events without clearing them.
+     * \returns The pending StatusEvent flags
+     */
+    int StatusWatchdog::pending_events() const
+    {
+        return this->_events;
     }
 }
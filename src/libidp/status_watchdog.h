@@ -8,20 +8,70 @@
 // errors that may arise
 
 #pragma once
-#ifndef LIBIDP_H
-#define LIBIDP_H
+#ifndef LIBIDP_STATUS_WATCHDOG_H
+#define LIBIDP_STATUS_WATCHDOG_H
 
 namespace IDP {
 
+    struct SensorFrame;
+
+    /**
+     * Whether to decode the fault bits of the STATUS register. The bit
+     * layout below is a guess which has not been checked against the
+     * microcontroller, and neither robot_instr.h nor the robot_link
+     * documentation describe it, so this stays off until it has been
+     * tried on the robot. Link errors are still raised either way.
+     */
+    const bool STATUS_DECODE_FAULTS = false;
+
+    /**
+     * STATUS register bit set when the emergency stop has fired.
+     * Unverified, see STATUS_DECODE_FAULTS.
+     */
+    const int STATUS_EMERGENCY_STOP = (1<<7);
+
+    /**
+     * STATUS register bit set when a motor driver reports a fault.
+     * Unverified, see STATUS_DECODE_FAULTS.
+     */
+    const int STATUS_MOTOR_FAULT = (1<<6);
+
+    /**
+     * STATUS register bits set on a communications error on the robot.
+     * Unverified, see STATUS_DECODE_FAULTS.
+     */
+    const int STATUS_COMMS_FAULT = 0x0F;
+
+    /**
+     * Events the watchdog can raise. Several may be pending at once, so
+     * these are bit flags.
+     */
+    enum StatusEvent {
+        STATUS_EVENT_NONE = 0,
+        STATUS_EVENT_EMERGENCY_STOP = (1<<0),
+        STATUS_EVENT_MOTOR_FAULT = (1<<1),
+        STATUS_EVENT_LINK_ERROR = (1<<2)
+    };
+
     /**
      * Polls the STATUS register of the microcontroller any handles
      * any errors that may arise
+     *
+     * The HAL passes each sampled frame to check(), which raises events
+     * into a lock-free flag word. Whoever handles them collects them with
+     * take_events(), from any thread.
      */
     class StatusWatchdog {
         public:
-            int check() const;
+            StatusWatchdog(const bool decode_faults = STATUS_DECODE_FAULTS);
+            int check(const SensorFrame& frame, const bool link_ok);
+            int take_events();
+            int pending_events() const;
+        private:
+            const bool _decode_faults;
+            volatile int _events;
     };
 }
 
-#endif /* LIBIDP_H */
+#endif /* LIBIDP_STATUS_WATCHDOG_H */
 
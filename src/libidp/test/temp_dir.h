@@ -0,0 +1,75 @@
+// IDP Test Suite
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// temp_dir.h
+// Scratch directory for tests that read or write files
+//
+// Several classes use fixed file names in the current directory, such as
+// levelsfile and turnsfile, which on the robot hold its calibration. Tests
+// run from inside a TempDir so that they never touch the real ones.
+
+#pragma once
+#ifndef LIBIDP_TEST_TEMP_DIR_H
+#define LIBIDP_TEST_TEMP_DIR_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <dirent.h>
+#include <unistd.h>
+
+/**
+ * Make a fresh directory under /tmp and change into it, then change back
+ * and remove it and everything in it when destroyed.
+ */
+class TempDir
+{
+    public:
+        TempDir(): _ok(false)
+        {
+            char cwd[4096];
+            char path[] = "/tmp/idp_testXXXXXX";
+            if(getcwd(cwd, sizeof(cwd)) && mkdtemp(path) &&
+                chdir(path) == 0)
+            {
+                this->_cwd = cwd;
+                this->_path = path;
+                this->_ok = true;
+            }
+        }
+
+        ~TempDir()
+        {
+            if(!this->_ok)
+                return;
+            if(chdir(this->_cwd.c_str()) != 0)
+                return;
+
+            DIR* dir = opendir(this->_path.c_str());
+            if(dir) {
+                struct dirent* entry;
+                while((entry = readdir(dir)) != 0) {
+                    std::string name(entry->d_name);
+                    if(name != "." && name != "..")
+                        std::remove((this->_path + "/" + name).c_str());
+                }
+                closedir(dir);
+            }
+            rmdir(this->_path.c_str());
+        }
+
+        /**
+         * Whether the directory was made and is now the current one.
+         */
+        bool ok() const
+        {
+            return this->_ok;
+        }
+
+    private:
+        bool _ok;
+        std::string _cwd;
+        std::string _path;
+};
+
+#endif /* LIBIDP_TEST_TEMP_DIR_H */
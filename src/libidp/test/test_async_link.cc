@@ -0,0 +1,61 @@
+// IDP Test Suite
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// test_async_link.cc
+// Unit tests for the Asynchronous Link I/O thread
+
+#include <gtest/gtest.h>
+#include <robot_link.h>
+#include <robot_instr.h>
+#include "../async_link.h"
+#include "../hal.h"
+#include "../link_stats.h"
+
+using namespace IDP;
+
+/**
+ * How many commands to queue at once.
+ */
+static const int QUEUED_COMMANDS = 3;
+
+/**
+ * Run an AsyncLink over a robot_link that was never initialised, so that
+ * every exchange fails straight away.
+ */
+class TestAsyncLink : public ::testing::Test
+{
+    public:
+        robot_link rlink;
+        LinkStats stats;
+};
+
+TEST_F(TestAsyncLink, FailedLinkIsReported)
+{
+    AsyncLink link(&this->rlink, &this->stats);
+    ASSERT_TRUE(link.running());
+    EXPECT_TRUE(link.latest().error);
+}
+
+TEST_F(TestAsyncLink, QueuedCommandsAreSent)
+{
+    {
+        AsyncLink link(&this->rlink, &this->stats);
+        ASSERT_TRUE(link.running());
+        for(int i = 0; i < QUEUED_COMMANDS; i++)
+            link.command(MOTOR_1_GO, i);
+    }
+
+    // Stopping the thread sends whatever it had left
+    EXPECT_EQ(static_cast<unsigned int>(QUEUED_COMMANDS),
+        this->stats.count(MOTOR_1_GO));
+}
+
+TEST_F(TestAsyncLink, HALWaitsForTheLinkBeforeGoingAsync)
+{
+    // There is no robot to link to, so the HAL stays synchronous with
+    // the link down rather than starting the I/O thread on a dead link
+    HardwareAbstractionLayer hal(0, true);
+    EXPECT_FALSE(hal.link_up());
+    hal.sample();
+    EXPECT_FALSE(hal.link_up());
+}
@@ -0,0 +1,100 @@
+// IDP Test Suite
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// test_line_following.cc
+// Unit tests for the Line Following action tables
+
+#include <gtest/gtest.h>
+#include "../hal.h"
+#include "../line_following.h"
+
+using namespace IDP;
+
+/**
+ * Build the LineSensors for a sensor nibble.
+ */
+static LineSensors sensors_for(const unsigned int nibble)
+{
+    LineSensors s;
+    s.outer_left = (nibble & SENSOR_OUTER_LEFT) ? LINE : NO_LINE;
+    s.line_left = (nibble & SENSOR_LINE_LEFT) ? LINE : NO_LINE;
+    s.line_right = (nibble & SENSOR_LINE_RIGHT) ? LINE : NO_LINE;
+    s.outer_right = (nibble & SENSOR_OUTER_RIGHT) ? LINE : NO_LINE;
+    return s;
+}
+
+TEST(TestLineFollowing, NibbleRoundTrips)
+{
+    for(unsigned int n = 0; n < SENSOR_STATES; n++)
+        EXPECT_EQ(n, sensor_nibble(sensors_for(n)));
+}
+
+TEST(TestLineFollowing, FollowTableIsExhaustive)
+{
+    for(unsigned int n = 0; n < SENSOR_STATES; n++) {
+        const LineFollowingAction& a = FOLLOW_ACTIONS[n];
+        bool inner = (n & SENSOR_LINE_LEFT) && (n & SENSOR_LINE_RIGHT);
+
+        // Junctions are only reported with both inner sensors on the line
+        if(a.status != ACTION_IN_PROGRESS) {
+            EXPECT_TRUE(inner) << n;
+            EXPECT_EQ(STEER_STRAIGHT, a.steering) << n;
+        }
+
+        // A sensor on one side only means we drifted the other way
+        if(a.steering == STEER_LEFT) {
+            EXPECT_TRUE(n & (SENSOR_LINE_RIGHT | SENSOR_OUTER_RIGHT));
+            EXPECT_FALSE(n & (SENSOR_LINE_LEFT | SENSOR_OUTER_LEFT));
+            EXPECT_GT(a.error, 0);
+        } else if(a.steering == STEER_RIGHT) {
+            EXPECT_TRUE(n & (SENSOR_LINE_LEFT | SENSOR_OUTER_LEFT));
+            EXPECT_FALSE(n & (SENSOR_LINE_RIGHT | SENSOR_OUTER_RIGHT));
+            EXPECT_LT(a.error, 0);
+        } else if(a.steering == STEER_SEARCH) {
+            EXPECT_EQ(0u, n);
+            EXPECT_GT(a.error, EDGE_ERROR);
+        } else {
+            EXPECT_EQ(0, a.error);
+        }
+        EXPECT_NE(STEER_TURN, a.steering) << n;
+    }
+
+    EXPECT_EQ(LEFT_TURN_FOUND, FOLLOW_ACTIONS[0x7].status);
+    EXPECT_EQ(RIGHT_TURN_FOUND, FOLLOW_ACTIONS[0xE].status);
+    EXPECT_EQ(BOTH_TURNS_FOUND, FOLLOW_ACTIONS[0xF].status);
+    EXPECT_EQ(-EDGE_ERROR, FOLLOW_ACTIONS[SENSOR_OUTER_LEFT].error);
+    EXPECT_EQ(EDGE_ERROR, FOLLOW_ACTIONS[SENSOR_OUTER_RIGHT].error);
+}
+
+TEST(TestLineFollowing, TurnTablesAreExhaustive)
+{
+    for(unsigned int d = 0; d < MAX_TURN_DIRECTION; d++) {
+        for(unsigned int n = 0; n < SENSOR_STATES; n++) {
+            const LineFollowingAction& a = TURN_ACTIONS[d][n];
+            bool left = n & SENSOR_LINE_LEFT;
+            bool right = n & SENSOR_LINE_RIGHT;
+
+            LineFollowingLineStatus expected = OTHER;
+            if(n == (SENSOR_LINE_LEFT | SENSOR_LINE_RIGHT))
+                expected = ON_LINE;
+            else if(n == 0)
+                expected = LOST_LINE;
+            else if((d == TURN_LEFT || d == TURN_AROUND_CCW) &&
+                left && !right)
+                expected = ON_LINE;
+            else if(d == TURN_RIGHT && !left && right)
+                expected = ON_LINE;
+            else if(d == TURN_AROUND_CW && (n & SENSOR_OUTER_RIGHT))
+                expected = ON_LINE;
+            else if((d == TURN_LEFT || d == TURN_AROUND_CCW) &&
+                n == SENSOR_OUTER_LEFT)
+                expected = NEAR_LINE;
+            else if(d == TURN_RIGHT && n == SENSOR_OUTER_RIGHT)
+                expected = NEAR_LINE;
+
+            EXPECT_EQ(expected, a.line) << d << ":" << n;
+            EXPECT_EQ(STEER_TURN, a.steering) << d << ":" << n;
+            EXPECT_EQ(ACTION_IN_PROGRESS, a.status) << d << ":" << n;
+        }
+    }
+}
@@ -0,0 +1,125 @@
+// IDP Test Suite
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// test_localiser.cc
+// Unit tests for the Localiser on the built in layout
+
+#include <gtest/gtest.h>
+#include "../localiser.h"
+#include "../navigation_graph.h"
+#include "../odometry.h"
+
+using namespace IDP;
+
+/**
+ * Speed to drive both wheels at, well inside the motor range.
+ */
+static const int DRIVE_SPEED = 100;
+
+/**
+ * Time between odometry updates, in microseconds.
+ */
+static const unsigned long long int DRIVE_TICK = 10000;
+
+/**
+ * Localise on the built in layout with odometry driven straight ahead
+ * by hand.
+ */
+class TestLocaliser : public ::testing::Test
+{
+    public:
+        TestLocaliser(): now(1), localiser(&graph, &odometry)
+        {
+        }
+
+        virtual void SetUp()
+        {
+            this->odometry.update(this->now);
+            this->odometry.command(DRIVE_SPEED, DRIVE_SPEED);
+        }
+
+        /**
+         * Drive straight on along the line.
+         * \param distance How far to drive, in millimetres
+         */
+        void drive(const double distance)
+        {
+            const double end = this->odometry.total() + distance;
+            while(this->odometry.total() < end) {
+                this->now += DRIVE_TICK;
+                this->odometry.update(this->now);
+            }
+        }
+
+        /**
+         * Take a step at the junction last observed.
+         */
+        void move(const NavigationAction action, const NavigationTurn turn)
+        {
+            NavigationStep step = {action, turn, TURN_RIGHT, 0, MAX_NODE,
+                MAX_NODE};
+            this->localiser.move(step);
+        }
+
+        /**
+         * Check where the Localiser thinks the robot most likely is.
+         */
+        void expect_best(const NavigationNode from, const NavigationNode to,
+            const bool false_junction)
+        {
+            NavigationNode best_from, best_to;
+            bool best_false;
+            this->localiser.best(best_from, best_to, best_false);
+            EXPECT_EQ(from, best_from) << NavigationNodeStrings[best_from];
+            EXPECT_EQ(to, best_to) << NavigationNodeStrings[best_to];
+            EXPECT_EQ(false_junction, best_false);
+        }
+
+        unsigned long long int now;
+        NavigationGraph graph;
+        Odometry odometry;
+        Localiser localiser;
+};
+
+TEST_F(TestLocaliser, SeesTheNodeAhead)
+{
+    this->localiser.reset(NODE8, NODE9);
+    this->drive(this->graph.edge(NODE8, NODE9).length);
+    this->localiser.observe(BOTH_TURNS);
+    this->expect_best(NODE8, NODE9, false);
+
+    this->move(STEP_JUNCTION, STRAIGHT);
+    this->expect_best(NODE9, NODE10, false);
+}
+
+TEST_F(TestLocaliser, CatchesUpAfterAMissedJunction)
+{
+    // Drive over node 9 without seeing it, and see node 10 instead
+    this->localiser.reset(NODE8, NODE9);
+    this->drive(this->graph.edge(NODE8, NODE9).length +
+        this->graph.edge(NODE9, NODE10).length);
+    this->localiser.observe(RIGHT_TURN);
+    this->expect_best(NODE9, NODE10, false);
+
+    // Turning right there takes us on to node 11
+    this->move(STEP_JUNCTION, RIGHT);
+    this->expect_best(NODE10, NODE11, false);
+}
+
+TEST_F(TestLocaliser, IgnoresAFalseJunction)
+{
+    // A mark on the table well short of node 10
+    this->localiser.reset(NODE9, NODE10);
+    this->drive(300);
+    this->localiser.observe(BOTH_TURNS);
+    this->expect_best(NODE9, NODE10, true);
+
+    // Carry on straight over it, still heading for node 10
+    this->move(STEP_JUNCTION, STRAIGHT);
+    this->expect_best(NODE9, NODE10, false);
+
+    // The real node 10 is then where it should be
+    this->drive(this->graph.edge(NODE9, NODE10).length - 300);
+    this->localiser.observe(RIGHT_TURN);
+    this->expect_best(NODE9, NODE10, false);
+}
@@ -0,0 +1,104 @@
+// IDP Test Suite
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// test_navigation.cc
+// Unit tests for Navigation on the simulated robot
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <fstream>
+#include "../hal.h"
+#include "../navigation.h"
+#include "../odometry.h"
+#include "../sim_link.h"
+#include "temp_dir.h"
+
+using namespace IDP;
+
+/**
+ * Most ticks any one operation is given before the test gives up.
+ */
+static const int MAX_TICKS = 20000;
+
+/**
+ * How far the robot may turn, in radians, before it counts as turning.
+ */
+static const double TURNING = 0.3;
+
+/**
+ * Drive the simulated robot, which starts on a straight line with
+ * junctions every SIM_JUNCTION_SPACING, having told Navigation it is
+ * heading into the start box at node 8. Runs in a TempDir, so starts
+ * without turn rates learned in earlier runs.
+ */
+class TestNavigation : public ::testing::Test
+{
+    public:
+        TestNavigation(): hal(0, false, HAL_BACKEND_SIMULATOR), nav(0)
+        {
+        }
+
+        virtual void SetUp()
+        {
+            ASSERT_TRUE(this->dir.ok());
+
+            // Levels that never see a bobbin under the simulator's LDRs
+            std::ofstream f("levelsfile");
+            f << "0 0 0 0 0 0 0 0 0 0 255 0\n";
+            f.close();
+
+            this->nav = new Navigation(&this->hal, NODE7, NODE8);
+        }
+
+        virtual void TearDown()
+        {
+            delete this->nav;
+        }
+
+        /**
+         * Run find_box_for_drop() until the robot starts to turn.
+         * \returns How far the robot drove first, in millimetres
+         */
+        double drive_until_turning()
+        {
+            const double start = this->hal.odometry().total();
+            this->hal.reset_odometry();
+            for(int i = 0; i < MAX_TICKS; i++) {
+                if(this->nav->find_box_for_drop(BOX2) != NAVIGATION_ENROUTE)
+                    break;
+                if(std::fabs(this->hal.odometry().heading()) > TURNING)
+                    break;
+            }
+            return this->hal.odometry().total() - start;
+        }
+
+        TempDir dir;
+        HardwareAbstractionLayer hal;
+        Navigation* nav;
+};
+
+TEST_F(TestNavigation, DropAfterArrivingLeavesTheNodeFirst)
+{
+    NavigationStatus status = NAVIGATION_ENROUTE;
+    for(int i = 0; i < MAX_TICKS && status == NAVIGATION_ENROUTE; i++)
+        status = this->nav->go_node(NODE8);
+    ASSERT_EQ(NAVIGATION_ARRIVED, status);
+
+    // Still over node 8, the turn around is at node 9, one junction on
+    EXPECT_GT(this->drive_until_turning(), SIM_JUNCTION_SPACING / 2);
+}
+
+TEST_F(TestNavigation, DropAfterFindBobbinTurnsAtTheNextNode)
+{
+    // Drive into the start box and along the rack past node 9, where
+    // find_bobbin() knows it is between nodes 9 and 10
+    for(int i = 0; i < MAX_TICKS; i++) {
+        ASSERT_EQ(NAVIGATION_ENROUTE, this->nav->find_bobbin());
+        if(this->hal.odometry().distance() > SIM_JUNCTION_SPACING + 100)
+            break;
+    }
+    ASSERT_GT(this->hal.odometry().distance(), SIM_JUNCTION_SPACING);
+
+    // The turn around is at node 10, the junction after that
+    EXPECT_GT(this->drive_until_turning(), SIM_JUNCTION_SPACING / 2);
+}
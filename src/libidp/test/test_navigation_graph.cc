@@ -0,0 +1,236 @@
+// IDP Test Suite
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// test_navigation_graph.cc
+// Unit tests for the Navigation Graph layout and routes
+
+#include <gtest/gtest.h>
+#include <fstream>
+#include "../navigation_graph.h"
+#include "temp_dir.h"
+
+using namespace IDP;
+
+/**
+ * File the tests write layouts to, in a TempDir
+ */
+static const char* const TEST_GRAPH_FILE = "graphfile";
+
+/**
+ * Where the robot went next at each node in each direction before the
+ * node graph, indexed by NavigationDirection and then by NavigationNode.
+ */
+static const NavigationNode OLD_ROUTE_MAP[MAX_DIRECTION][MAX_NODE] = {
+    {NODE2, NODE3, NODE4, NODE5, NODE6, NODE8, NODE8, NODE9, NODE10,
+        NODE11, NODE10},
+    {NODE2, NODE1, NODE2, NODE3, NODE4, NODE5, NODE6, NODE7, NODE8,
+        NODE9, NODE10}
+};
+
+/**
+ * The turn the robot took at each node in each direction before the
+ * node graph, indexed by NavigationDirection and then by NavigationNode.
+ */
+static const NavigationTurn OLD_TURN_MAP[MAX_DIRECTION][MAX_NODE] = {
+    {STRAIGHT, STRAIGHT, STRAIGHT, RIGHT, STRAIGHT, RIGHT, STRAIGHT,
+        STRAIGHT, STRAIGHT, RIGHT, END_OF_LINE},
+    {END_OF_LINE, STRAIGHT, STRAIGHT, LEFT, STRAIGHT, LEFT, STRAIGHT,
+        STRAIGHT, STRAIGHT, LEFT, STRAIGHT}
+};
+
+/**
+ * Work out whether the old route maps drove from one node to another,
+ * which they did heading clockwise towards higher numbered nodes and
+ * anticlockwise towards lower numbered ones.
+ * \param dir The direction of travel
+ * \param from The node behind the robot
+ * \param to Set to the node ahead of it
+ * \returns true if the old route maps had such an edge
+ */
+static bool old_edge(const int dir, const int from, NavigationNode& to)
+{
+    to = OLD_ROUTE_MAP[dir][from];
+    if(dir == NAVIGATION_CLOCKWISE)
+        return to > from;
+    return to < from;
+}
+
+/**
+ * Write a layout for NavigationGraph::load() to read.
+ */
+static void write_graph(const char* layout)
+{
+    std::ofstream f(TEST_GRAPH_FILE);
+    f << layout;
+    f.close();
+}
+
+class TestNavigationGraph : public ::testing::Test
+{
+    public:
+        virtual void SetUp()
+        {
+            ASSERT_TRUE(this->dir.ok());
+        }
+
+        TempDir dir;
+        NavigationGraph graph;
+};
+
+TEST_F(TestNavigationGraph, BuiltInLayoutHasTheOldEdges)
+{
+    for(int dir = 0; dir < MAX_DIRECTION; dir++) {
+        for(int from = 0; from < MAX_NODE; from++) {
+            NavigationNode to;
+            if(!old_edge(dir, from, to))
+                continue;
+            EXPECT_TRUE(this->graph.edge(
+                static_cast<NavigationNode>(from), to).present)
+                << NavigationNodeStrings[from] << " to "
+                << NavigationNodeStrings[to];
+        }
+    }
+}
+
+TEST_F(TestNavigationGraph, ArrivingHeadsOnAsTheOldRouteMap)
+{
+    for(int dir = 0; dir < MAX_DIRECTION; dir++) {
+        for(int from = 0; from < MAX_NODE; from++) {
+            NavigationNode to;
+            if(!old_edge(dir, from, to))
+                continue;
+            const NavigationStep& step = this->graph.route(
+                static_cast<NavigationNode>(from), to, to);
+            EXPECT_EQ(STEP_ARRIVE, step.action)
+                << NavigationNodeStrings[from] << " to "
+                << NavigationNodeStrings[to];
+            EXPECT_EQ(to, step.from);
+            EXPECT_EQ(OLD_ROUTE_MAP[dir][to], step.to)
+                << NavigationNodeStrings[from] << " to "
+                << NavigationNodeStrings[to];
+        }
+    }
+}
+
+TEST_F(TestNavigationGraph, NextNodeTakesTheOldTurn)
+{
+    for(int dir = 0; dir < MAX_DIRECTION; dir++) {
+        for(int from = 0; from < MAX_NODE; from++) {
+            NavigationNode to;
+            if(!old_edge(dir, from, to) || OLD_TURN_MAP[dir][to] ==
+                END_OF_LINE)
+                continue;
+            const NavigationNode next = OLD_ROUTE_MAP[dir][to];
+            const NavigationStep& step = this->graph.route(
+                static_cast<NavigationNode>(from), to, next);
+            EXPECT_EQ(STEP_JUNCTION, step.action)
+                << NavigationNodeStrings[from] << " to "
+                << NavigationNodeStrings[to];
+            EXPECT_EQ(OLD_TURN_MAP[dir][to], step.turn)
+                << NavigationNodeStrings[from] << " to "
+                << NavigationNodeStrings[to];
+            EXPECT_EQ(to, step.from);
+            EXPECT_EQ(next, step.to);
+
+            // The old code skipped a line turning right at node 6
+            unsigned short int skip_lines = 0;
+            if(to == NODE6 && dir == NAVIGATION_CLOCKWISE)
+                skip_lines = 1;
+            EXPECT_EQ(skip_lines, step.skip_lines)
+                << NavigationNodeStrings[from] << " to "
+                << NavigationNodeStrings[to];
+        }
+    }
+}
+
+TEST_F(TestNavigationGraph, EveryNodeIsReachedFromEveryEdge)
+{
+    for(int from = 0; from < MAX_NODE; from++) {
+        for(int to = 0; to < MAX_NODE; to++) {
+            if(!this->graph.edge(static_cast<NavigationNode>(from),
+                static_cast<NavigationNode>(to)).present)
+                continue;
+            for(int target = 0; target < MAX_NODE; target++) {
+                // Follow the route one step at a time
+                NavigationNode f = static_cast<NavigationNode>(from);
+                NavigationNode t = static_cast<NavigationNode>(to);
+                NavigationAction action = STEP_NO_ROUTE;
+                for(int i = 0; i < MAX_NODE * MAX_NODE; i++) {
+                    const NavigationStep& step = this->graph.route(f, t,
+                        static_cast<NavigationNode>(target));
+                    action = step.action;
+                    if(action == STEP_ARRIVE || action == STEP_NO_ROUTE)
+                        break;
+                    f = step.from;
+                    t = step.to;
+                }
+                EXPECT_EQ(STEP_ARRIVE, action)
+                    << NavigationNodeStrings[from] << " to "
+                    << NavigationNodeStrings[to] << " for "
+                    << NavigationNodeStrings[target];
+                EXPECT_EQ(target, t);
+            }
+        }
+    }
+}
+
+TEST_F(TestNavigationGraph, LoadsAValidLayout)
+{
+    write_graph(
+        "# A single line, driven either way\n"
+        "edge 1 2 500 END_OF_LINE\n"
+        "turnaround 1 2 TURN_AROUND_ON_EDGE TURN_AROUND_CW 0 2 1\n"
+        "edge 2 1 500 END_OF_LINE\n"
+        "turnaround 2 1 TURN_AROUND_ON_EDGE TURN_AROUND_CW 0 1 2\n");
+    ASSERT_TRUE(this->graph.load(TEST_GRAPH_FILE));
+
+    EXPECT_EQ(STEP_TURN_AROUND, this->graph.route(NODE1, NODE2,
+        NODE1).action);
+    EXPECT_FALSE(this->graph.edge(NODE5, NODE6).present);
+}
+
+TEST_F(TestNavigationGraph, RejectsAMissingFile)
+{
+    EXPECT_FALSE(this->graph.load("no_such_graphfile"));
+    EXPECT_TRUE(this->graph.edge(NODE5, NODE6).present);
+}
+
+TEST_F(TestNavigationGraph, RejectsBadLayouts)
+{
+    const char* const layouts[] = {
+        // Unknown keyword
+        "edge 1 2 500 END_OF_LINE\n"
+        "bridge 1 2\n",
+        // Node out of range
+        "edge 1 12 500 END_OF_LINE\n",
+        // Unknown junction
+        "edge 1 2 500 CROSSROADS\n",
+        // Missing length
+        "edge 1 2\n",
+        // Exit onto a line that is not there
+        "edge 1 2 500 STRAIGHT\n"
+        "exit 1 2 STRAIGHT 0 3\n",
+        // Turn around onto a line that is not there
+        "edge 1 2 500 END_OF_LINE\n"
+        "turnaround 1 2 TURN_AROUND_ON_EDGE TURN_AROUND_CW 0 2 1\n",
+        // No length
+        "edge 1 2 0 END_OF_LINE\n",
+        // Nothing at all
+        "# empty\n"
+    };
+    const int count = sizeof(layouts) / sizeof(layouts[0]);
+
+    const NavigationStep before = this->graph.route(NODE5, NODE6, NODE8);
+    for(int i = 0; i < count; i++) {
+        write_graph(layouts[i]);
+        EXPECT_FALSE(this->graph.load(TEST_GRAPH_FILE)) << layouts[i];
+    }
+
+    // The built in layout is kept
+    const NavigationStep& after = this->graph.route(NODE5, NODE6, NODE8);
+    EXPECT_EQ(before.action, after.action);
+    EXPECT_EQ(before.turn, after.turn);
+    EXPECT_EQ(before.skip_lines, after.skip_lines);
+    EXPECT_EQ(before.to, after.to);
+    EXPECT_TRUE(this->graph.edge(NODE5, NODE6).present);
+}
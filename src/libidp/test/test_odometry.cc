@@ -0,0 +1,183 @@
+// IDP Test Suite
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// test_odometry.cc
+// Unit tests for dead reckoning and its calibration
+
+#include <gtest/gtest.h>
+#include <fstream>
+#include "../hal.h"
+#include "../odometry.h"
+#include "temp_dir.h"
+
+using namespace IDP;
+
+/**
+ * Speed to drive the wheels at, well inside the motor range.
+ */
+static const int DRIVE_SPEED = 100;
+
+/**
+ * Time between odometry updates, in microseconds.
+ */
+static const unsigned long long int DRIVE_TICK = 10000;
+
+/**
+ * Comfortably longer than the motors take to ramp to full speed, in
+ * microseconds.
+ */
+static const unsigned long long int SETTLE_TIME = 1000000;
+
+/**
+ * How long to measure over once the motors have settled, in seconds.
+ */
+static const double MEASURE_TIME = 2.0;
+
+class TestOdometry : public ::testing::Test
+{
+    public:
+        TestOdometry(): now(1)
+        {
+        }
+
+        virtual void SetUp()
+        {
+            ASSERT_TRUE(this->dir.ok());
+            this->odometry.update(this->now);
+        }
+
+        /**
+         * Update the odometry every DRIVE_TICK for a while.
+         * \param duration How long to run for, in microseconds
+         */
+        void run(const unsigned long long int duration)
+        {
+            const unsigned long long int end = this->now + duration;
+            while(this->now < end) {
+                this->now += DRIVE_TICK;
+                this->odometry.update(this->now);
+            }
+        }
+
+        /**
+         * Drive at the given wheel speeds until they have settled, then
+         * reset and drive on for MEASURE_TIME.
+         */
+        void measure(const int left, const int right)
+        {
+            this->odometry.command(left, right);
+            this->run(SETTLE_TIME);
+            this->odometry.reset();
+            this->run(static_cast<unsigned long long int>(
+                MEASURE_TIME * 1000000));
+        }
+
+        TempDir dir;
+        unsigned long long int now;
+        Odometry odometry;
+};
+
+TEST_F(TestOdometry, RampsUpToSpeed)
+{
+    this->odometry.command(DRIVE_SPEED, DRIVE_SPEED);
+    this->run(DRIVE_TICK);
+    EXPECT_GT(this->odometry.speed(), 0);
+    EXPECT_LT(this->odometry.speed(),
+        DRIVE_SPEED * ODOMETRY_MM_PER_SPEED_UNIT);
+
+    this->run(SETTLE_TIME);
+    EXPECT_DOUBLE_EQ(DRIVE_SPEED * ODOMETRY_MM_PER_SPEED_UNIT,
+        this->odometry.speed());
+}
+
+TEST_F(TestOdometry, DrivesStraight)
+{
+    this->measure(DRIVE_SPEED, DRIVE_SPEED);
+    const double expected = DRIVE_SPEED * ODOMETRY_MM_PER_SPEED_UNIT *
+        MEASURE_TIME;
+    EXPECT_NEAR(expected, this->odometry.distance(), 1e-6);
+    EXPECT_NEAR(expected, this->odometry.x(), 1e-6);
+    EXPECT_NEAR(0, this->odometry.y(), 1e-6);
+    EXPECT_NEAR(0, this->odometry.heading(), 1e-9);
+    EXPECT_GT(this->odometry.total(), expected);
+}
+
+TEST_F(TestOdometry, SpinsOnTheSpot)
+{
+    this->measure(-DRIVE_SPEED, DRIVE_SPEED);
+    EXPECT_NEAR(0, this->odometry.distance(), 1e-6);
+    EXPECT_NEAR(2 * DRIVE_SPEED * ODOMETRY_MM_PER_SPEED_UNIT /
+        ODOMETRY_WHEEL_BASE * MEASURE_TIME, this->odometry.heading(), 1e-6);
+}
+
+TEST_F(TestOdometry, DrivesInAnArc)
+{
+    // Driving round a quarter circle ends up forwards and to the left
+    // by its radius
+    const double radius = 500.0;
+    const int left = static_cast<int>(DRIVE_SPEED *
+        (radius - ODOMETRY_WHEEL_BASE / 2) / radius);
+    const int right = static_cast<int>(DRIVE_SPEED *
+        (radius + ODOMETRY_WHEEL_BASE / 2) / radius);
+    this->odometry.command(left, right);
+    this->run(SETTLE_TIME);
+    this->odometry.reset();
+
+    const double rate = (right - left) * ODOMETRY_MM_PER_SPEED_UNIT /
+        ODOMETRY_WHEEL_BASE;
+    this->run(static_cast<unsigned long long int>(1.5708 / rate *
+        1000000));
+    const double arc = (left + right) / 2.0 * ODOMETRY_MM_PER_SPEED_UNIT /
+        rate;
+    EXPECT_NEAR(1.5708, this->odometry.heading(), 0.01);
+    EXPECT_NEAR(arc, this->odometry.x(), 5.0);
+    EXPECT_NEAR(arc, this->odometry.y(), 5.0);
+}
+
+TEST_F(TestOdometry, CalibrationScalesTheMovement)
+{
+    this->odometry.calibrate(2 * ODOMETRY_MM_PER_SPEED_UNIT,
+        2 * ODOMETRY_WHEEL_BASE, ODOMETRY_RAMP_TIME_UNIT);
+    this->measure(-DRIVE_SPEED, DRIVE_SPEED);
+    EXPECT_NEAR(2 * DRIVE_SPEED * ODOMETRY_MM_PER_SPEED_UNIT /
+        ODOMETRY_WHEEL_BASE * MEASURE_TIME, this->odometry.heading(), 1e-6);
+
+    this->measure(DRIVE_SPEED, DRIVE_SPEED);
+    EXPECT_NEAR(2 * DRIVE_SPEED * ODOMETRY_MM_PER_SPEED_UNIT * MEASURE_TIME,
+        this->odometry.distance(), 1e-6);
+}
+
+TEST_F(TestOdometry, CalibrationRoundTrips)
+{
+    this->odometry.calibrate(2.5, 210.0, 0.03);
+    ASSERT_TRUE(this->odometry.save(ODOMETRY_FILE));
+
+    Odometry loaded;
+    ASSERT_TRUE(loaded.load(ODOMETRY_FILE));
+    EXPECT_DOUBLE_EQ(2.5, loaded.mm_per_speed_unit());
+    EXPECT_DOUBLE_EQ(210.0, loaded.wheel_base());
+    EXPECT_DOUBLE_EQ(0.03, loaded.ramp_time_unit());
+}
+
+TEST_F(TestOdometry, RejectsABadCalibration)
+{
+    EXPECT_FALSE(this->odometry.load("no_such_odometryfile"));
+
+    std::ofstream f(ODOMETRY_FILE);
+    f << "2.5" << std::endl << "-1" << std::endl << "0.03" << std::endl;
+    f.close();
+    EXPECT_FALSE(this->odometry.load(ODOMETRY_FILE));
+    EXPECT_DOUBLE_EQ(ODOMETRY_MM_PER_SPEED_UNIT,
+        this->odometry.mm_per_speed_unit());
+    EXPECT_DOUBLE_EQ(ODOMETRY_WHEEL_BASE, this->odometry.wheel_base());
+}
+
+TEST_F(TestOdometry, HALLoadsTheCalibration)
+{
+    this->odometry.calibrate(2.5, 210.0, 0.03);
+    ASSERT_TRUE(this->odometry.save(ODOMETRY_FILE));
+
+    HardwareAbstractionLayer hal(0, false, HAL_BACKEND_SIMULATOR);
+    EXPECT_DOUBLE_EQ(2.5, hal.odometry().mm_per_speed_unit());
+    EXPECT_DOUBLE_EQ(210.0, hal.odometry().wheel_base());
+}
@@ -0,0 +1,118 @@
+// IDP Test Suite
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// test_replay_link.cc
+// Unit tests for replaying a recorded link log
+
+#include <gtest/gtest.h>
+#include <fstream>
+#include <robot_instr.h>
+#include "../hal.h"
+#include "../link_log.h"
+#include "../replay_link.h"
+#include "temp_dir.h"
+
+using namespace IDP;
+
+/**
+ * How many ticks to record from the simulator.
+ */
+static const int RECORDED_TICKS = 50;
+
+/**
+ * Most ticks the replay is given to run out.
+ */
+static const int MAX_TICKS = 1000;
+
+/**
+ * Length of a log with a request further ahead than the replay searches.
+ */
+static const int LONG_LOG = 12;
+
+/**
+ * Write a link log of requests, each answered with its position in the
+ * log.
+ */
+static void write_requests(const request_instruction* opcodes,
+    const int count)
+{
+    std::ofstream f(LINK_LOG_FILE, std::ios::out | std::ios::binary);
+    for(int i = 0; i < count; i++) {
+        LinkLogRecord record = {LINK_LOG_REQUEST,
+            static_cast<unsigned char>(opcodes[i]), 0, 0, i, 0};
+        f.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    }
+    f.close();
+}
+
+class TestReplayLink : public ::testing::Test
+{
+    public:
+        virtual void SetUp()
+        {
+            ASSERT_TRUE(this->dir.ok());
+        }
+
+        TempDir dir;
+};
+
+TEST_F(TestReplayLink, SkipsRequestsTheRunDidNotMake)
+{
+    const request_instruction log[] = {ADC1, ADC0, READ_PORT_0};
+    write_requests(log, 3);
+
+    ReplayLink replay(LINK_LOG_FILE);
+    EXPECT_EQ(1, replay.request(ADC0));
+    EXPECT_EQ(2, replay.request(READ_PORT_0));
+    EXPECT_EQ(1u, replay.divergences());
+    EXPECT_EQ(0u, replay.errors());
+    EXPECT_TRUE(replay.finished());
+}
+
+TEST_F(TestReplayLink, GivesUpOnARequestNotNearby)
+{
+    request_instruction log[LONG_LOG];
+    for(int i = 0; i < LONG_LOG - 1; i++)
+        log[i] = ADC0;
+    log[LONG_LOG - 1] = READ_PORT_0;
+    write_requests(log, LONG_LOG);
+
+    // Only the first record is thrown away looking for it
+    ReplayLink replay(LINK_LOG_FILE);
+    EXPECT_EQ(REQUEST_ERROR, replay.request(READ_PORT_0));
+    EXPECT_EQ(1u, replay.errors());
+    EXPECT_EQ(1, replay.request(ADC0));
+    EXPECT_FALSE(replay.finished());
+}
+
+TEST_F(TestReplayLink, MissingLogIsReported)
+{
+    HardwareAbstractionLayer hal(0, false, HAL_BACKEND_REPLAY);
+    EXPECT_TRUE(hal.replay_finished());
+    EXPECT_FALSE(hal.link_up());
+    hal.sample();
+}
+
+TEST_F(TestReplayLink, EndOfLogIsReported)
+{
+    {
+        HardwareAbstractionLayer hal(0, false, HAL_BACKEND_SIMULATOR, true);
+        for(int i = 0; i < RECORDED_TICKS; i++)
+            hal.sample();
+    }
+
+    HardwareAbstractionLayer hal(0, false, HAL_BACKEND_REPLAY);
+    EXPECT_TRUE(hal.link_up());
+    int ticks = 0;
+    while(!hal.replay_finished() && ticks < MAX_TICKS) {
+        hal.sample();
+        ticks++;
+    }
+    EXPECT_TRUE(hal.replay_finished());
+    EXPECT_GE(ticks, RECORDED_TICKS - 1);
+
+    // Sampling on is harmless, with the link down for good
+    hal.sample();
+    hal.sample();
+    EXPECT_FALSE(hal.link_up());
+}
@@ -0,0 +1,64 @@
+// IDP Test Suite
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// test_scheduler.cc
+// Unit tests for the Scheduler overrun count
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include "../scheduler.h"
+
+using namespace IDP;
+
+/**
+ * Rate to run the scheduler at, in Hz.
+ */
+static const unsigned int TEST_RATE = 500;
+
+/**
+ * One period at TEST_RATE, in microseconds.
+ */
+static const unsigned int TEST_PERIOD = 1000000 / TEST_RATE;
+
+TEST(TestScheduler, CountsLateTicks)
+{
+    Scheduler scheduler(TEST_RATE);
+    scheduler.wait();
+    EXPECT_EQ(0u, scheduler.overruns());
+
+    usleep(5 * TEST_PERIOD);
+    scheduler.wait();
+    EXPECT_EQ(1u, scheduler.overruns());
+}
+
+TEST(TestScheduler, CountsStalls)
+{
+    Scheduler scheduler(TEST_RATE);
+    scheduler.wait();
+
+    usleep(2 * SCHEDULER_STALL_PERIODS * TEST_PERIOD);
+    scheduler.wait();
+    EXPECT_EQ(1u, scheduler.overruns());
+    EXPECT_EQ(2u, scheduler.ticks());
+}
+
+TEST(TestScheduler, IdleIsNotAnOverrun)
+{
+    Scheduler scheduler(TEST_RATE);
+    scheduler.wait();
+
+    scheduler.idle();
+    usleep(2 * SCHEDULER_STALL_PERIODS * TEST_PERIOD);
+    scheduler.wait();
+    EXPECT_EQ(0u, scheduler.overruns());
+}
+
+TEST(TestScheduler, NeverLateWithoutARate)
+{
+    Scheduler scheduler(0);
+    scheduler.wait();
+    usleep(5 * TEST_PERIOD);
+    scheduler.wait();
+    EXPECT_EQ(0u, scheduler.overruns());
+    EXPECT_EQ(2u, scheduler.ticks());
+}
@@ -0,0 +1,149 @@
+// IDP Test Suite
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// test_status_watchdog.cc
+// Unit tests for the Status Watchdog, fed from the sim and replay backends
+
+#include <gtest/gtest.h>
+#include <fstream>
+#include <vector>
+#include <robot_instr.h>
+#include "../hal.h"
+#include "../link_log.h"
+#include "../status_watchdog.h"
+#include "temp_dir.h"
+
+using namespace IDP;
+
+/**
+ * How many ticks to record from the simulator, each with a STATUS read.
+ */
+static const int RECORDED_TICKS = 12;
+
+/**
+ * The recorded tick whose STATUS reading shows the emergency stop.
+ */
+static const int EMERGENCY_STOP_TICK = 3;
+
+/**
+ * The recorded tick whose STATUS reading shows a motor fault.
+ */
+static const int MOTOR_FAULT_TICK = 7;
+
+/**
+ * Record a run of the simulator with STATUS read every tick, then
+ * rewrite its STATUS readings to show the emergency stop and a motor
+ * fault once each.
+ */
+static void record_faults()
+{
+    {
+        HardwareAbstractionLayer hal(0, false, HAL_BACKEND_SIMULATOR, true);
+        hal.set_status_interval(1);
+        for(int i = 0; i < RECORDED_TICKS; i++)
+            hal.sample();
+    }
+
+    std::vector<LinkLogRecord> records;
+    std::ifstream in(LINK_LOG_FILE, std::ios::in | std::ios::binary);
+    LinkLogRecord record;
+    while(in.read(reinterpret_cast<char*>(&record), sizeof(record)))
+        records.push_back(record);
+    in.close();
+
+    // The HAL's constructor takes the first reading
+    int reading = -1;
+    for(unsigned int i = 0; i < records.size(); i++) {
+        if(records[i].kind != LINK_LOG_REQUEST ||
+            records[i].opcode != STATUS)
+            continue;
+        if(reading == EMERGENCY_STOP_TICK)
+            records[i].response = STATUS_EMERGENCY_STOP;
+        else if(reading == MOTOR_FAULT_TICK)
+            records[i].response = STATUS_MOTOR_FAULT;
+        reading++;
+    }
+
+    std::ofstream out(LINK_LOG_FILE, std::ios::out | std::ios::binary);
+    for(unsigned int i = 0; i < records.size(); i++)
+        out.write(reinterpret_cast<const char*>(&records[i]),
+            sizeof(records[i]));
+    out.close();
+}
+
+class TestStatusWatchdog : public ::testing::Test
+{
+    public:
+        virtual void SetUp()
+        {
+            ASSERT_TRUE(this->dir.ok());
+        }
+
+        TempDir dir;
+};
+
+TEST_F(TestStatusWatchdog, RaisesLinkErrorsUntilTaken)
+{
+    StatusWatchdog watchdog;
+    SensorFrame frame;
+    frame.status_read = false;
+    frame.status = 0;
+
+    EXPECT_EQ(STATUS_EVENT_NONE, watchdog.check(frame, true));
+    EXPECT_EQ(STATUS_EVENT_LINK_ERROR, watchdog.check(frame, false));
+    EXPECT_EQ(STATUS_EVENT_LINK_ERROR, watchdog.pending_events());
+    EXPECT_EQ(STATUS_EVENT_LINK_ERROR, watchdog.take_events());
+    EXPECT_EQ(STATUS_EVENT_NONE, watchdog.take_events());
+}
+
+TEST_F(TestStatusWatchdog, SimulatorRaisesNothing)
+{
+    HardwareAbstractionLayer hal(0, false, HAL_BACKEND_SIMULATOR);
+    hal.set_status_interval(1);
+    for(int i = 0; i < RECORDED_TICKS; i++) {
+        const SensorFrame& frame = hal.sample();
+        EXPECT_TRUE(frame.status_read);
+        EXPECT_EQ(STATUS_EVENT_NONE, hal.status_events());
+    }
+}
+
+TEST_F(TestStatusWatchdog, DecodesReplayedFaults)
+{
+    record_faults();
+
+    HardwareAbstractionLayer hal(0, false, HAL_BACKEND_REPLAY);
+    hal.set_status_interval(1);
+    StatusWatchdog decoding(true);
+    StatusWatchdog ignoring(false);
+
+    for(int i = 0; i < RECORDED_TICKS; i++) {
+        const SensorFrame& frame = hal.sample();
+        ASSERT_TRUE(frame.status_read);
+        EXPECT_EQ(STATUS_EVENT_NONE, hal.status_events());
+
+        int expected = STATUS_EVENT_NONE;
+        if(i == EMERGENCY_STOP_TICK)
+            expected = STATUS_EVENT_EMERGENCY_STOP;
+        else if(i == MOTOR_FAULT_TICK)
+            expected = STATUS_EVENT_MOTOR_FAULT;
+        EXPECT_EQ(expected, decoding.check(frame, hal.link_up())) << i;
+        EXPECT_EQ(STATUS_EVENT_NONE, ignoring.check(frame, hal.link_up()));
+    }
+
+    EXPECT_EQ(STATUS_EVENT_EMERGENCY_STOP | STATUS_EVENT_MOTOR_FAULT,
+        decoding.take_events());
+}
+
+TEST_F(TestStatusWatchdog, ReplayRaisesLinkErrorAtEndOfLog)
+{
+    record_faults();
+
+    HardwareAbstractionLayer hal(0, false, HAL_BACKEND_REPLAY);
+    hal.set_status_interval(1);
+    for(int i = 0; i < RECORDED_TICKS; i++)
+        hal.sample();
+    EXPECT_EQ(STATUS_EVENT_NONE, hal.status_events());
+
+    hal.sample();
+    EXPECT_EQ(STATUS_EVENT_LINK_ERROR, hal.status_events());
+}
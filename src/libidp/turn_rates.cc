@@ -0,0 +1,118 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// turn_rates.cc
+// Turn Rates class implementation
+
+#include <fstream>
+
+#include "turn_rates.h"
+
+// Debug functionality
+#define MODULE_NAME "TurnRates"
+#define TRACE_ENABLED   false
+#define DEBUG_ENABLED   false
+#define INFO_ENABLED    true
+#define ERROR_ENABLED   true
+#include "debug.h"
+
+namespace IDP {
+
+    /**
+     * Start with DEFAULT_TURN_RATE for every kind of turn.
+     */
+    TurnRates::TurnRates()
+    {
+        TRACE("TurnRates()");
+        for(int i = 0; i < MAX_TURN_DIRECTION; i++)
+            this->_rates[i] = DEFAULT_TURN_RATE;
+    }
+
+    /**
+     * Load the turn rates. See misc/turnsfile_format.
+     * \param filename The file to read them from
+     * \returns true if every rate was loaded, otherwise false and the
+     * current rates are kept
+     */
+    bool TurnRates::load(const char* filename)
+    {
+        TRACE("load(" << filename << ")");
+
+        std::ifstream f(filename);
+        if(!f.is_open()) {
+            DEBUG("Could not open " << filename);
+            return false;
+        }
+
+        double rates[MAX_TURN_DIRECTION];
+        for(int i = 0; i < MAX_TURN_DIRECTION; i++) {
+            if(!(f >> rates[i]) || rates[i] <= 0) {
+                ERROR("Missing or bad turn rate in " << filename <<
+                    ", ignoring it");
+                return false;
+            }
+        }
+        f.close();
+
+        for(int i = 0; i < MAX_TURN_DIRECTION; i++)
+            this->_rates[i] = rates[i];
+        INFO("Read turn rates from " << filename);
+        return true;
+    }
+
+    /**
+     * Save the turn rates, so the next run starts from them.
+     * \param filename The file to write them to
+     * \returns true if they were written
+     */
+    bool TurnRates::save(const char* filename) const
+    {
+        TRACE("save(" << filename << ")");
+
+        std::ofstream f(filename);
+        if(!f.is_open()) {
+            ERROR("Could not write turn rates to " << filename);
+            return false;
+        }
+
+        for(int i = 0; i < MAX_TURN_DIRECTION; i++)
+            f << this->_rates[i] << std::endl;
+        f.close();
+        return true;
+    }
+
+    /**
+     * The learned rate for a kind of turn.
+     * \param dir The kind of turn
+     * \returns The rate, in radians per second per unit of difference
+     * between the wheel speeds
+     */
+    double TurnRates::rate(const LineFollowingTurnDirection dir) const
+    {
+        return this->_rates[dir];
+    }
+
+    /**
+     * Fold a measurement from a finished turn into the learned rate.
+     * \param dir The kind of turn
+     * \param measured The rate measured over the turn
+     */
+    void TurnRates::learn(const LineFollowingTurnDirection dir,
+        const double measured)
+    {
+        TRACE("learn(" << LineFollowingTurnDirectionStrings[dir] << ", " <<
+            measured << ")");
+
+        double rate = this->_rates[dir];
+        double limited = measured;
+        if(limited > 2 * rate)
+            limited = 2 * rate;
+        else if(limited < rate / 2)
+            limited = rate / 2;
+
+        this->_rates[dir] = rate + TURN_LEARNING_RATE * (limited - rate);
+        INFO("Learned " << LineFollowingTurnDirectionStrings[dir] <<
+            " rate " << this->_rates[dir] << " from " << measured);
+    }
+}
+
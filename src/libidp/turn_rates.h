@@ -0,0 +1,58 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// turn_rates.h
+// Turn Rates class definition
+//
+// Turn Rates - how fast the robot turns for each kind of turn, learned
+// from the turns it has made and kept between runs
+
+#pragma once
+#ifndef LIBIDP_TURN_RATES_H
+#define LIBIDP_TURN_RATES_H
+
+#include "line_following.h"
+
+namespace IDP {
+
+    /**
+     * File the learned turn rates are kept in
+     */
+    const char* const TURN_RATES_FILE = "turnsfile";
+
+    /**
+     * Turn rate to assume before any turns have been measured, in radians
+     * per second per unit of difference between the wheel speeds. This is
+     * on the high side, so the first turns slow down too early rather
+     * than too late.
+     */
+    const double DEFAULT_TURN_RATE = 0.015;
+
+    /**
+     * How much of each new measurement goes into the learned rate.
+     */
+    const double TURN_LEARNING_RATE = 0.3;
+
+    /**
+     * The learned rate for each LineFollowingTurnDirection.
+     *
+     * A measurement more than twice or less than half the current rate is
+     * limited to that, so one odd turn, such as one where we slipped or
+     * were knocked, cannot throw the rate off by much.
+     */
+    class TurnRates
+    {
+        public:
+            TurnRates();
+            bool load(const char* filename);
+            bool save(const char* filename) const;
+            double rate(const LineFollowingTurnDirection dir) const;
+            void learn(const LineFollowingTurnDirection dir,
+                const double measured);
+        private:
+            double _rates[MAX_TURN_DIRECTION];
+    };
+}
+
+#endif /* LIBIDP_TURN_RATES_H */
+
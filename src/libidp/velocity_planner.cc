@@ -0,0 +1,126 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// velocity_planner.cc
+// Velocity Planner class implementation
+
+#include <cmath>
+
+#include "velocity_planner.h"
+#include "hal.h"
+#include "odometry.h"
+
+// Debug functionality
+#define MODULE_NAME "VelPlanner"
+#define TRACE_ENABLED   false
+#define DEBUG_ENABLED   false
+#define INFO_ENABLED    true
+#define ERROR_ENABLED   true
+#include "debug.h"
+
+namespace IDP {
+
+    /**
+     * Start with a segment of unknown length.
+     * \param odometry The Odometry to measure distance along segments
+     * with
+     */
+    VelocityPlanner::VelocityPlanner(const Odometry* odometry):
+        _odometry(odometry), _length(0), _start(0), _travelled(0),
+        _speed(0), _last_timestamp(0)
+    {
+        TRACE("VelocityPlanner(" << odometry << ")");
+    }
+
+    /**
+     * Start planning a new segment, from the node we are at now.
+     * \param length The length of the segment in millimetres, or 0 if
+     * it is not known
+     */
+    void VelocityPlanner::start_segment(const unsigned int length)
+    {
+        TRACE("start_segment(" << length << ")");
+        this->_length = length;
+        this->_start = this->_odometry->distance();
+        this->_travelled = 0;
+    }
+
+    /**
+     * We have turned around part way along the segment, so what was
+     * behind us is now ahead.
+     */
+    void VelocityPlanner::reverse()
+    {
+        TRACE("reverse()");
+        double ahead = this->remaining();
+        this->_start = this->_odometry->distance();
+        this->_travelled = ahead > 0 ? ahead : 0;
+    }
+
+    /**
+     * Work out how fast to go now.
+     * \param timestamp The time now, in microseconds
+     * \param current The motor speed we have been driving at since the
+     * last call
+     * \param slow_at_end Whether we need to be at APPROACH_SPEED by the
+     * end of the segment
+     * \returns The motor speed to drive at
+     */
+    unsigned short int VelocityPlanner::speed(
+        const unsigned long long int timestamp,
+        const unsigned short int current, const bool slow_at_end)
+    {
+        TRACE("speed(" << timestamp << ", " << current << ", " <<
+            slow_at_end << ")");
+
+        double elapsed = 0;
+        if(this->_last_timestamp && timestamp > this->_last_timestamp &&
+            timestamp - this->_last_timestamp <= MAX_PLANNER_GAP)
+        {
+            elapsed = (timestamp - this->_last_timestamp) / 1000000.0;
+        }
+        this->_last_timestamp = timestamp;
+
+        // Keep the fractional speed between calls so small steps still
+        // add up, unless someone else has changed the speed since
+        if(static_cast<unsigned short int>(this->_speed + 0.5) != current)
+            this->_speed = current;
+
+        // Speed up towards full speed
+        double speed = this->_speed + PLANNER_ACCELERATION * elapsed;
+        if(speed > MOTOR_MAX_SPEED)
+            speed = MOTOR_MAX_SPEED;
+        if(speed < APPROACH_SPEED)
+            speed = APPROACH_SPEED;
+
+        // Then make sure we can still slow down in time. Decelerating
+        // evenly, v^2 = u^2 + 2as, converting distance into speed units.
+        if(slow_at_end) {
+            double braking = this->remaining() - APPROACH_DISTANCE;
+            double limit = APPROACH_SPEED;
+            if(braking > 0)
+                limit = std::sqrt(static_cast<double>(APPROACH_SPEED) *
+                    APPROACH_SPEED + 2 * PLANNER_DECELERATION * braking /
+                    this->_odometry->mm_per_speed_unit());
+            if(speed > limit)
+                speed = limit;
+        }
+
+        DEBUG(this->remaining() << "mm of " << this->_length <<
+            "mm to go, speed " << speed);
+        this->_speed = speed;
+        return static_cast<unsigned short int>(speed + 0.5);
+    }
+
+    /**
+     * How far there is left to go along the segment.
+     * \returns The estimated distance in millimetres, which is negative
+     * once we are past where the node should be
+     */
+    double VelocityPlanner::remaining() const
+    {
+        return this->_length - this->_travelled -
+            (this->_odometry->distance() - this->_start);
+    }
+}
+
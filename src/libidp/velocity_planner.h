@@ -0,0 +1,78 @@
+// IDP
+// Copyright 2011 Adam Greig & Jon Sowman
+//
+// velocity_planner.h
+// Velocity Planner class definition
+//
+// Velocity Planner - choose the driving speed along a segment of line
+// from how far it is to the next node
+
+#pragma once
+#ifndef LIBIDP_VELOCITY_PLANNER_H
+#define LIBIDP_VELOCITY_PLANNER_H
+
+namespace IDP {
+
+    class Odometry;
+
+    /**
+     * Speed to reach a junction at where we need to turn or stop. This
+     * is the speed the turns have always been made at.
+     */
+    const unsigned short int APPROACH_SPEED = 80;
+
+    /**
+     * How far before a junction we should already be down to
+     * APPROACH_SPEED, in millimetres. This covers the error in the
+     * distance estimate.
+     */
+    const unsigned int APPROACH_DISTANCE = 100;
+
+    /**
+     * How quickly to speed up, in units of motor speed per second.
+     */
+    const double PLANNER_ACCELERATION = 250.0;
+
+    /**
+     * How quickly to slow down, in units of motor speed per second.
+     */
+    const double PLANNER_DECELERATION = 250.0;
+
+    /**
+     * Longest time between two calls to speed() that the robot is
+     * allowed to speed up over, in microseconds. Longer gaps are when
+     * the robot was stopped to do something else.
+     */
+    const unsigned int MAX_PLANNER_GAP = 100000;
+
+    /**
+     * Plan the speed along one segment of line between two nodes.
+     *
+     * The distance driven along the segment is taken from the odometry.
+     * We speed up to MOTOR_MAX_SPEED as soon as we are on the segment
+     * and, if the robot has to turn or stop at the end, slow down just in
+     * time to reach APPROACH_SPEED APPROACH_DISTANCE before the node.
+     * Once past where the node should be we carry on at APPROACH_SPEED
+     * until it is found.
+     */
+    class VelocityPlanner
+    {
+        public:
+            VelocityPlanner(const Odometry* odometry);
+            void start_segment(const unsigned int length);
+            void reverse();
+            unsigned short int speed(const unsigned long long int timestamp,
+                const unsigned short int current, const bool slow_at_end);
+            double remaining() const;
+        private:
+            const Odometry* _odometry;
+            unsigned int _length;
+            double _start;
+            double _travelled;
+            double _speed;
+            unsigned long long int _last_timestamp;
+    };
+}
+
+#endif /* LIBIDP_VELOCITY_PLANNER_H */
+